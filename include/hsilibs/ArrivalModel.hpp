@@ -0,0 +1,115 @@
+/**
+ * @file ArrivalModel.hpp
+ *
+ * Stochastic arrival times of emulated HSI signals.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_ARRIVALMODEL_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_ARRIVALMODEL_HPP_
+
+#include "hsilibs/SignalMapGenerator.hpp"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief A Poisson process that sets a group of signals together.
+ */
+struct ArrivalSource
+{
+  uint32_t signal_map; // NOLINT(build/unsigned) 0: the signals of an arrival are drawn by the user
+  double rate;         // Hz
+};
+
+/**
+ * @brief Alternation of the arrival rates between an on and an off state, e.g. beam
+ * spills. The rates of all sources are multiplied by the factor of the current state.
+ */
+struct ArrivalModulation
+{
+  double on_duration = 0;  // s, 0: no modulation
+  double off_duration = 0; // s
+  double on_rate_factor = 1;
+  double off_rate_factor = 0;
+  bool random_durations = false; // exponentially distributed durations with the above means, otherwise fixed
+};
+
+struct Arrival
+{
+  double time;         // ns
+  uint32_t signal_map; // NOLINT(build/unsigned)
+  bool draw_signals;   // includes an arrival of a source with signal_map 0
+};
+
+/**
+ * @brief Merges independent Poisson sources into one time-ordered stream of arrivals.
+ *
+ * The next arrival time of each source is kept in a binary min-heap, so an arrival
+ * costs a pop, an exponential draw and a push, O(log n) in the number of sources.
+ * Arrivals that fall within the coincidence window of the first one are merged into it.
+ * As the inter-arrival times are memoryless, a change of rate, by the modulation or by
+ * set_rate_scale(), simply redraws the next arrival of every source.
+ *
+ * Times are in ns from the time given to restart().
+ */
+class ArrivalModel
+{
+public:
+  ArrivalModel(std::vector<ArrivalSource> sources,
+               const ArrivalModulation& modulation,
+               double coincidence_window, // ns
+               uint64_t seed = 0);        // NOLINT(build/unsigned)
+
+  void seed(uint64_t seed) { m_rng.seed(seed); } // NOLINT(build/unsigned)
+
+  // start over at time, in the on state
+  void restart(double time);
+
+  // multiplies all rates by scale from time on
+  void set_rate_scale(double scale, double time);
+
+  // infinity if there are no more arrivals
+  double next_time();
+
+  // the next arrival; next_time() must be finite
+  Arrival pop();
+
+  bool is_on() const { return m_on; }
+
+private:
+  using Entry = std::pair<double, size_t>; // next arrival time, source
+
+  void schedule(size_t source, double after);
+  void redraw(double time);
+  double exponential(double mean);
+  double state_duration();
+
+  std::vector<ArrivalSource> m_sources;
+  ArrivalModulation m_modulation;
+  double m_coincidence_window;
+  Xoshiro256pp m_rng;
+
+  std::vector<Entry> m_heap;
+  double m_rate_scale = 1;
+  bool m_modulated;
+  bool m_on = true;
+  double m_next_switch; // ns
+  bool m_has_arrivals;  // whether any source can ever fire
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_ARRIVALMODEL_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
@@ -0,0 +1,83 @@
+/**
+ * @file EmulatedHSIDevice.hpp
+ *
+ * In-process stand-in for an HSI timing firmware device.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_EMULATEDHSIDEVICE_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_EMULATEDHSIDEVICE_HPP_
+
+#include "hsilibs/HSIDeviceInterface.hpp"
+#include "hsilibs/hsireadout/Structs.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief EmulatedHSIDevice emulates the HSI firmware event buffer.
+ *
+ * Events are generated lazily on every buffer read, for all Poisson arrival
+ * times since the previous read, so MHz-equivalent rates cost no background
+ * thread. Bursts are emulated by switching the signal on and off with the
+ * configured periods. Events arriving to a full buffer are lost, as in the
+ * firmware. UDP timeouts, corrupt headers and the IPbus round trip time can be
+ * injected.
+ */
+class EmulatedHSIDevice : public HSIDeviceInterface
+{
+public:
+  explicit EmulatedHSIDevice(const hsireadout::EmulatedDevice& cfg);
+
+  bool endpoint_ready() override;
+  uint32_t read_endpoint_state() override; // NOLINT(build/unsigned)
+  bool read_signal_source_mode() override;
+  void read_data_buffer(std::vector<uint32_t>& words, uint16_t& n_words_in_buffer) override; // NOLINT
+
+  uint64_t get_generated_counter() const { return m_generated_counter; } // NOLINT(build/unsigned)
+  uint64_t get_lost_counter() const { return m_lost_counter; }           // NOLINT(build/unsigned)
+  uint64_t get_timeout_counter() const { return m_timeout_counter; }     // NOLINT(build/unsigned)
+
+private:
+  using clock_t = std::chrono::steady_clock;
+
+  void generate_events(clock_t::time_point until);
+  bool signal_on(clock_t::time_point time) const;
+  void emulate_round_trip() const;
+
+  hsireadout::EmulatedDevice m_cfg;
+
+  std::mt19937_64 m_random_generator;
+  std::exponential_distribution<double> m_interarrival_distribution;
+  std::bernoulli_distribution m_timeout_distribution;
+  std::bernoulli_distribution m_corrupt_header_distribution;
+
+  clock_t::time_point m_start_time;
+  clock_t::time_point m_next_event_time;
+  // converts emulated arrival times to timing system timestamps
+  std::chrono::nanoseconds m_steady_to_system_offset;
+
+  std::vector<uint32_t> m_fifo; // NOLINT(build/unsigned)
+  uint16_t m_sequence_counter;  // NOLINT(build/unsigned)
+
+  uint64_t m_generated_counter; // NOLINT(build/unsigned)
+  uint64_t m_lost_counter;      // NOLINT(build/unsigned)
+  uint64_t m_timeout_counter;   // NOLINT(build/unsigned)
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_EMULATEDHSIDEVICE_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
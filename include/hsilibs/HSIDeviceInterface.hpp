@@ -0,0 +1,51 @@
+/**
+ * @file HSIDeviceInterface.hpp
+ *
+ * Hardware access needed by HSIReadout, implemented for timing
+ * firmware devices and by EmulatedHSIDevice.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_HSIDEVICEINTERFACE_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_HSIDEVICEINTERFACE_HPP_
+
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief Interface to an HSI endpoint and its firmware event buffer.
+ *
+ * Implementations throw HSIReadoutNetworkIssue when the device does not
+ * answer in time. A device is only ever accessed from one thread at a time.
+ */
+class HSIDeviceInterface
+{
+public:
+  virtual ~HSIDeviceInterface() = default;
+
+  virtual bool endpoint_ready() = 0;
+  virtual uint32_t read_endpoint_state() = 0; // NOLINT(build/unsigned)
+  virtual bool read_signal_source_mode() = 0;
+
+  /**
+   * @brief Read all complete events from the firmware buffer.
+   * @param words Replaced by the words read, a multiple of the HSI event size
+   * @param n_words_in_buffer Buffer occupancy [words] before the read
+   */
+  virtual void read_data_buffer(std::vector<uint32_t>& words, uint16_t& n_words_in_buffer) = 0; // NOLINT
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_HSIDEVICEINTERFACE_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
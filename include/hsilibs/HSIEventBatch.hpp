@@ -0,0 +1,58 @@
+/**
+ * @file HSIEventBatch.hpp
+ *
+ * Several HSIEvents sent downstream as one message.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_HSIEVENTBATCH_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_HSIEVENTBATCH_HPP_
+
+#include "dfmessages/HSIEvent.hpp"
+#include "serialization/Serialization.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief HSIEvents in timestamp order, sent in one message to receivers that
+ * declare their connection with the HSIEventBatch data type.
+ */
+struct HSIEventBatch
+{
+  std::vector<dfmessages::HSIEvent> events;
+
+  DUNE_DAQ_SERIALIZE(HSIEventBatch, events);
+};
+
+// a batch counts as all of its events in the drop and timeout statistics of an OutputChannel
+inline size_t
+output_item_count(const HSIEventBatch& batch)
+{
+  return batch.events.size();
+}
+
+inline uint64_t // NOLINT(build/unsigned)
+output_item_last_timestamp(const HSIEventBatch& batch)
+{
+  return batch.events.empty() ? 0 : batch.events.back().timestamp;
+}
+
+} // namespace hsilibs
+
+DUNE_DAQ_SERIALIZABLE(hsilibs::HSIEventBatch, "HSIEventBatch");
+
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_HSIEVENTBATCH_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
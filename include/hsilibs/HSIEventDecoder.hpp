@@ -0,0 +1,84 @@
+/**
+ * @file HSIEventDecoder.hpp
+ *
+ * Batch decoder for the raw words read out of the HSI firmware buffer.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_HSIEVENTDECODER_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_HSIEVENTDECODER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief Number of 32 bit words per event in the HSI firmware buffer
+ * (header, timestamp low, timestamp high, data, trigger).
+ * Must match timing::g_hsi_event_size.
+ */
+const constexpr std::size_t HSI_BUFFER_EVENT_SIZE = 5;
+
+/**
+ * @brief Value of the upper 16 bits of a valid HSI buffer event header.
+ */
+const constexpr uint32_t HSI_BUFFER_EVENT_HEADER_MARKER = 0xaa00; // NOLINT(build/unsigned)
+
+/**
+ * @brief HSI buffer events decoded in structure-of-arrays layout.
+ *
+ * An event is valid if its header carries HSI_BUFFER_EVENT_HEADER_MARKER
+ * and its timestamp is not 0. The arrays are reused between decode calls,
+ * so a long-lived instance stops allocating once it has seen the largest batch.
+ */
+struct HSIDecodedEvents
+{
+  std::vector<uint64_t> timestamps; // NOLINT(build/unsigned)
+  std::vector<uint32_t> device_ids; // NOLINT(build/unsigned)
+  std::vector<uint32_t> counters;   // NOLINT(build/unsigned)
+  std::vector<uint32_t> data;       // NOLINT(build/unsigned)
+  std::vector<uint32_t> triggers;   // NOLINT(build/unsigned)
+  std::vector<uint64_t> valid_mask; // NOLINT(build/unsigned)
+
+  std::size_t size = 0;
+  std::size_t n_valid = 0;
+
+  bool is_valid(std::size_t i) const { return (valid_mask[i / 64] >> (i % 64)) & 0x1; }
+
+  uint32_t header(std::size_t i) const { return (device_ids[i] << 16) | counters[i]; } // NOLINT(build/unsigned)
+
+  void resize(std::size_t n_events);
+};
+
+/**
+ * @brief Decode n_words words of HSI buffer data into events.
+ *
+ * Trailing words that do not make up a complete event are ignored.
+ * Uses AVX2 when the CPU supports it, a scalar loop otherwise.
+ *
+ * @return Number of decoded events
+ */
+std::size_t
+decode_hsi_events(const uint32_t* words, std::size_t n_words, HSIDecodedEvents& events); // NOLINT(build/unsigned)
+
+/**
+ * @brief Same as decode_hsi_events, always with the scalar loop.
+ * Reference for the vectorised path.
+ */
+std::size_t
+decode_hsi_events_scalar(const uint32_t* words, std::size_t n_words, HSIDecodedEvents& events); // NOLINT
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_HSIEVENTDECODER_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
@@ -7,7 +7,11 @@
 #ifndef HSILIBS_INCLUDE_HSILIBS_HSIEVENTSENDER_HPP_
 #define HSILIBS_INCLUDE_HSILIBS_HSIEVENTSENDER_HPP_
 
+#include "hsilibs/HSIEventBatch.hpp"
 #include "hsilibs/Issues.hpp"
+#include "hsilibs/LatencyHistogram.hpp"
+#include "hsilibs/OutputChannel.hpp"
+#include "hsilibs/ShmRing.hpp"
 #include "hsilibs/Types.hpp"
 
 #include "appfwk/DAQModule.hpp"
@@ -23,6 +27,18 @@
 #include <string>
 #include <vector>
 
+// Per-event debug messages are compiled out unless built with HSILIBS_EVENT_TRACE
+#ifdef HSILIBS_EVENT_TRACE
+// NOLINTNEXTLINE(build/define_used)
+#define TLOG_EVENT_DEBUG(lvl) TLOG_DEBUG(lvl)
+#else
+// NOLINTNEXTLINE(build/define_used)
+#define TLOG_EVENT_DEBUG(lvl)                                                                                        \
+  if (true) {                                                                                                          \
+  } else                                                                                                               \
+    TLOG_DEBUG(lvl)
+#endif
+
 namespace dunedaq {
 namespace hsilibs {
 
@@ -53,18 +69,88 @@ protected:
 
   // Configuration
   std::string m_hsievent_send_connection;
-  std::chrono::milliseconds m_queue_timeout;
 
   using raw_sender_ct = iomanager::SenderConcept<HSI_FRAME_STRUCT>;
+  using raw_chunk_sender_ct = iomanager::SenderConcept<HSI_SUPERCHUNK_STRUCT>;
+
+  // back-pressure handling of the outputs; only one of the two HSIEvent outputs, and one of
+  // the two raw data outputs, is used, depending on the data types of the connections
+  OutputChannel<dfmessages::HSIEvent> m_hsievent_output;
+  OutputChannel<HSIEventBatch> m_hsievent_batch_output;
+  OutputChannel<HSI_FRAME_STRUCT> m_raw_hsi_data_output;
+  OutputChannel<HSI_SUPERCHUNK_STRUCT> m_raw_hsi_chunk_output;
+
+  // looked up once, when the connection is set. If the connection has the HSIEventBatch
+  // data type, events are sent in batches, otherwise one by one
+  std::shared_ptr<iomanager::SenderConcept<dfmessages::HSIEvent>> m_hsievent_sender;
+  std::shared_ptr<iomanager::SenderConcept<HSIEventBatch>> m_hsievent_batch_sender;
+  void set_hsievent_send_connection(const std::string& connection);
+
+  // looked up once, at init. If the connection has the HSISuperChunk data type, raw frames
+  // are sent packed in superchunks, otherwise one by one
+  std::shared_ptr<raw_sender_ct> m_raw_hsi_data_sender;
+  std::shared_ptr<raw_chunk_sender_ct> m_raw_hsi_chunk_sender;
+  void set_raw_hsi_data_send_connection(const std::string& connection);
+
+  // set up by configure_outputs for outputs with the shm transport, which then take the place of the connections
+  std::unique_ptr<ShmRingSender<dfmessages::HSIEvent>> m_hsievent_shm_sender;
+  std::unique_ptr<ShmRingSender<HSI_FRAME_STRUCT>> m_raw_hsi_shm_sender;
+  bool send_hsievent_batches() const { return m_hsievent_batch_sender && !m_hsievent_shm_sender; }
+  bool send_raw_hsi_chunks() const { return m_raw_hsi_chunk_sender && !m_raw_hsi_shm_sender; }
+
+  // to be called after the connections are set
+  void configure_outputs(const hsieventsender::OutputPolicy& hsievent_policy,
+                         const hsieventsender::OutputPolicy& raw_policy);
+  void start_outputs(uint64_t run_number); // NOLINT(build/unsigned)
+
+  // push events to HSIEvent output queue; return whether the event was sent straight away, rather than
+  // dropped or kept back by the output policy
+  virtual bool send_hsi_event(dfmessages::HSIEvent& event, const std::string& location);
+  virtual bool send_hsi_event(dfmessages::HSIEvent& event);
+  // sends n_events events, in messages of up to batch_size events if the connection takes batches.
+  // If sent is given, sent[i] tells whether events[i] was sent straight away
+  virtual void send_hsi_events(const dfmessages::HSIEvent* events, size_t n_events, bool* sent = nullptr);
+  virtual void send_raw_hsi_data(const HSI_FRAME_STRUCT& frame, raw_sender_ct* sender);
+  // sends n_frames frames in timestamp order, in superchunks if the connection takes them
+  virtual void send_raw_hsi_frames(const HSI_FRAME_STRUCT* frames, size_t n_frames);
 
-  // push events to HSIEvent output queue
-  virtual void send_hsi_event(dfmessages::HSIEvent& event, const std::string& location);
-  virtual void send_hsi_event(dfmessages::HSIEvent& event) { send_hsi_event(event, m_hsievent_send_connection); }
-  virtual void send_raw_hsi_data(const std::array<uint32_t, 7>& raw_data, raw_sender_ct* sender);
+  // statistics of whichever HSIEvent output is in use
+  uint64_t get_dropped_hsi_events_counter() const; // NOLINT(build/unsigned)
+  uint64_t get_spilled_hsi_events_counter() const; // NOLINT(build/unsigned)
+  size_t get_hsi_event_backlog_size() const;
+
+  // statistics of whichever raw data output is in use, in frames
+  uint64_t get_dropped_raw_hsi_frames_counter() const; // NOLINT(build/unsigned)
+  uint64_t get_spilled_raw_hsi_frames_counter() const; // NOLINT(build/unsigned)
+  size_t get_raw_hsi_frame_backlog_size() const;
+
+  // fills all fields of a raw HSI frame: frame version 1, detector id 1
+  static void fill_hsi_frame(HSI_FRAME_STRUCT& frame,
+                             uint32_t link,     // NOLINT(build/unsigned)
+                             uint64_t ts,       // NOLINT(build/unsigned)
+                             uint32_t data,     // NOLINT(build/unsigned)
+                             uint32_t trigger,  // NOLINT(build/unsigned)
+                             uint32_t counter); // NOLINT(build/unsigned)
+
+  // sends what the drop_oldest policy kept locally; with final set, whatever cannot be sent is dropped
+  void flush_outputs(bool final = false);
 
   std::atomic<uint64_t> m_sent_counter;           // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_failed_to_send_counter; // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_last_sent_timestamp;    // NOLINT(build/unsigned)
+
+  // Latencies [ns], read (and restarted) by get_info of the derived modules
+  LatencyHistogram m_send_latency;     // time blocked in a send call, to either output
+  LatencyHistogram m_dispatch_latency; // from decoding or generating an event until both its copies are sent
+
+  // reused between batches; the events of m_hsievent_batch are gone once it is moved into a sender
+  HSIEventBatch m_hsievent_batch;
+  size_t m_hsievent_batch_size;
+  HSI_SUPERCHUNK_STRUCT m_raw_hsi_chunk;
+
+  // p99 latency budget [us]; 0 disables the check
+  uint64_t m_latency_budget; // NOLINT(build/unsigned)
+  void check_latency_budget(const std::string& interval, const LatencySummary& latency);
 };
 } // namespace hsilibs
 } // namespace dunedaq
@@ -0,0 +1,182 @@
+/**
+ * @file HSIRecording.hpp
+ *
+ * Compact, indexed recording of HSI frames.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_HSIRECORDING_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_HSIRECORDING_HPP_
+
+#include "hsilibs/Types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * The recording file is a stream of self-contained chunks, each a multiple of
+ * HSI_RECORDING_ALIGNMENT bytes: a chunk header followed by the encoded frames. Within a
+ * chunk each frame is a tag byte and the fields that cannot be predicted from the frame
+ * before it:
+ *  - the timestamp, as a varint of the difference to the previous timestamp;
+ *  - the link, only if it differs from that of the previous frame;
+ *  - the DAQ header word, only if it changed since the previous frame of the link;
+ *  - the sequence counter, only if it is not that of the previous frame of the link
+ *    plus one;
+ *  - the input and trigger words, as an index into a small dictionary of the recent
+ *    signal maps, or literally if they are not in it.
+ * Next to it, <file>.idx holds one entry per chunk with its time range and offset, so
+ * a reader finds the chunk of a timestamp with a binary search.
+ */
+const constexpr size_t HSI_RECORDING_ALIGNMENT = 4096;
+
+struct HSIRecordingIndexEntry
+{
+  uint64_t first_timestamp; // NOLINT(build/unsigned)
+  uint64_t last_timestamp;  // NOLINT(build/unsigned)
+  uint64_t offset;          // NOLINT(build/unsigned) of the chunk in the recording file
+  uint32_t n_frames;        // NOLINT(build/unsigned)
+  uint32_t size;            // NOLINT(build/unsigned) of the chunk including padding
+};
+
+/**
+ * @brief Encodes HSI frames into chunks and writes them with aligned writes, with
+ * O_DIRECT where the file system supports it.
+ *
+ * write() only encodes into the current chunk; the chunk is written to disk by flush(),
+ * which the caller calls when full() or when it is done, so that the disk write can
+ * happen outside any section that holds up the data taking. One thread at a time may
+ * use the writer.
+ */
+class HSIRecordingWriter
+{
+public:
+  /**
+   * @brief Creates (or truncates) the recording file and its index.
+   * @param chunk_size Largest size of a chunk, rounded up to HSI_RECORDING_ALIGNMENT
+   * @throws HSIRecordingIssue if the files cannot be created
+   */
+  HSIRecordingWriter(const std::string& path, size_t chunk_size, bool use_o_direct);
+  ~HSIRecordingWriter();
+
+  HSIRecordingWriter(const HSIRecordingWriter&) = delete;
+  HSIRecordingWriter& operator=(const HSIRecordingWriter&) = delete;
+
+  // the current chunk may not have room for another superchunk
+  bool full() const { return m_chunk_size - m_position < s_max_encoded_frame_size * HSI_SUPERCHUNK_MAX_FRAMES; }
+
+  // precondition: !full()
+  void write(const detdataformats::HSIFrame& frame);
+  void write(const HSI_FRAME_STRUCT& frame) { write(frame.frame); }
+  void write(const HSI_SUPERCHUNK_STRUCT& chunk);
+
+  /**
+   * @brief Writes the current chunk and its index entry, if it holds any frame.
+   * @throws HSIRecordingIssue if the write fails
+   */
+  void flush();
+
+  uint64_t get_frames_written() const { return m_frames_written; } // NOLINT(build/unsigned)
+  uint64_t get_bytes_written() const { return m_offset; }          // NOLINT(build/unsigned)
+  const std::string& get_path() const { return m_path; }
+
+  // tag, timestamp, link, header word, sequence counter and signal map
+  static constexpr size_t s_max_encoded_frame_size = 1 + 10 + 1 + 4 + 10 + 3 * 5;
+  static constexpr size_t s_dictionary_size = 15;
+  // 6 bit link field
+  static constexpr size_t s_max_links = 64;
+
+private:
+  void start_chunk();
+
+  std::string m_path;
+  size_t m_chunk_size;
+  int m_fd;
+  int m_index_fd;
+  bool m_o_direct;
+  unsigned char* m_buffer;
+  size_t m_position;
+  uint64_t m_offset;         // NOLINT(build/unsigned)
+  uint64_t m_frames_written; // NOLINT(build/unsigned)
+
+  // state of the current chunk
+  uint32_t m_n_frames;          // NOLINT(build/unsigned)
+  uint64_t m_first_timestamp;   // NOLINT(build/unsigned)
+  uint64_t m_previous_ts;   // NOLINT(build/unsigned)
+  uint32_t m_previous_link; // NOLINT(build/unsigned)
+  uint64_t m_links_seen;    // NOLINT(build/unsigned)
+  uint32_t m_link_header[s_max_links];   // NOLINT(build/unsigned)
+  uint32_t m_link_sequence[s_max_links]; // NOLINT(build/unsigned)
+  uint32_t m_dictionary[s_dictionary_size][3]; // NOLINT(build/unsigned)
+  size_t m_dictionary_fill;
+};
+
+/**
+ * @brief Reads back a recording written by HSIRecordingWriter, or a file of raw
+ * HSI_FRAME_STRUCTs as written by the readoutlibs recorder.
+ *
+ * The file is memory-mapped; a compact recording is decoded directly from the mapping.
+ */
+class HSIRecordingReader
+{
+public:
+  /**
+   * @throws HSIRecordingIssue if the recording or its index cannot be read
+   */
+  explicit HSIRecordingReader(const std::string& path);
+  ~HSIRecordingReader();
+
+  HSIRecordingReader(const HSIRecordingReader&) = delete;
+  HSIRecordingReader& operator=(const HSIRecordingReader&) = delete;
+
+  // positions the reader at the first frame not before timestamp, in O(log chunks) or O(log frames)
+  void seek(uint64_t timestamp); // NOLINT(build/unsigned)
+
+  // @return false at the end of the recording
+  bool next(detdataformats::HSIFrame& frame);
+
+  // empty for raw frames
+  const std::vector<HSIRecordingIndexEntry>& get_index() const { return m_index; }
+  bool is_raw() const { return m_raw; }
+
+private:
+  bool load_chunk(size_t chunk);
+  void decode(detdataformats::HSIFrame& frame);
+
+  std::string m_path;
+  const unsigned char* m_map;
+  size_t m_file_size;
+  bool m_raw;
+  std::vector<HSIRecordingIndexEntry> m_index;
+  const unsigned char* m_chunk;
+  size_t m_chunk_number;
+  size_t m_position; // in the chunk, or the frame number for raw frames
+  uint32_t m_frames_left; // NOLINT(build/unsigned)
+  // the frame seek() stopped at, returned by the next call to next()
+  bool m_has_pending;
+  detdataformats::HSIFrame m_pending;
+
+  uint64_t m_previous_ts;   // NOLINT(build/unsigned)
+  uint32_t m_previous_link; // NOLINT(build/unsigned)
+  uint32_t m_link_header[HSIRecordingWriter::s_max_links];   // NOLINT(build/unsigned)
+  uint32_t m_link_sequence[HSIRecordingWriter::s_max_links]; // NOLINT(build/unsigned)
+  uint32_t m_dictionary[HSIRecordingWriter::s_dictionary_size][3]; // NOLINT(build/unsigned)
+  size_t m_dictionary_fill;
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_HSIRECORDING_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
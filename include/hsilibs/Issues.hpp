@@ -88,6 +88,11 @@ ERS_DECLARE_ISSUE(hsilibs, HSIBufferIssue, "HSI buffer in state: " << buffer_sta
 
 ERS_DECLARE_ISSUE(hsilibs, HSIReadoutIssue, "Failed to read HSI events.", ERS_EMPTY)
 
+ERS_DECLARE_ISSUE(hsilibs,
+                  HSIReadoutConfigurationIssue,
+                  " Invalid HSI readout configuration: " << message,
+                  ((std::string)message))
+
 ERS_DECLARE_ISSUE_BASE(hsilibs,
                        HSIReadoutNetworkIssue,
                        hsilibs::HSIReadoutIssue,
@@ -95,6 +100,50 @@ ERS_DECLARE_ISSUE_BASE(hsilibs,
                        ERS_EMPTY,
                        ERS_EMPTY)
 
+ERS_DECLARE_ISSUE(hsilibs,
+                  OutputBackPressure,
+                  name << ": " << n_timeouts << " send timeout(s) and " << n_dropped << " dropped item(s) with policy "
+                       << policy << " in the last " << interval << " ms",
+                  ((std::string)name)((std::string)policy)((uint64_t)n_timeouts)((uint64_t)n_dropped)( // NOLINT
+                    (uint64_t)interval))                                                               // NOLINT
+
+ERS_DECLARE_ISSUE(hsilibs,
+                  OutputPolicyIssue,
+                  name << ": " << message,
+                  ((std::string)name)((std::string)message))
+
+ERS_DECLARE_ISSUE(hsilibs,
+                  SpillJournalIssue,
+                  " Spill journal " << path << ": " << message,
+                  ((std::string)path)((std::string)message))
+
+ERS_DECLARE_ISSUE(hsilibs,
+                  HSIRecordingIssue,
+                  " HSI recording " << path << ": " << message,
+                  ((std::string)path)((std::string)message))
+
+ERS_DECLARE_ISSUE(hsilibs,
+                  ShmRingIssue,
+                  " Shared memory ring " << name << ": " << message,
+                  ((std::string)name)((std::string)message))
+
+ERS_DECLARE_ISSUE(hsilibs,
+                  ShmRingTimeout,
+                  " Shared memory ring " << name << " stayed full for " << timeout << " ms",
+                  ((std::string)name)((int64_t)timeout)) // NOLINT
+
+ERS_DECLARE_ISSUE(hsilibs,
+                  LatencyBudgetExceeded,
+                  name << ": p99 of the " << interval << " latency is " << p99 << " us, above the budget of " << budget
+                       << " us",
+                  ((std::string)name)((std::string)interval)((double)p99)((uint64_t)budget)) // NOLINT(build/unsigned)
+
+ERS_DECLARE_ISSUE(hsilibs,
+                  CorruptedHSIFrame,
+                  " HSI frame of link " << link << " with timestamp " << ts << ": " << message
+                                        << ". Further errors of this run are only counted",
+                  ((uint32_t)link)((uint64_t)ts)((std::string)message)) // NOLINT(build/unsigned)
+
 ERS_DECLARE_ISSUE(hsilibs,
                   InvalidTriggerRateValue,
                   " Trigger rate value " << trigger_rate << " invalid!",
@@ -0,0 +1,149 @@
+/**
+ * @file LatencyHistogram.hpp
+ *
+ * Lock-free log-linear latency histogram.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_LATENCYHISTOGRAM_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_LATENCYHISTOGRAM_HPP_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief Percentiles of the latencies recorded in a LatencyHistogram [ns].
+ */
+struct LatencySummary
+{
+  uint64_t count = 0; // NOLINT(build/unsigned)
+  uint64_t max = 0;   // NOLINT(build/unsigned)
+  uint64_t p50 = 0;   // NOLINT(build/unsigned)
+  uint64_t p90 = 0;   // NOLINT(build/unsigned)
+  uint64_t p99 = 0;   // NOLINT(build/unsigned)
+};
+
+/**
+ * @brief HDR-style histogram of latencies in ns.
+ *
+ * Values below 16 ns have their own bucket. Above that, every power of 2 is split
+ * into 16 linear sub-buckets, so a percentile is known to within ~6% for any
+ * magnitude, from ns to minutes, with a few hundred counters. Values of 2^40 ns
+ * (~18 min) or more are counted in the last bucket.
+ *
+ * record() is wait-free and can be called from several threads. read() returns the
+ * latencies recorded since the previous read() and starts a new interval.
+ */
+class LatencyHistogram
+{
+public:
+  static constexpr uint32_t s_sub_bucket_bits = 4;                // NOLINT(build/unsigned)
+  static constexpr uint32_t s_sub_buckets = 1u << s_sub_bucket_bits; // NOLINT(build/unsigned)
+  static constexpr uint32_t s_max_value_bits = 40;                // NOLINT(build/unsigned)
+  static constexpr size_t s_num_buckets = (s_max_value_bits - s_sub_bucket_bits + 1) * s_sub_buckets;
+
+  LatencyHistogram() { reset(); }
+
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  void record(uint64_t latency) // NOLINT(build/unsigned)
+  {
+    m_buckets[bucket(latency)].fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+    while (latency > max && !m_max.compare_exchange_weak(max, latency, std::memory_order_relaxed)) {
+    }
+  }
+
+  LatencySummary read()
+  {
+    std::array<uint64_t, s_num_buckets> counts; // NOLINT(build/unsigned)
+
+    LatencySummary summary;
+    for (size_t b = 0; b < s_num_buckets; ++b) {
+      counts[b] = m_buckets[b].exchange(0, std::memory_order_relaxed);
+      summary.count += counts[b];
+    }
+    summary.max = m_max.exchange(0, std::memory_order_relaxed);
+    if (!summary.count)
+      return summary;
+
+    // smallest sample count at or below which each percentile lies
+    const uint64_t p50_rank = (summary.count * 50 + 99) / 100;   // NOLINT(build/unsigned)
+    const uint64_t p90_rank = (summary.count * 90 + 99) / 100;   // NOLINT(build/unsigned)
+    const uint64_t p99_rank = (summary.count * 99 + 99) / 100;   // NOLINT(build/unsigned)
+
+    uint64_t cumulative = 0; // NOLINT(build/unsigned)
+    for (size_t b = 0; b < s_num_buckets && cumulative < p99_rank; ++b) {
+      if (!counts[b])
+        continue;
+      uint64_t before = cumulative; // NOLINT(build/unsigned)
+      cumulative += counts[b];
+      uint64_t value = bucket_midpoint(b); // NOLINT(build/unsigned)
+      if (before < p50_rank && cumulative >= p50_rank)
+        summary.p50 = value;
+      if (before < p90_rank && cumulative >= p90_rank)
+        summary.p90 = value;
+      if (cumulative >= p99_rank)
+        summary.p99 = value;
+    }
+
+    // a bucket midpoint can overshoot the largest recorded value
+    if (summary.p50 > summary.max)
+      summary.p50 = summary.max;
+    if (summary.p90 > summary.max)
+      summary.p90 = summary.max;
+    if (summary.p99 > summary.max)
+      summary.p99 = summary.max;
+    return summary;
+  }
+
+  void reset()
+  {
+    for (auto& count : m_buckets)
+      count.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  static size_t bucket(uint64_t value) // NOLINT(build/unsigned)
+  {
+    if (value < s_sub_buckets)
+      return value;
+    uint32_t msb = 63 - __builtin_clzll(value); // NOLINT(build/unsigned)
+    if (msb >= s_max_value_bits)
+      return s_num_buckets - 1;
+    uint32_t shift = msb - s_sub_bucket_bits; // NOLINT(build/unsigned)
+    return (shift + 1) * s_sub_buckets + ((value >> shift) & (s_sub_buckets - 1));
+  }
+
+  static uint64_t bucket_midpoint(size_t b) // NOLINT(build/unsigned)
+  {
+    if (b < s_sub_buckets)
+      return b;
+    uint32_t shift = b / s_sub_buckets - 1; // NOLINT(build/unsigned)
+    uint64_t low = static_cast<uint64_t>(s_sub_buckets + b % s_sub_buckets) << shift; // NOLINT(build/unsigned)
+    return low + ((1ull << shift) >> 1);
+  }
+
+  std::array<std::atomic<uint64_t>, s_num_buckets> m_buckets; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_max;                                // NOLINT(build/unsigned)
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_LATENCYHISTOGRAM_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
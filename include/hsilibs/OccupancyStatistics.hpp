@@ -0,0 +1,159 @@
+/**
+ * @file OccupancyStatistics.hpp
+ *
+ * Lock-free statistics of a buffer occupancy sampled at every poll.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_OCCUPANCYSTATISTICS_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_OCCUPANCYSTATISTICS_HPP_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief Summary of the occupancy samples in the window of an OccupancyStatistics.
+ *
+ * Bin b of the histogram counts occupancies in [2^(b-1), 2^b - 1]. Bin 0 counts
+ * occupancy 0.
+ */
+struct OccupancySummary
+{
+  static constexpr size_t s_num_bins = 17;
+
+  uint32_t n_samples = 0;  // NOLINT(build/unsigned)
+  uint64_t sum = 0;        // NOLINT(build/unsigned)
+  uint16_t max = 0;        // NOLINT(build/unsigned)
+  std::array<uint32_t, s_num_bins> bins{}; // NOLINT(build/unsigned)
+
+  double average() const { return n_samples ? static_cast<double>(sum) / n_samples : 0.; }
+
+  /**
+   * @brief Occupancy below which a fraction q of the samples lie, interpolated within its histogram bin
+   */
+  double percentile(double q) const
+  {
+    if (!n_samples)
+      return 0.;
+
+    double rank = std::clamp(q, 0., 1.) * n_samples;
+    uint32_t cumulative = 0; // NOLINT(build/unsigned)
+    for (size_t b = 0; b < s_num_bins; ++b) {
+      if (!bins[b] || cumulative + bins[b] < rank) {
+        cumulative += bins[b];
+        continue;
+      }
+      if (b == 0)
+        return 0.;
+      double low = 1u << (b - 1);
+      double high = (1u << b) - 1;
+      return low + (high - low) * (rank - cumulative) / bins[b];
+    }
+    return max;
+  }
+
+  // combines the samples of another buffer into this summary
+  void merge(const OccupancySummary& other)
+  {
+    n_samples += other.n_samples;
+    sum += other.sum;
+    max = std::max(max, other.max);
+    for (size_t b = 0; b < s_num_bins; ++b)
+      bins[b] += other.bins[b];
+  }
+};
+
+/**
+ * @brief Keeps the last s_window_size occupancy samples of a buffer in a ring,
+ * together with their running sum and histogram, so that adding a sample and
+ * reading the statistics are both O(1) and never take a lock.
+ *
+ * There must be a single writer calling add(). Any thread may call read(); it
+ * can see a sample half-accounted while add() runs, which is harmless for monitoring.
+ * The maximum is the largest sample since the previous read() rather than over the
+ * window, so that short spikes between two reads are not missed.
+ */
+class OccupancyStatistics
+{
+public:
+  static constexpr size_t s_window_size = 1024; // must be a power of 2
+
+  OccupancyStatistics() { reset(); }
+
+  OccupancyStatistics(const OccupancyStatistics&) = delete;
+  OccupancyStatistics& operator=(const OccupancyStatistics&) = delete;
+
+  void add(uint16_t occupancy) // NOLINT(build/unsigned)
+  {
+    uint64_t n_added = m_n_added.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+    auto& slot = m_ring[n_added & (s_window_size - 1)];
+
+    uint64_t sum = m_sum.load(std::memory_order_relaxed) + occupancy; // NOLINT(build/unsigned)
+    if (n_added >= s_window_size) {
+      uint16_t evicted = slot.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+      sum -= evicted;
+      m_bins[bin(evicted)].fetch_sub(1, std::memory_order_relaxed);
+    }
+    slot.store(occupancy, std::memory_order_relaxed);
+    m_bins[bin(occupancy)].fetch_add(1, std::memory_order_relaxed);
+    m_sum.store(sum, std::memory_order_relaxed);
+    m_n_added.store(n_added + 1, std::memory_order_release);
+
+    uint16_t max = m_max.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+    while (occupancy > max && !m_max.compare_exchange_weak(max, occupancy, std::memory_order_relaxed)) {
+    }
+  }
+
+  OccupancySummary read()
+  {
+    OccupancySummary summary;
+    summary.n_samples = std::min<uint64_t>(m_n_added.load(std::memory_order_acquire), s_window_size); // NOLINT
+    summary.sum = m_sum.load(std::memory_order_relaxed);
+    summary.max = m_max.exchange(0, std::memory_order_relaxed);
+    for (size_t b = 0; b < OccupancySummary::s_num_bins; ++b)
+      summary.bins[b] = m_bins[b].load(std::memory_order_relaxed);
+    return summary;
+  }
+
+  // only while there is no writer, e.g. at start of run
+  void reset()
+  {
+    for (auto& slot : m_ring)
+      slot.store(0, std::memory_order_relaxed);
+    for (auto& count : m_bins)
+      count.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+    m_n_added.store(0, std::memory_order_release);
+  }
+
+private:
+  static size_t bin(uint16_t occupancy) // NOLINT(build/unsigned)
+  {
+    return occupancy ? 32 - __builtin_clz(occupancy) : 0;
+  }
+
+  std::array<std::atomic<uint16_t>, s_window_size> m_ring; // NOLINT(build/unsigned)
+  std::array<std::atomic<uint32_t>, OccupancySummary::s_num_bins> m_bins; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_sum;     // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_n_added; // NOLINT(build/unsigned)
+  std::atomic<uint16_t> m_max;     // NOLINT(build/unsigned)
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_OCCUPANCYSTATISTICS_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
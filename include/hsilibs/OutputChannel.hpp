@@ -0,0 +1,418 @@
+/**
+ * @file OutputChannel.hpp
+ *
+ * Back-pressure handling for one output of an HSIEventSender.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_OUTPUTCHANNEL_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_OUTPUTCHANNEL_HPP_
+
+#include "hsilibs/Issues.hpp"
+#include "hsilibs/SpillJournal.hpp"
+#include "hsilibs/hsieventsender/Structs.hpp"
+
+#include "dfmessages/HSIEvent.hpp"
+#include "iomanager/IOManager.hpp"
+#include "logging/Logging.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief Number of items counted for item in the statistics of an OutputChannel;
+ * overloaded for types that carry several items in one message.
+ */
+template<class T>
+size_t
+output_item_count(const T&)
+{
+  return 1;
+}
+
+/**
+ * @brief Timestamp of the last item in item, passed to the on_sent callback of an OutputChannel;
+ * overloaded for types that carry several items in one message or have no get_timestamp().
+ */
+template<class T>
+uint64_t // NOLINT(build/unsigned)
+output_item_last_timestamp(const T& item)
+{
+  return item.get_timestamp();
+}
+
+inline uint64_t // NOLINT(build/unsigned)
+output_item_last_timestamp(const dfmessages::HSIEvent& event)
+{
+  return event.timestamp;
+}
+
+/**
+ * @brief Sends items of type T to an iomanager sender, applying the configured
+ * back-pressure policy when a send times out.
+ *
+ * Timeouts and drops are counted and reported at most once per report interval,
+ * as an error if items were dropped and as a warning otherwise.
+ *
+ * With the spill policy, items that cannot be sent are appended to a SpillJournal
+ * file for the run, and later items follow them there until the journal has been
+ * replayed, so the output sees every item in order. A journal that cannot be
+ * replayed before the end of the run is kept on disk. Only trivially copyable
+ * types can be spilled.
+ *
+ * The sender can be an iomanager sender or a ShmRingSender; both throw on timeout.
+ * Each send attempt hands the sender a copy of the item, as a sender may have taken
+ * the item when it times out. Items passed as rvalues are moved into an attempt that
+ * cannot be followed by another one.
+ *
+ * send() and flush() must be called from one thread only; the counters can be read
+ * from any thread.
+ */
+template<class T>
+class OutputChannel
+{
+public:
+  using sender_t = iomanager::SenderConcept<T>;
+
+  /**
+   * @param name Name used in reports, e.g. "<module>/<output>"
+   * @param on_sent Called for every item once it has been sent, with its output_item_count and
+   * output_item_last_timestamp; the item itself may have been moved into the sender by then
+   * @param on_timeout Called for every send attempt that timed out
+   */
+  OutputChannel(std::string name,
+                std::function<void(size_t n_items, uint64_t last_timestamp)> on_sent, // NOLINT(build/unsigned)
+                std::function<void()> on_timeout)
+    : m_name(std::move(name))
+    , m_on_sent(std::move(on_sent))
+    , m_on_timeout(std::move(on_timeout))
+  {}
+
+  /**
+   * @throws OutputPolicyIssue if items of type T cannot be handled with the policy
+   */
+  void configure(const hsieventsender::OutputPolicy& policy)
+  {
+    if (policy.policy == hsieventsender::BackPressurePolicy::spill && !std::is_trivially_copyable_v<T>)
+      throw OutputPolicyIssue(ERS_HERE, m_name, "the items of this output cannot be spilled to a journal");
+
+    m_policy = policy;
+    m_backlog.clear();
+    m_backlog_size = 0;
+  }
+
+  /**
+   * @brief Resets the counters and, with the spill policy, creates the journal file of the run.
+   * @throws SpillJournalIssue if the journal file cannot be created
+   */
+  void start(uint64_t run_number) // NOLINT(build/unsigned)
+  {
+    m_timeout_counter = 0;
+    m_dropped_counter = 0;
+    m_spilled_counter = 0;
+    m_interval_timeouts = 0;
+    m_interval_dropped = 0;
+
+    m_journal.reset();
+    if (m_policy.policy == hsieventsender::BackPressurePolicy::spill) {
+      std::string file_name = m_name;
+      std::replace(file_name.begin(), file_name.end(), '/', '_');
+      m_journal = std::make_unique<SpillJournal>(m_policy.spill_directory + "/" + file_name + "_run" +
+                                                   std::to_string(run_number) + ".journal",
+                                                 sizeof(T),
+                                                 m_policy.spill_capacity);
+      m_replay_tokens = 0;
+      m_last_replay_time = std::chrono::steady_clock::now();
+      m_next_replay_time = m_last_replay_time;
+    }
+  }
+
+  /**
+   * @brief Sends item, or handles it according to the policy if the output is blocked.
+   * @return Whether item was sent
+   */
+  template<class Sender = sender_t>
+  bool send(const T& item, Sender* sender)
+  {
+    return send_item(item, sender);
+  }
+
+  /**
+   * @brief As send(const T&), but item is moved into the sender, or into the backlog, where
+   * it is not needed afterwards.
+   */
+  template<class Sender = sender_t>
+  bool send(T&& item, Sender* sender)
+  {
+    return send_item(std::move(item), sender);
+  }
+
+  /**
+   * @brief Sends what is left of the local backlog, as long as the output accepts it.
+   * @param final No further sends will follow: whatever cannot be sent is dropped and reported straight away
+   */
+  template<class Sender = sender_t>
+  void flush(Sender* sender, bool final = false)
+  {
+    if (m_journal) {
+      replay(sender);
+      if (final)
+        close_journal();
+      report(final);
+      return;
+    }
+
+    while (!m_backlog.empty() && try_send(m_backlog.front(), sender, 1))
+      m_backlog.pop_front();
+
+    if (final) {
+      for (const auto& item : m_backlog)
+        drop(output_item_count(item));
+      m_backlog.clear();
+    }
+    m_backlog_size = m_backlog.size();
+    report(final);
+  }
+
+  uint64_t get_timeout_counter() const { return m_timeout_counter.load(); } // NOLINT(build/unsigned)
+  uint64_t get_dropped_counter() const { return m_dropped_counter.load(); } // NOLINT(build/unsigned)
+  uint64_t get_spilled_counter() const { return m_spilled_counter.load(); } // NOLINT(build/unsigned)
+  size_t get_backlog_size() const { return m_backlog_size.load(); }
+
+private:
+  // Item is const T& or T; an rvalue item is only moved from where it is not needed afterwards
+  template<class Item, class Sender>
+  bool send_item(Item&& item, Sender* sender)
+  {
+    bool sent = false;
+    size_t n_items = output_item_count(item);
+    switch (m_policy.policy) {
+      case hsieventsender::BackPressurePolicy::block:
+        // 0 retries means retrying until the item is sent
+        sent = try_send(std::forward<Item>(item), sender, m_policy.max_retries ? m_policy.max_retries + 1 : 0);
+        if (!sent)
+          drop(n_items);
+        break;
+      case hsieventsender::BackPressurePolicy::drop_newest:
+        sent = try_send(std::forward<Item>(item), sender, 1);
+        if (!sent)
+          drop(n_items);
+        break;
+      case hsieventsender::BackPressurePolicy::drop_oldest:
+        // older items go first
+        flush(sender);
+        // kept in the backlog if the send fails
+        if (m_backlog.empty())
+          sent = try_send(item, sender, 1);
+        if (!sent) {
+          m_backlog.push_back(std::forward<Item>(item));
+          if (m_backlog.size() > m_policy.queue_size) {
+            drop(output_item_count(m_backlog.front()));
+            m_backlog.pop_front();
+          }
+          m_backlog_size = m_backlog.size();
+        }
+        break;
+      case hsieventsender::BackPressurePolicy::spill:
+        // later items queue up behind spilled ones
+        replay(sender);
+        if (m_journal->empty())
+          sent = try_send(item, sender, 1);
+        if (!sent)
+          spill(item);
+        break;
+    }
+    report(false);
+    return sent;
+  }
+
+  // max_attempts 0 keeps trying until the item is sent. An rvalue item is moved into the last
+  // attempt, earlier ones send a copy
+  template<class Item, class Sender>
+  bool try_send(Item&& item, Sender* sender, uint32_t max_attempts) // NOLINT(build/unsigned)
+  {
+    size_t n_items = output_item_count(item);
+    uint64_t last_timestamp = output_item_last_timestamp(item); // NOLINT(build/unsigned)
+    for (uint32_t attempt = 0; max_attempts == 0 || attempt < max_attempts; ++attempt) { // NOLINT(build/unsigned)
+      try {
+        if constexpr (std::is_lvalue_reference_v<Item>) {
+          T item_copy(item);
+          sender->send(std::move(item_copy), std::chrono::milliseconds(m_policy.send_timeout));
+        } else if (attempt + 1 == max_attempts) {
+          sender->send(std::move(item), std::chrono::milliseconds(m_policy.send_timeout));
+        } else {
+          T item_copy(item);
+          sender->send(std::move(item_copy), std::chrono::milliseconds(m_policy.send_timeout));
+        }
+        m_on_sent(n_items, last_timestamp);
+        return true;
+      } catch (const dunedaq::iomanager::TimeoutExpired&) {
+        on_timeout();
+      } catch (const ShmRingTimeout&) {
+        on_timeout();
+      }
+    }
+    return false;
+  }
+
+  void on_timeout()
+  {
+    ++m_timeout_counter;
+    ++m_interval_timeouts;
+    m_on_timeout();
+    report(false);
+  }
+
+  // spilled items are stored as raw bytes, configure() does not allow the policy for other types
+  void spill(const T& item)
+  {
+    if constexpr (std::is_trivially_copyable_v<T>) {
+      if (m_journal->append(&item))
+        m_spilled_counter += output_item_count(item);
+      else
+        drop(output_item_count(item));
+      m_backlog_size = m_journal->size();
+    }
+  }
+
+  // sends spilled items in order, no faster than the replay rate
+  template<class Sender>
+  void replay(Sender* sender)
+  {
+    if (m_journal->empty())
+      return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (now < m_next_replay_time)
+      return;
+
+    // allow bursts of up to 10 ms worth of items
+    double max_tokens = std::max(1., m_policy.replay_rate / 100.);
+    double elapsed = std::chrono::duration<double>(now - m_last_replay_time).count();
+    m_replay_tokens = std::min(max_tokens, m_replay_tokens + elapsed * m_policy.replay_rate);
+    m_last_replay_time = now;
+
+    while (m_replay_tokens >= 1 && !m_journal->empty()) {
+      bool valid = false;
+      const void* record = m_journal->front(valid);
+      if (!valid) {
+        // torn or overwritten record
+        m_journal->pop_front();
+        drop(1);
+        continue;
+      }
+
+      T item;
+      if constexpr (std::is_trivially_copyable_v<T>)
+        std::memcpy(static_cast<void*>(&item), record, sizeof(T));
+      if (!try_send(std::move(item), sender, 1)) {
+        // still blocked, do not hold up the producer with a timeout on every call
+        m_next_replay_time = now + std::chrono::milliseconds(m_policy.replay_probe_interval);
+        break;
+      }
+      m_journal->pop_front();
+      m_replay_tokens -= 1;
+    }
+    m_backlog_size = m_journal->size();
+  }
+
+  void close_journal()
+  {
+    if (m_journal->empty()) {
+      m_journal->remove_on_close();
+    } else {
+      auto message = std::to_string(m_journal->size()) + " item(s) could not be replayed and are left in the file";
+      ers::warning(SpillJournalIssue(ERS_HERE, m_journal->get_path(), message));
+    }
+    m_journal.reset();
+    m_backlog_size = 0;
+  }
+
+  void drop(size_t n_items)
+  {
+    m_dropped_counter += n_items;
+    m_interval_dropped += n_items;
+  }
+
+  void report(bool force)
+  {
+    if (!m_interval_timeouts && !m_interval_dropped)
+      return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (!force && now < m_next_report_time)
+      return;
+
+    OutputBackPressure issue(
+      ERS_HERE, m_name, to_string(m_policy.policy), m_interval_timeouts, m_interval_dropped, m_policy.report_interval);
+    if (m_interval_dropped)
+      ers::error(issue);
+    else
+      ers::warning(issue);
+
+    m_interval_timeouts = 0;
+    m_interval_dropped = 0;
+    m_next_report_time = now + std::chrono::milliseconds(m_policy.report_interval);
+  }
+
+  static std::string to_string(hsieventsender::BackPressurePolicy policy)
+  {
+    switch (policy) {
+      case hsieventsender::BackPressurePolicy::block:
+        return "block";
+      case hsieventsender::BackPressurePolicy::drop_newest:
+        return "drop_newest";
+      case hsieventsender::BackPressurePolicy::drop_oldest:
+        return "drop_oldest";
+      case hsieventsender::BackPressurePolicy::spill:
+        return "spill";
+    }
+    return "unknown";
+  }
+
+  std::string m_name;
+  std::function<void(size_t, uint64_t)> m_on_sent; // NOLINT(build/unsigned)
+  std::function<void()> m_on_timeout;
+
+  hsieventsender::OutputPolicy m_policy;
+  std::deque<T> m_backlog;
+  std::atomic<size_t> m_backlog_size{ 0 };
+
+  std::atomic<uint64_t> m_timeout_counter{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_dropped_counter{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_spilled_counter{ 0 }; // NOLINT(build/unsigned)
+
+  // spill policy
+  std::unique_ptr<SpillJournal> m_journal;
+  double m_replay_tokens = 0;
+  std::chrono::steady_clock::time_point m_last_replay_time;
+  std::chrono::steady_clock::time_point m_next_replay_time;
+
+  // reporting
+  uint64_t m_interval_timeouts = 0; // NOLINT(build/unsigned)
+  uint64_t m_interval_dropped = 0;  // NOLINT(build/unsigned)
+  std::chrono::steady_clock::time_point m_next_report_time;
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_OUTPUTCHANNEL_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
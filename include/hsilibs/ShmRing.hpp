@@ -0,0 +1,186 @@
+/**
+ * @file ShmRing.hpp
+ *
+ * Single-producer/single-consumer ring of fixed-size records in POSIX shared memory.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_SHMRING_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_SHMRING_HPP_
+
+#include "hsilibs/Issues.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief Lock-free FIFO of fixed-size records shared between two processes on one host.
+ *
+ * The segment (/dev/shm/<name>) holds a header with the write and read positions,
+ * each on its own cache line, followed by capacity slots. Whichever side opens the
+ * ring first creates and initialises the segment; the other side attaches to it and
+ * checks that record size and capacity agree.
+ *
+ * Records are written and read in place: the producer claims a slot, fills it and
+ * commits it, the consumer reads the front slot and pops it. A side waiting for data
+ * or space sleeps on a futex in the segment and is only woken when the other side
+ * sees it waiting, so the fast path makes no system call.
+ *
+ * There must be a single producer thread and a single consumer thread, in any processes.
+ */
+class ShmRing
+{
+public:
+  /**
+   * @brief Creates the shared memory segment, or attaches to an existing one, and maps it.
+   * @throws ShmRingIssue if the segment cannot be created or mapped, or has another geometry
+   */
+  ShmRing(const std::string& name, size_t record_size, size_t capacity);
+  ~ShmRing();
+
+  ShmRing(const ShmRing&) = delete;
+  ShmRing& operator=(const ShmRing&) = delete;
+
+  // producer side
+
+  /**
+   * @return The slot to write the next record to, nullptr if the ring is full
+   */
+  void* claim();
+  // publishes the record written to the claimed slot
+  void commit();
+  /**
+   * @return false if the ring is still full after timeout
+   */
+  bool wait_for_space(std::chrono::milliseconds timeout);
+
+  // consumer side
+
+  /**
+   * @return The oldest record, nullptr if the ring is empty
+   */
+  const void* front() const;
+  void pop_front();
+  /**
+   * @return false if the ring is still empty after timeout
+   */
+  bool wait_for_data(std::chrono::milliseconds timeout);
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+  size_t get_capacity() const { return m_capacity; }
+  const std::string& get_name() const { return m_name; }
+
+  // removes the segment when closing; a side attached to it keeps its mapping
+  void remove_on_close() { m_remove_on_close = true; }
+
+private:
+  struct Header;
+
+  unsigned char* slot(uint64_t sequence) const; // NOLINT(build/unsigned)
+
+  std::string m_name;
+  size_t m_record_size;
+  size_t m_slot_size;
+  size_t m_capacity;
+  size_t m_segment_size;
+  unsigned char* m_map;
+  Header* m_header;
+  bool m_remove_on_close;
+};
+
+/**
+ * @brief Producer end of a ShmRing of items of type T, with the send() interface of an
+ * iomanager sender so that an OutputChannel can use it.
+ */
+template<class T>
+class ShmRingSender
+{
+public:
+  static_assert(std::is_trivially_copyable_v<T>, "items are copied into shared memory as raw bytes");
+
+  /**
+   * @brief The segment is removed when the sender is destroyed.
+   * @throws ShmRingIssue if the ring cannot be opened
+   */
+  ShmRingSender(const std::string& name, size_t capacity)
+    : m_ring(name, sizeof(T), capacity)
+  {
+    m_ring.remove_on_close();
+  }
+
+  /**
+   * @throws ShmRingTimeout if the ring stays full for timeout
+   */
+  void send(T&& item, std::chrono::milliseconds timeout)
+  {
+    void* slot = m_ring.claim();
+    if (!slot && m_ring.wait_for_space(timeout))
+      slot = m_ring.claim();
+    if (!slot)
+      throw ShmRingTimeout(ERS_HERE, m_ring.get_name(), timeout.count());
+    std::memcpy(slot, &item, sizeof(T));
+    m_ring.commit();
+  }
+
+  const ShmRing& get_ring() const { return m_ring; }
+
+private:
+  ShmRing m_ring;
+};
+
+/**
+ * @brief Consumer end of a ShmRing of items of type T; items are read in place.
+ */
+template<class T>
+class ShmRingReceiver
+{
+public:
+  static_assert(std::is_trivially_copyable_v<T>, "items are copied into shared memory as raw bytes");
+
+  /**
+   * @throws ShmRingIssue if the ring cannot be opened
+   */
+  ShmRingReceiver(const std::string& name, size_t capacity)
+    : m_ring(name, sizeof(T), capacity)
+  {}
+
+  // oldest item, nullptr if there is none; valid until pop()
+  const T* front() const { return static_cast<const T*>(m_ring.front()); }
+  void pop() { m_ring.pop_front(); }
+  bool wait(std::chrono::milliseconds timeout) { return m_ring.wait_for_data(timeout); }
+
+  // pops the items that are in the ring when called, returns how many
+  size_t discard()
+  {
+    size_t n_items = m_ring.size();
+    for (size_t i = 0; i < n_items; ++i)
+      m_ring.pop_front();
+    return n_items;
+  }
+
+  const ShmRing& get_ring() const { return m_ring; }
+
+private:
+  ShmRing m_ring;
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_SHMRING_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
@@ -0,0 +1,151 @@
+/**
+ * @file SignalMapGenerator.hpp
+ *
+ * Fast random HSI signal maps with a firing probability per signal.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_SIGNALMAPGENERATOR_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_SIGNALMAPGENERATOR_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief xoshiro256++ pseudo-random number generator (Blackman and Vigna), seeded
+ * through splitmix64 so that any 64-bit seed gives a good state.
+ */
+class Xoshiro256pp
+{
+public:
+  explicit Xoshiro256pp(uint64_t seed = 0) { this->seed(seed); } // NOLINT(build/unsigned)
+
+  void seed(uint64_t seed) // NOLINT(build/unsigned)
+  {
+    for (auto& s : m_state) {
+      seed += 0x9e3779b97f4a7c15;
+      uint64_t z = seed; // NOLINT(build/unsigned)
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+      s = z ^ (z >> 31);
+    }
+  }
+
+  uint64_t operator()() // NOLINT(build/unsigned)
+  {
+    uint64_t result = rotl(m_state[0] + m_state[3], 23) + m_state[0]; // NOLINT(build/unsigned)
+    uint64_t t = m_state[1] << 17;                                   // NOLINT(build/unsigned)
+    m_state[2] ^= m_state[0];
+    m_state[3] ^= m_state[1];
+    m_state[1] ^= m_state[2];
+    m_state[0] ^= m_state[3];
+    m_state[2] ^= t;
+    m_state[3] = rotl(m_state[3], 45);
+    return result;
+  }
+
+private:
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); } // NOLINT(build/unsigned)
+
+  uint64_t m_state[4]; // NOLINT(build/unsigned)
+};
+
+/**
+ * @brief Draws 32-bit signal maps in which each bit is set independently with its own
+ * probability.
+ *
+ * The probabilities are kept as 16-bit integer thresholds, i.e. to within 1/65536,
+ * and a map costs eight PRNG outputs and a vector compare of 32 16-bit values
+ * against the thresholds. A probability of 1 always sets its bit.
+ */
+class SignalMapGenerator
+{
+public:
+  static constexpr size_t s_num_signals = 32;
+
+  explicit SignalMapGenerator(uint64_t seed = 0) // NOLINT(build/unsigned)
+    : m_rng(seed)
+  {
+    set_probabilities(std::vector<double>(s_num_signals, 0.));
+  }
+
+  void seed(uint64_t seed) { m_rng.seed(seed); } // NOLINT(build/unsigned)
+
+  // probabilities[i] for bit i; missing ones are 0
+  void set_probabilities(const std::vector<double>& probabilities)
+  {
+    m_always_on = 0;
+    for (size_t i = 0; i < s_num_signals; ++i) {
+      double p = i < probabilities.size() ? std::clamp(probabilities[i], 0., 1.) : 0.;
+      if (p >= 1.) {
+        m_always_on |= 1u << i;
+        m_thresholds[i] = 0;
+      } else {
+        m_thresholds[i] = static_cast<uint16_t>(std::min(std::lround(p * 65536.), 65535L)); // NOLINT(build/unsigned)
+      }
+    }
+  }
+
+  // the probability of at least one edge of a Poisson process with the given mean, for all bits
+  void set_poisson_mean(double mean)
+  {
+    set_probabilities(std::vector<double>(s_num_signals, mean > 0 ? 1. - std::exp(-mean) : 0.));
+  }
+
+  uint32_t uniform() { return static_cast<uint32_t>(m_rng() >> 32); } // NOLINT(build/unsigned)
+
+  uint32_t operator()() // NOLINT(build/unsigned)
+  {
+    uint16_t random[s_num_signals]; // NOLINT(build/unsigned)
+    for (size_t i = 0; i < s_num_signals / 4; ++i) {
+      uint64_t r = m_rng(); // NOLINT(build/unsigned)
+      std::memcpy(&random[4 * i], &r, sizeof(r));
+    }
+
+#if defined(__SSE2__)
+    // unsigned 16-bit compare through the signed one, then one mask bit per lane
+    const __m128i bias = _mm_set1_epi16(static_cast<int16_t>(0x8000));
+    __m128i less[4];
+    for (int i = 0; i < 4; ++i) {
+      __m128i r = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&random[8 * i])), bias);
+      __m128i t = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&m_thresholds[8 * i])), bias);
+      less[i] = _mm_cmplt_epi16(r, t);
+    }
+    uint32_t low = _mm_movemask_epi8(_mm_packs_epi16(less[0], less[1]));  // NOLINT(build/unsigned)
+    uint32_t high = _mm_movemask_epi8(_mm_packs_epi16(less[2], less[3])); // NOLINT(build/unsigned)
+    uint32_t map = low | (high << 16);                                    // NOLINT(build/unsigned)
+#else
+    uint32_t map = 0; // NOLINT(build/unsigned)
+    for (size_t i = 0; i < s_num_signals; ++i)
+      map |= static_cast<uint32_t>(random[i] < m_thresholds[i]) << i; // NOLINT(build/unsigned)
+#endif
+    return map | m_always_on;
+  }
+
+private:
+  Xoshiro256pp m_rng;
+  alignas(16) uint16_t m_thresholds[s_num_signals]; // NOLINT(build/unsigned)
+  uint32_t m_always_on;                             // NOLINT(build/unsigned)
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_SIGNALMAPGENERATOR_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
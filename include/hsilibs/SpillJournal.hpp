@@ -0,0 +1,98 @@
+/**
+ * @file SpillJournal.hpp
+ *
+ * Memory-mapped ring file of fixed-size records.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_SPILLJOURNAL_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_SPILLJOURNAL_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief FIFO of fixed-size records kept in a preallocated, memory-mapped ring file.
+ *
+ * The file is a header followed by capacity slots. Each slot holds the sequence
+ * number of its record and a CRC-32 of sequence number and payload, so records
+ * torn by a crash or overwritten by a later run can be recognised. The header
+ * keeps the read and write positions, so a journal left behind by an aborted
+ * run can still be replayed offline. Data reach the page cache on append;
+ * they survive a crash of the process, not of the host.
+ *
+ * Appending to a full journal fails; nothing is overwritten. One thread at a time
+ * may use the journal.
+ */
+class SpillJournal
+{
+public:
+  /**
+   * @brief Creates (or truncates) the journal file and maps it.
+   * @throws SpillJournalIssue if the file cannot be created, allocated or mapped
+   */
+  SpillJournal(const std::string& path, size_t record_size, size_t capacity);
+  /**
+   * @brief Opens a journal file left behind by an earlier instance, e.g. in a run that was
+   * aborted, with the records it still holds, so that they can be replayed.
+   * @throws SpillJournalIssue if the file cannot be opened or mapped, or is not a spill journal
+   */
+  explicit SpillJournal(const std::string& path);
+  ~SpillJournal();
+
+  SpillJournal(const SpillJournal&) = delete;
+  SpillJournal& operator=(const SpillJournal&) = delete;
+
+  /**
+   * @return false if the journal is full
+   */
+  bool append(const void* record);
+
+  /**
+   * @brief Oldest record, nullptr if the journal is empty.
+   * @param valid Set to whether the record passed its checksum
+   */
+  const void* front(bool& valid) const;
+  void pop_front();
+
+  size_t size() const;
+  bool empty() const { return size() == 0; }
+  const std::string& get_path() const { return m_path; }
+
+  // removes the file when closing, used once everything has been replayed
+  void remove_on_close() { m_remove_on_close = true; }
+
+private:
+  struct Header;
+  struct SlotHeader;
+
+  void map_file();
+  unsigned char* slot(uint64_t sequence) const; // NOLINT(build/unsigned)
+  uint32_t checksum(uint64_t sequence, const void* record) const; // NOLINT(build/unsigned)
+
+  std::string m_path;
+  size_t m_record_size;
+  size_t m_slot_size;
+  size_t m_capacity;
+  size_t m_file_size;
+  int m_fd;
+  unsigned char* m_map;
+  Header* m_header;
+  bool m_remove_on_close;
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_SPILLJOURNAL_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
@@ -0,0 +1,91 @@
+/**
+ * @file TimestampOrderedMerge.hpp
+ *
+ * k-way merge of per-source queues into one timestamp-ordered stream.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_INCLUDE_HSILIBS_TIMESTAMPORDEREDMERGE_HPP_
+#define HSILIBS_INCLUDE_HSILIBS_TIMESTAMPORDEREDMERGE_HPP_
+
+#include "folly/ProducerConsumerQueue.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief Chooses which of several single-producer/single-consumer queues to consume
+ * from next, so that the consumed stream is ordered in timestamp.
+ *
+ * Each queue must be filled in timestamp order. While every input has an element
+ * waiting, the oldest one can be released straight away. If some input is empty,
+ * a newer element from that source could still arrive, so the oldest waiting element
+ * is held back until it has been queued for at least the hold time. This bounds
+ * the extra latency to the hold time.
+ *
+ * T must provide get_timestamp() and get_enqueue_time() (a steady_clock time point).
+ * Only the consumer thread of the queues may call next().
+ */
+template<class T>
+class TimestampOrderedMerge
+{
+public:
+  using queue_t = folly::ProducerConsumerQueue<T>;
+
+  explicit TimestampOrderedMerge(std::chrono::microseconds hold_time)
+    : m_hold_time(hold_time)
+  {}
+
+  void add_input(queue_t* input) { m_inputs.push_back(input); }
+
+  size_t get_num_inputs() const { return m_inputs.size(); }
+
+  /**
+   * @brief Index of the input whose front element is next in timestamp order.
+   * @param flush Release elements without waiting for empty inputs, e.g. when the producers have stopped
+   * @return Input index, or -1 if nothing can be released yet
+   */
+  int next(std::chrono::steady_clock::time_point now, bool flush = false) const
+  {
+    int oldest = -1;
+    uint64_t oldest_timestamp = 0; // NOLINT(build/unsigned)
+    bool any_input_empty = false;
+
+    for (size_t i = 0; i < m_inputs.size(); ++i) {
+      const T* front = m_inputs[i]->frontPtr();
+      if (front == nullptr) {
+        any_input_empty = true;
+        continue;
+      }
+      if (oldest < 0 || front->get_timestamp() < oldest_timestamp) {
+        oldest = i;
+        oldest_timestamp = front->get_timestamp();
+      }
+    }
+
+    if (oldest < 0 || flush || !any_input_empty)
+      return oldest;
+
+    return now - m_inputs[oldest]->frontPtr()->get_enqueue_time() >= m_hold_time ? oldest : -1;
+  }
+
+private:
+  std::chrono::microseconds m_hold_time;
+  std::vector<queue_t*> m_inputs;
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_INCLUDE_HSILIBS_TIMESTAMPORDEREDMERGE_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
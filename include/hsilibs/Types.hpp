@@ -1,7 +1,7 @@
 /**
  * @file Types.hpp
  *
- *  Contains declaration of HSI_FRAME_STRUCT.
+ *  Contains declaration of HSI_FRAME_STRUCT and HSI_SUPERCHUNK_STRUCT.
  *
  * This is part of the DUNE DAQ Application Framework, copyright 2020.
  * Licensing/copyright details are in the COPYING file that you should have
@@ -32,6 +32,10 @@ namespace hsilibs {
  * */
 const constexpr std::size_t HSI_FRAME_STRUCT_SIZE = 28;
 
+// DAQ header values of the HSI frames written by HSIEventSender::fill_hsi_frame
+const constexpr uint32_t HSI_FRAME_VERSION = 0x1;     // NOLINT(build/unsigned)
+const constexpr uint32_t HSI_FRAME_DETECTOR_ID = 0x1; // NOLINT(build/unsigned)
+
 class HSI_FRAME_STRUCT
 {
 public:
@@ -55,6 +59,11 @@ public:
     return frame.get_timestamp(); // NOLINT
   }
 
+  uint64_t get_last_timestamp() const // NOLINT(build/unsigned)
+  {
+    return frame.get_timestamp(); // NOLINT
+  }
+
   void set_first_timestamp(uint64_t ts) // NOLINT(build/unsigned)
   {
     frame.set_timestamp(ts);
@@ -79,9 +88,92 @@ public:
 static_assert(sizeof(struct HSI_FRAME_STRUCT) == HSI_FRAME_STRUCT_SIZE,
               "Check your assumptions on HSI_FRAME_STRUCT");
 
+/**
+ * @brief Up to HSI_SUPERCHUNK_MAX_FRAMES HSI frames in timestamp order, e.g. all frames
+ * of one hardware poll, sent and buffered as one element.
+ * Only the first n_frames frames are valid; begin() and end() span those.
+ * */
+const constexpr std::size_t HSI_SUPERCHUNK_MAX_FRAMES = 32;
+
+class HSI_SUPERCHUNK_STRUCT
+{
+public:
+  using FrameType = dunedaq::detdataformats::HSIFrame;
+
+  uint32_t n_frames = 0; // NOLINT(build/unsigned)
+  uint32_t reserved = 0; // NOLINT(build/unsigned)
+  FrameType frames[HSI_SUPERCHUNK_MAX_FRAMES];
+
+  // comparable based on start timestamp
+  bool operator<(const HSI_SUPERCHUNK_STRUCT& other) const
+  {
+    return this->get_first_timestamp() < other.get_first_timestamp() ? true : false;
+  }
+
+  uint64_t get_timestamp() const // NOLINT(build/unsigned)
+  {
+    return frames[0].get_timestamp(); // NOLINT
+  }
+
+  uint64_t get_first_timestamp() const // NOLINT(build/unsigned)
+  {
+    return frames[0].get_timestamp(); // NOLINT
+  }
+
+  // timestamp of the last valid frame; a chunk can span the edges of a request window
+  uint64_t get_last_timestamp() const // NOLINT(build/unsigned)
+  {
+    return frames[n_frames ? n_frames - 1 : 0].get_timestamp(); // NOLINT
+  }
+
+  // only used on the empty elements that the latency buffer searches with
+  void set_first_timestamp(uint64_t ts) // NOLINT(build/unsigned)
+  {
+    frames[0].set_timestamp(ts);
+  }
+
+  FrameType* begin() { return &frames[0]; }
+
+  FrameType* end() { return &frames[n_frames]; } // NOLINT
+
+  size_t get_payload_size() { return n_frames * HSI_FRAME_STRUCT_SIZE; }
+
+  size_t get_num_frames() { return n_frames; }
+
+  size_t get_frame_size() { return HSI_FRAME_STRUCT_SIZE; }
+
+  bool full() const { return n_frames == HSI_SUPERCHUNK_MAX_FRAMES; }
+
+  void add_frame(const HSI_FRAME_STRUCT& frame) { frames[n_frames++] = frame.frame; }
+
+  static const constexpr daqdataformats::SourceID::Subsystem subsystem =
+    daqdataformats::SourceID::Subsystem::kHwSignalsInterface;
+  static const constexpr daqdataformats::FragmentType fragment_type = daqdataformats::FragmentType::kHardwareSignal;
+  // frames are sparse and have no fixed spacing, so the readoutlibs request handler cannot tell
+  // from this which frames of a chunk lie in a window; HSIRequestHandlerModel cuts chunks frame by frame
+  static const constexpr uint64_t expected_tick_difference = 0; // NOLINT(build/unsigned)
+};
+
+static_assert(sizeof(struct HSI_SUPERCHUNK_STRUCT) == 8 + HSI_SUPERCHUNK_MAX_FRAMES * HSI_FRAME_STRUCT_SIZE,
+              "Check your assumptions on HSI_SUPERCHUNK_STRUCT");
+
+// a superchunk counts as all of its frames in the drop and timeout statistics of an OutputChannel
+inline size_t
+output_item_count(const HSI_SUPERCHUNK_STRUCT& chunk)
+{
+  return chunk.n_frames;
+}
+
+inline uint64_t // NOLINT(build/unsigned)
+output_item_last_timestamp(const HSI_SUPERCHUNK_STRUCT& chunk)
+{
+  return chunk.get_last_timestamp();
+}
+
 } // namespace hsilibs
 
 DUNE_DAQ_TYPESTRING(hsilibs::HSI_FRAME_STRUCT, "HSIFrame")
+DUNE_DAQ_TYPESTRING(hsilibs::HSI_SUPERCHUNK_STRUCT, "HSISuperChunk")
 
 } // namespace dunedaq
 
@@ -20,10 +20,15 @@
 #include "logging/Logging.hpp"
 #include "rcif/cmd/Nljs.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <functional>
+#include <random>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace dunedaq {
@@ -33,12 +38,12 @@ FakeHSIEventGenerator::FakeHSIEventGenerator(const std::string& name)
   : HSIEventSender(name)
   , m_thread(std::bind(&FakeHSIEventGenerator::do_hsi_work, this, std::placeholders::_1))
   , m_timestamp_estimator(nullptr)
-  , m_random_generator()
-  , m_uniform_distribution(0, UINT32_MAX)
+  , m_signal_map_generator()
+  , m_random_seed(0)
   , m_clock_frequency(50e6)
   , m_trigger_rate(1) // Hz
   , m_active_trigger_rate(1) // Hz
-  , m_event_period(1e6) // us
+  , m_event_period(1e9) // ns
   , m_timestamp_offset(0)
   , m_hsi_device_id(0)
   , m_signal_emulation_mode(0)
@@ -46,6 +51,12 @@ FakeHSIEventGenerator::FakeHSIEventGenerator(const std::string& name)
   , m_enabled_signals(0)
   , m_generated_counter(0)
   , m_last_generated_timestamp(0)
+  , m_generation_mode(fakehsieventgenerator::GenerationMode::paced)
+  , m_wakeup_period(100)
+  , m_max_batch_size(4096)
+  , m_last_info_generated(0)
+  , m_ordered_output(false)
+  , m_merge_window(1000)
 {
   register_command("conf", &FakeHSIEventGenerator::do_configure);
   register_command("start", &FakeHSIEventGenerator::do_start);
@@ -58,7 +69,7 @@ void
 FakeHSIEventGenerator::init(const nlohmann::json& init_data)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering init() method";
-  m_raw_hsi_data_sender = get_iom_sender<HSI_FRAME_STRUCT>(appfwk::connection_uid(init_data, "output"));
+  set_raw_hsi_data_send_connection(appfwk::connection_uid(init_data, "output"));
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting init() method";
 }
 
@@ -71,9 +82,64 @@ FakeHSIEventGenerator::get_info(opmonlib::InfoCollector& ci, int /*level*/)
   module_info.generated_hsi_events_counter = m_generated_counter.load();
   module_info.sent_hsi_events_counter = m_sent_counter.load();
   module_info.failed_to_send_hsi_events_counter = m_failed_to_send_counter.load();
+  module_info.dropped_hsi_events_counter = get_dropped_hsi_events_counter();
+  module_info.dropped_raw_hsi_frames_counter = get_dropped_raw_hsi_frames_counter();
+  module_info.spilled_hsi_events_counter = get_spilled_hsi_events_counter();
+  module_info.spilled_raw_hsi_frames_counter = get_spilled_raw_hsi_frames_counter();
+  module_info.hsi_event_backlog = get_hsi_event_backlog_size();
+  module_info.raw_hsi_frame_backlog = get_raw_hsi_frame_backlog_size();
   module_info.last_generated_timestamp = m_last_generated_timestamp.load();
   module_info.last_sent_timestamp = m_last_sent_timestamp.load();
 
+  auto dispatch_latency = m_dispatch_latency.read();
+  module_info.dispatch_latency_p50 = dispatch_latency.p50 / 1000.;
+  module_info.dispatch_latency_p90 = dispatch_latency.p90 / 1000.;
+  module_info.dispatch_latency_p99 = dispatch_latency.p99 / 1000.;
+  module_info.dispatch_latency_max = dispatch_latency.max / 1000.;
+
+  auto send_latency = m_send_latency.read();
+  module_info.send_latency_p50 = send_latency.p50 / 1000.;
+  module_info.send_latency_p90 = send_latency.p90 / 1000.;
+  module_info.send_latency_p99 = send_latency.p99 / 1000.;
+  module_info.send_latency_max = send_latency.max / 1000.;
+
+  auto pacing_jitter = m_pacing_jitter.read();
+  module_info.pacing_jitter_p50 = pacing_jitter.p50 / 1000.;
+  module_info.pacing_jitter_p99 = pacing_jitter.p99 / 1000.;
+  module_info.pacing_jitter_max = pacing_jitter.max / 1000.;
+
+  // rate sustained since the previous report
+  auto now = std::chrono::steady_clock::now();
+  uint64_t generated = m_generated_counter.load(); // NOLINT(build/unsigned)
+  double interval = std::chrono::duration<double>(now - m_last_info_time).count();
+  module_info.generation_rate =
+    (interval > 0 && generated >= m_last_info_generated) ? (generated - m_last_info_generated) / interval : 0.;
+  m_last_info_time = now;
+  m_last_info_generated = generated;
+
+  // generated timestamps are estimates of the current DAQ time, so this is the generator's end-to-end latency
+  check_latency_budget("generation-to-send", dispatch_latency);
+
+  std::lock_guard<std::mutex> lock(m_devices_mutex);
+  module_info.event_buffer_occupancy = 0;
+  module_info.event_buffer_high_water_mark = 0;
+  for (auto& shard : m_shards) {
+    module_info.event_buffer_occupancy += shard->event_buffer->sizeGuess();
+    module_info.event_buffer_high_water_mark =
+      std::max<uint64_t>(module_info.event_buffer_high_water_mark, shard->event_buffer_high_water_mark.load()); // NOLINT
+  }
+
+  for (auto& device : m_devices) {
+    fakehsieventgeneratorinfo::DeviceInfo device_info;
+    device_info.generated_hsi_events_counter = device->generated_counter.load();
+    device_info.sent_hsi_events_counter = device->sent_counter.load();
+    device_info.last_generated_timestamp = device->last_generated_timestamp.load();
+
+    opmonlib::InfoCollector device_ci;
+    device_ci.add(device_info);
+    ci.add("device_" + std::to_string(device->hsi_device_id), device_ci);
+  }
+
   ci.add(module_info);
 }
 
@@ -84,7 +150,7 @@ FakeHSIEventGenerator::do_configure(const nlohmann::json& obj)
 
   auto params = obj.get<fakehsieventgenerator::Conf>();
 
-  m_hsievent_send_connection = params.hsievent_connection_name;
+  set_hsievent_send_connection(params.hsievent_connection_name);
 
   m_clock_frequency = params.clock_frequency;
   if (params.trigger_rate>0)
@@ -98,9 +164,9 @@ FakeHSIEventGenerator::do_configure(const nlohmann::json& obj)
   }
 
 
-  // time between HSI events [us]
-  m_event_period.store(1.e6 / m_active_trigger_rate.load());
-  TLOG() << get_name() << " Setting trigger rate, event period [us] to: " << m_active_trigger_rate.load() << ", "
+  // time between HSI events [ns]
+  m_event_period.store(1.e9 / m_active_trigger_rate.load());
+  TLOG() << get_name() << " Setting trigger rate, event period [ns] to: " << m_active_trigger_rate.load() << ", "
          << m_event_period.load();
 
   // offset in units of clock ticks, positive offset increases timestamp
@@ -109,9 +175,89 @@ FakeHSIEventGenerator::do_configure(const nlohmann::json& obj)
   m_signal_emulation_mode = params.signal_emulation_mode;
   m_mean_signal_multiplicity = params.mean_signal_multiplicity;
   m_enabled_signals = params.enabled_signals;
+  m_latency_budget = params.latency_budget;
+  m_generation_mode = params.generation_mode;
+  m_wakeup_period = params.wakeup_period;
+  m_max_batch_size = std::max<uint32_t>(params.max_batch_size, 1); // NOLINT(build/unsigned)
 
-  // configure the random distributions
-  m_poisson_distribution = std::poisson_distribution<uint64_t>(m_mean_signal_multiplicity); // NOLINT(build/unsigned)
+  configure_outputs(params.hsievent_output_policy, params.raw_output_policy);
+
+  // per-signal firing probabilities: a signal is on if it has at least one edge
+  if (params.signal_probabilities.empty())
+    m_signal_map_generator.set_poisson_mean(m_mean_signal_multiplicity);
+  else
+    m_signal_map_generator.set_probabilities(params.signal_probabilities);
+  m_random_seed = params.random_seed;
+
+  m_arrival_model.reset();
+  if (params.arrival_process != fakehsieventgenerator::ArrivalProcess::periodic) {
+    std::vector<ArrivalSource> sources;
+    if (params.arrival_process == fakehsieventgenerator::ArrivalProcess::poisson) {
+      sources.push_back({ 0, m_trigger_rate.load() });
+    } else {
+      for (size_t i = 0; i < std::min<size_t>(params.signal_rates.size(), 32); ++i)
+        sources.push_back({ 1u << i, params.signal_rates[i] });
+    }
+    for (auto& coincidence : params.coincidences)
+      sources.push_back({ coincidence.signals, coincidence.rate });
+
+    ArrivalModulation modulation;
+    modulation.on_duration = params.modulation.on_duration;
+    modulation.off_duration = params.modulation.off_duration;
+    modulation.on_rate_factor = params.modulation.on_rate_factor;
+    modulation.off_rate_factor = params.modulation.off_rate_factor;
+    modulation.random_durations = params.modulation.random_durations;
+
+    m_arrival_model = std::make_unique<ArrivalModel>(std::move(sources), modulation, params.coincidence_window);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_devices_mutex);
+    m_shards.clear();
+    m_devices.clear();
+  }
+  std::vector<std::unique_ptr<GeneratorShard>> shards;
+  std::vector<std::unique_ptr<EmulatedDevice>> devices;
+  m_ordered_output = params.ordered_output;
+  m_merge_window = params.merge_window;
+  // several devices: each gets a copy of the signal map generator and arrival model configured above
+  if (params.num_devices > 1 || params.num_shards > 1) {
+    uint32_t num_devices = std::max<uint32_t>(params.num_devices, 1);                   // NOLINT(build/unsigned)
+    uint32_t num_shards = std::min(std::max<uint32_t>(params.num_shards, 1), num_devices); // NOLINT(build/unsigned)
+
+    for (uint32_t i = 0; i < num_shards; ++i) { // NOLINT(build/unsigned)
+      auto shard = std::make_unique<GeneratorShard>();
+      // one slot of a folly::ProducerConsumerQueue is always kept free
+      shard->event_buffer =
+        std::make_unique<folly::ProducerConsumerQueue<GeneratedHSIEvent>>(std::max<uint32_t>(params.event_buffer_size, 1) + 1); // NOLINT
+      auto& shard_ref = *shard;
+      shard->thread = std::make_unique<dunedaq::utilities::WorkerThread>(
+        std::bind(&FakeHSIEventGenerator::generate_shard, this, std::ref(shard_ref), std::placeholders::_1));
+      shards.push_back(std::move(shard));
+    }
+    for (uint32_t i = 0; i < num_devices; ++i) { // NOLINT(build/unsigned)
+      auto device = std::make_unique<EmulatedDevice>();
+      device->hsi_device_id = m_hsi_device_id + i;
+      device->link = i;
+      device->signal_map_generator = m_signal_map_generator;
+      if (m_arrival_model)
+        device->arrival_model = std::make_unique<ArrivalModel>(*m_arrival_model);
+      shards[i % num_shards]->devices.push_back(device.get());
+      devices.push_back(std::move(device));
+    }
+    TLOG() << get_name() << ": emulating " << num_devices << " HSI devices with " << num_shards << " threads";
+    if (num_shards > 1 && !m_ordered_output)
+      ers::warning(OutputPolicyIssue(ERS_HERE,
+                                     get_name(),
+                                     "ordered_output is off, the raw frames of the " + std::to_string(num_shards) +
+                                       " shards are sent out of timestamp order"));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_devices_mutex);
+    m_shards = std::move(shards);
+    m_devices = std::move(devices);
+  }
 
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_configure() method";
 }
@@ -124,6 +270,22 @@ FakeHSIEventGenerator::do_start(const nlohmann::json& obj)
 
   m_received_timesync_count.store(0);
 
+  uint64_t seed = m_random_seed; // NOLINT(build/unsigned)
+  if (!seed) {
+    std::random_device device;
+    seed = (static_cast<uint64_t>(device()) << 32) | device(); // NOLINT(build/unsigned)
+  }
+  m_signal_map_generator.seed(seed);
+  if (m_arrival_model)
+    m_arrival_model->seed(seed + 1);
+  // every device its own streams, still reproducible from the one seed
+  for (auto& device : m_devices) {
+    device->signal_map_generator.seed(seed + 2 * device->link + 2);
+    if (device->arrival_model)
+      device->arrival_model->seed(seed + 2 * device->link + 3);
+  }
+  TLOG_DEBUG(2) << get_name() << ": random seed " << seed;
+
   m_timesync_receiver = get_iom_receiver<dfmessages::TimeSync>(".*");
   m_timesync_receiver->add_callback(std::bind(&FakeHSIEventGenerator::dispatch_timesync, this, std::placeholders::_1));
 
@@ -131,16 +293,18 @@ FakeHSIEventGenerator::do_start(const nlohmann::json& obj)
   if (start_params.trigger_rate>0) {
     m_active_trigger_rate.store(start_params.trigger_rate);
 
-    // time between HSI events [us]
-    m_event_period.store(1.e6 / m_active_trigger_rate.load());
-    TLOG() << get_name() << " Setting trigger rate, event period [us] to: " << m_active_trigger_rate.load() << ", "
+    // time between HSI events [ns]
+    m_event_period.store(1.e9 / m_active_trigger_rate.load());
+    TLOG() << get_name() << " Setting trigger rate, event period [ns] to: " << m_active_trigger_rate.load() << ", "
            << m_event_period.load();
   } else {
-    TLOG() << get_name() << " Using trigger rate, event period [us]: " << m_active_trigger_rate.load() << ", "
+    TLOG() << get_name() << " Using trigger rate, event period [ns]: " << m_active_trigger_rate.load() << ", "
            << m_event_period.load();
   }
   m_run_number.store(start_params.run);
 
+  start_outputs(start_params.run);
+
   m_thread.start_working_thread("fake-tsd-gen");
   TLOG() << get_name() << " successfully started";
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_start() method";
@@ -155,9 +319,9 @@ FakeHSIEventGenerator::do_change_rate(const nlohmann::json& obj)
   TLOG() << get_name() << "trigger_RATE: " << change_rate_params.trigger_rate;
   m_active_trigger_rate.store(change_rate_params.trigger_rate);
 
-  // time between HSI events [us]
-  m_event_period.store(1.e6 / m_active_trigger_rate.load());
-  TLOG() << get_name() << " Updating trigger rate, event period [us] to: " << m_active_trigger_rate.load() << ", "
+  // time between HSI events [ns]
+  m_event_period.store(1.e9 / m_active_trigger_rate.load());
+  TLOG() << get_name() << " Updating trigger rate, event period [ns] to: " << m_active_trigger_rate.load() << ", "
          << m_event_period.load();
 
   TLOG() << get_name() << " successfully changed arate";
@@ -176,8 +340,8 @@ FakeHSIEventGenerator::do_stop(const nlohmann::json& /*args*/)
   m_timestamp_estimator.reset(nullptr); // Calls TimestampEstimator dtor
 
   m_active_trigger_rate.store(m_trigger_rate.load());
-  m_event_period.store(1.e6 / m_active_trigger_rate.load());
-  TLOG() << get_name() << " Updating trigger rate, event period [us] to: " << m_active_trigger_rate.load() << ", "
+  m_event_period.store(1.e9 / m_active_trigger_rate.load());
+  TLOG() << get_name() << " Updating trigger rate, event period [ns] to: " << m_active_trigger_rate.load() << ", "
          << m_event_period.load();
   
   TLOG() << get_name() << " successfully stopped";
@@ -192,7 +356,7 @@ FakeHSIEventGenerator::do_scrap(const nlohmann::json& /*args*/)
 }
 
 uint32_t // NOLINT(build/unsigned)
-FakeHSIEventGenerator::generate_signal_map()
+FakeHSIEventGenerator::generate_signal_map(SignalMapGenerator& generator)
 {
 
   uint32_t signal_map = 0; // NOLINT(build/unsigned)
@@ -202,17 +366,15 @@ FakeHSIEventGenerator::generate_signal_map()
       signal_map = UINT32_MAX;
       break;
     case 1:
-      for (uint i = 0; i < 32; ++i)
-        if (m_poisson_distribution(m_random_generator))
-          signal_map = signal_map | (1UL << i);
+      signal_map = generator();
       break;
     case 2:
-      signal_map = m_uniform_distribution(m_random_generator);
+      signal_map = generator.uniform();
       break;
     default:
       signal_map = 0;
   }
-  TLOG_DEBUG(3) << "raw gen. map: " << std::bitset<32>(signal_map);
+  TLOG_EVENT_DEBUG(3) << "raw gen. map: " << std::bitset<32>(signal_map);
   return signal_map;
 }
 
@@ -235,6 +397,52 @@ FakeHSIEventGenerator::do_hsi_work(std::atomic<bool>& running_flag)
   m_last_sent_timestamp = 0;
   m_failed_to_send_counter = 0;
 
+  m_dispatch_latency.reset();
+  m_send_latency.reset();
+  m_pacing_jitter.reset();
+
+  for (auto& device : m_devices) {
+    device->generated_counter = 0;
+    device->sent_counter = 0;
+    device->last_generated_timestamp = 0;
+  }
+  for (auto& shard : m_shards)
+    shard->event_buffer_high_water_mark = 0;
+
+  auto run_start = std::chrono::steady_clock::now();
+  if (!m_shards.empty()) {
+    dispatch_shards(running_flag);
+  } else {
+    switch (m_generation_mode) {
+      case fakehsieventgenerator::GenerationMode::batch:
+        generate_batches(running_flag, false);
+        break;
+      case fakehsieventgenerator::GenerationMode::saturation:
+        generate_batches(running_flag, true);
+        break;
+      default:
+        if (m_arrival_model)
+          generate_batches(running_flag, false);
+        else
+          generate_paced(running_flag);
+    }
+  }
+
+  flush_outputs(true);
+
+  double run_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+  std::ostringstream oss_summ;
+  oss_summ << ": Exiting the generate_hsievents() method, generated " << m_generated_counter
+           << " HSIEvent messages for " << std::max<size_t>(m_devices.size(), 1)
+           << " device(s) and successfully sent " << m_sent_counter << " copies. Sustained rate: "
+           << (run_time > 0 ? m_generated_counter / run_time : 0.) << " Hz. ";
+  ers::info(dunedaq::hsilibs::ProgressUpdate(ERS_HERE, get_name(), oss_summ.str()));
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_work() method";
+}
+
+void
+FakeHSIEventGenerator::generate_paced(std::atomic<bool>& running_flag)
+{
   bool break_flag = false;
 
   auto prev_gen_time = std::chrono::steady_clock::now();
@@ -242,14 +450,15 @@ FakeHSIEventGenerator::do_hsi_work(std::atomic<bool>& running_flag)
   while (!break_flag) {
 
     // emulate some signals
-    uint32_t signal_map = generate_signal_map(); // NOLINT(build/unsigned)
+    uint32_t signal_map = generate_signal_map(m_signal_map_generator); // NOLINT(build/unsigned)
     uint32_t trigger_map = signal_map & m_enabled_signals; // NOLINT(build/unsigned)
   
-    TLOG_DEBUG(3) << "masked gen. map:" << std::bitset<32>(trigger_map);
+    TLOG_EVENT_DEBUG(3) << "masked gen. map:" << std::bitset<32>(trigger_map);
   
     // if at least one active signal, send a HSIEvent
     if (trigger_map && m_timestamp_estimator.get() != nullptr) {
 
+      auto generation_time = std::chrono::steady_clock::now();
       dfmessages::timestamp_t ts = m_timestamp_estimator->get_timestamp_estimate();
 
       ts += m_timestamp_offset;
@@ -262,34 +471,21 @@ FakeHSIEventGenerator::do_hsi_work(std::atomic<bool>& running_flag)
       send_hsi_event(event);
 
       // Send raw HSI data to a DLH 
-      std::array<uint32_t, 7> hsi_struct;
-      hsi_struct[0] = (0x1 << 6) | 0x1; // DAQHeader, frame version: 1, det id: 1
-      hsi_struct[1] = ts;
-      hsi_struct[2] = ts >> 32;
-      hsi_struct[3] = signal_map;
-      hsi_struct[4] = 0x0;
-      hsi_struct[5] = trigger_map;
-      hsi_struct[6] = m_generated_counter;
-
-      TLOG_DEBUG(3) << get_name() << ": Formed HSI_FRAME_STRUCT "
-            << std::hex 
-            << "0x"   << hsi_struct[0]
-            << ", 0x" << hsi_struct[1]
-            << ", 0x" << hsi_struct[2]
-            << ", 0x" << hsi_struct[3]
-            << ", 0x" << hsi_struct[4]
-            << ", 0x" << hsi_struct[5]
-            << ", 0x" << hsi_struct[6]
-            << "\n";
-
-      send_raw_hsi_data(hsi_struct, m_raw_hsi_data_sender.get());
+      HSI_FRAME_STRUCT hsi_frame;
+      fill_hsi_frame(hsi_frame, 0, ts, signal_map, trigger_map, m_generated_counter);
+      send_raw_hsi_frames(&hsi_frame, 1);
+
+      m_dispatch_latency.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - generation_time)
+          .count());
 
     }
 
     // sleep for the configured event period, if trigger ticks are not 0, otherwise do not send anything
     if (m_active_trigger_rate.load() > 0)
     {
-      auto next_gen_time = prev_gen_time + std::chrono::microseconds(m_event_period.load());
+      auto next_gen_time =
+        prev_gen_time + std::chrono::nanoseconds(static_cast<int64_t>(m_event_period.load()));
 
       // check running_flag periodically
       auto flag_check_period = std::chrono::milliseconds(1);
@@ -315,15 +511,368 @@ FakeHSIEventGenerator::do_hsi_work(std::atomic<bool>& running_flag)
 
     } else {
       std::this_thread::sleep_for(std::chrono::microseconds(250000));
+      if (!running_flag.load())
+        break_flag = true;
       continue;
     }
   }
+}
 
-  std::ostringstream oss_summ;
-  oss_summ << ": Exiting the generate_hsievents() method, generated " << m_generated_counter
-           << " HSIEvent messages and successfully sent " << m_sent_counter << " copies. ";
-  ers::info(dunedaq::hsilibs::ProgressUpdate(ERS_HERE, get_name(), oss_summ.str()));
-  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_work() method";
+void
+FakeHSIEventGenerator::generate_batches(std::atomic<bool>& running_flag, bool saturate)
+{
+  std::vector<dfmessages::HSIEvent> events;
+  std::vector<HSI_FRAME_STRUCT> frames;
+  events.reserve(m_max_batch_size);
+  frames.reserve(m_max_batch_size);
+
+  const double ticks_per_ns = m_clock_frequency / 1.e9;
+  // in paced mode, only the stochastic arrival processes get here; they wake up for each arrival
+  const auto wakeup_period =
+    std::chrono::microseconds(m_generation_mode == fakehsieventgenerator::GenerationMode::batch ? m_wakeup_period : 0);
+  const auto flag_check_period = std::chrono::milliseconds(1);
+
+  // the schedule counts from schedule_start in double precision, so that it does not drift at any rate
+  auto schedule_start = std::chrono::steady_clock::now();
+  double next_event_ns = 0;
+  dfmessages::timestamp_t last_ts = 0;
+
+  // the arrival model rates are those of the configured trigger rate, scaled by change_rate
+  float applied_trigger_rate = m_trigger_rate.load();
+  if (m_arrival_model) {
+    m_arrival_model->set_rate_scale(m_active_trigger_rate.load() / applied_trigger_rate, 0);
+    m_arrival_model->restart(0);
+    applied_trigger_rate = m_active_trigger_rate.load();
+  }
+
+  while (running_flag.load()) {
+    double period_ns = m_event_period.load();
+    if (!saturate && m_active_trigger_rate.load() <= 0) {
+      std::this_thread::sleep_for(flag_check_period);
+      schedule_start = std::chrono::steady_clock::now();
+      next_event_ns = 0;
+      if (m_arrival_model)
+        m_arrival_model->restart(0);
+      continue;
+    }
+
+    // one timestamp estimate per wake-up; each event gets the timestamp of its scheduled time
+    auto now = std::chrono::steady_clock::now();
+    dfmessages::timestamp_t now_ts = m_timestamp_estimator->get_timestamp_estimate() + m_timestamp_offset;
+    double now_ns = std::chrono::duration<double, std::nano>(now - schedule_start).count();
+
+    if (m_arrival_model) {
+      if (m_active_trigger_rate.load() != applied_trigger_rate) {
+        applied_trigger_rate = m_active_trigger_rate.load();
+        m_arrival_model->set_rate_scale(applied_trigger_rate / m_trigger_rate.load(), now_ns);
+      }
+      next_event_ns = m_arrival_model->next_time();
+    }
+
+    events.clear();
+    frames.clear();
+    for (uint32_t i = 0; i < m_max_batch_size && (saturate || next_event_ns <= now_ns); ++i) { // NOLINT(build/unsigned)
+      if (m_arrival_model && std::isinf(next_event_ns))
+        break;
+
+      dfmessages::timestamp_t ts = std::max(now_ts, last_ts + 1);
+      if (!saturate) {
+        double lag_ns = now_ns - next_event_ns;
+        ts = std::max(now_ts - static_cast<dfmessages::timestamp_t>(lag_ns * ticks_per_ns), last_ts);
+        m_pacing_jitter.record(static_cast<uint64_t>(lag_ns)); // NOLINT(build/unsigned)
+      }
+      last_ts = ts;
+
+      uint32_t signal_map = 0; // NOLINT(build/unsigned)
+      if (m_arrival_model) {
+        auto arrival = m_arrival_model->pop();
+        signal_map = arrival.signal_map | (arrival.draw_signals ? generate_signal_map(m_signal_map_generator) : 0);
+        next_event_ns = m_arrival_model->next_time();
+      } else {
+        signal_map = generate_signal_map(m_signal_map_generator);
+        next_event_ns += period_ns;
+      }
+      uint32_t trigger_map = signal_map & m_enabled_signals; // NOLINT(build/unsigned)
+      if (!trigger_map)
+        continue;
+
+      ++m_generated_counter;
+      events.emplace_back(m_hsi_device_id, trigger_map, ts, m_generated_counter, m_run_number);
+      frames.emplace_back();
+      fill_hsi_frame(frames.back(), 0, ts, signal_map, trigger_map, m_generated_counter);
+    }
+
+    if (!events.empty()) {
+      m_last_generated_timestamp.store(last_ts);
+      send_hsi_events(events.data(), events.size());
+      send_raw_hsi_frames(frames.data(), frames.size());
+      m_dispatch_latency.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - now).count());
+    }
+
+    if (saturate && !events.empty())
+      continue;
+
+    // no arrival, e.g. in the off state of a modulation, for longer than a flag check period
+    double next_wakeup_ns = std::min(next_event_ns, now_ns + 1.e6);
+    auto next_event_time = schedule_start + std::chrono::nanoseconds(static_cast<int64_t>(next_wakeup_ns));
+    if (next_event_time <= std::chrono::steady_clock::now())
+      continue; // behind by more than a batch
+
+    // sleep until the next wake-up, or the next event if that is later, checking running_flag periodically
+    auto wakeup_time = std::min(std::max(next_event_time, now + wakeup_period), now + flag_check_period);
+    std::this_thread::sleep_until(wakeup_time);
+  }
+}
+
+void
+FakeHSIEventGenerator::generate_shard(GeneratorShard& shard, std::atomic<bool>& running_flag)
+{
+  const bool saturate = m_generation_mode == fakehsieventgenerator::GenerationMode::saturation;
+  const double ticks_per_ns = m_clock_frequency / 1.e9;
+  // in paced mode a shard wakes up for each event of its devices
+  const auto wakeup_period =
+    std::chrono::microseconds(m_generation_mode == fakehsieventgenerator::GenerationMode::batch ? m_wakeup_period : 0);
+  const auto flag_check_period = std::chrono::milliseconds(1);
+  const auto full_buffer_retry_period = std::chrono::microseconds(10);
+
+  auto schedule_start = m_schedule_start;
+  dfmessages::timestamp_t last_ts = 0;
+  float applied_trigger_rate = m_active_trigger_rate.load();
+  bool paused = false;
+
+  // the time between the events of a periodic device; with a rate of 0 in saturation
+  // mode, any finite value keeps the devices taking turns
+  auto finite_period_ns = [&]() {
+    double period_ns = m_event_period.load();
+    return std::isfinite(period_ns) ? period_ns : 1.;
+  };
+
+  // next event time of each device of the shard, in a min-heap, so that the shard generates in timestamp order
+  using Entry = std::pair<double, size_t>;
+  std::vector<Entry> schedule;
+  schedule.reserve(shard.devices.size());
+  auto next_event_ns = [&](EmulatedDevice& device) {
+    return device.arrival_model ? device.arrival_model->next_time() : device.next_event_ns;
+  };
+  auto push = [&](size_t index) {
+    double time = next_event_ns(*shard.devices[index]);
+    if (!std::isfinite(time))
+      return;
+    schedule.emplace_back(time, index);
+    std::push_heap(schedule.begin(), schedule.end(), std::greater<Entry>());
+  };
+  // at the start and when the rate is back above 0, from schedule_start
+  auto restart = [&]() {
+    schedule.clear();
+    applied_trigger_rate = m_active_trigger_rate.load();
+    double period_ns = finite_period_ns();
+    for (size_t i = 0; i < shard.devices.size(); ++i) {
+      auto& device = *shard.devices[i];
+      if (device.arrival_model) {
+        device.arrival_model->set_rate_scale(applied_trigger_rate / m_trigger_rate.load(), 0);
+        device.arrival_model->restart(0);
+      } else {
+        // periodic devices are spread over the period rather than all firing at once
+        device.next_event_ns = period_ns * device.link / m_devices.size();
+      }
+      push(i);
+    }
+  };
+  restart();
+
+  while (running_flag.load()) {
+    if (!saturate && m_active_trigger_rate.load() <= 0) {
+      paused = true;
+      std::this_thread::sleep_for(flag_check_period);
+      continue;
+    }
+    if (paused) {
+      schedule_start = std::chrono::steady_clock::now();
+      restart();
+      paused = false;
+    }
+    double period_ns = finite_period_ns();
+
+    // one timestamp estimate per wake-up, shared by all shards
+    auto now = std::chrono::steady_clock::now();
+    dfmessages::timestamp_t now_ts = m_timestamp_estimator->get_timestamp_estimate() + m_timestamp_offset;
+    double now_ns = std::chrono::duration<double, std::nano>(now - schedule_start).count();
+
+    if (m_arrival_model && m_active_trigger_rate.load() != applied_trigger_rate) {
+      applied_trigger_rate = m_active_trigger_rate.load();
+      schedule.clear();
+      for (size_t i = 0; i < shard.devices.size(); ++i) {
+        shard.devices[i]->arrival_model->set_rate_scale(applied_trigger_rate / m_trigger_rate.load(), now_ns);
+        push(i);
+      }
+    }
+
+    uint64_t n_generated = 0; // NOLINT(build/unsigned)
+    for (uint32_t i = 0; i < m_max_batch_size && !schedule.empty(); ++i) { // NOLINT(build/unsigned)
+      if ((!saturate && schedule.front().first > now_ns) || shard.event_buffer->isFull())
+        break;
+
+      std::pop_heap(schedule.begin(), schedule.end(), std::greater<Entry>());
+      auto [event_ns, index] = schedule.back();
+      schedule.pop_back();
+      auto& device = *shard.devices[index];
+
+      dfmessages::timestamp_t ts = std::max(now_ts, last_ts + 1);
+      if (!saturate) {
+        double lag_ns = now_ns - event_ns;
+        ts = std::max(now_ts - static_cast<dfmessages::timestamp_t>(lag_ns * ticks_per_ns), last_ts);
+        m_pacing_jitter.record(static_cast<uint64_t>(lag_ns)); // NOLINT(build/unsigned)
+      }
+      last_ts = ts;
+
+      uint32_t signal_map = 0; // NOLINT(build/unsigned)
+      if (device.arrival_model) {
+        auto arrival = device.arrival_model->pop();
+        signal_map = arrival.signal_map | (arrival.draw_signals ? generate_signal_map(device.signal_map_generator) : 0);
+      } else {
+        signal_map = generate_signal_map(device.signal_map_generator);
+        device.next_event_ns = event_ns + period_ns;
+      }
+      push(index);
+
+      uint32_t trigger_map = signal_map & m_enabled_signals; // NOLINT(build/unsigned)
+      if (!trigger_map)
+        continue;
+
+      uint64_t counter = ++device.generated_counter; // NOLINT(build/unsigned)
+      GeneratedHSIEvent generated;
+      generated.event = dfmessages::HSIEvent(device.hsi_device_id, trigger_map, ts, counter, m_run_number);
+      fill_hsi_frame(generated.raw_data, device.link, ts, signal_map, trigger_map, counter);
+      generated.enqueue_time = now;
+      generated.device = device.link;
+      shard.event_buffer->write(std::move(generated));
+      device.last_generated_timestamp.store(ts);
+      ++n_generated;
+    }
+
+    if (n_generated) {
+      m_generated_counter += n_generated;
+      m_last_generated_timestamp.store(last_ts);
+      auto event_buffer_occupancy = shard.event_buffer->sizeGuess();
+      if (event_buffer_occupancy > shard.event_buffer_high_water_mark.load())
+        shard.event_buffer_high_water_mark.store(event_buffer_occupancy);
+    }
+
+    // the dispatcher is behind: wait for it, the schedule catches up afterwards
+    if (shard.event_buffer->isFull()) {
+      std::this_thread::sleep_for(full_buffer_retry_period);
+      continue;
+    }
+    if (saturate && n_generated)
+      continue;
+
+    double next_wakeup_ns = schedule.empty() ? now_ns + 1.e6 : std::min(schedule.front().first, now_ns + 1.e6);
+    auto next_event_time = schedule_start + std::chrono::nanoseconds(static_cast<int64_t>(next_wakeup_ns));
+    if (!saturate && next_event_time <= std::chrono::steady_clock::now())
+      continue; // behind by more than a batch
+
+    auto wakeup_time = std::min(std::max(next_event_time, now + wakeup_period), now + flag_check_period);
+    std::this_thread::sleep_until(wakeup_time);
+  }
+}
+
+void
+FakeHSIEventGenerator::dispatch_shards(std::atomic<bool>& running_flag)
+{
+  const auto idle_period = std::chrono::microseconds(50);
+
+  m_schedule_start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < m_shards.size(); ++i)
+    m_shards[i]->thread->start_working_thread("gen-hsi-" + std::to_string(i));
+
+  TimestampOrderedMerge<GeneratedHSIEvent> merge{ std::chrono::microseconds(m_merge_window) };
+  for (auto& shard : m_shards)
+    merge.add_input(shard->event_buffer.get());
+  size_t next_shard = 0;
+
+  // events ready at the same time are sent together, see send_hsi_events and send_raw_hsi_frames
+  std::vector<dfmessages::HSIEvent> batch;
+  std::vector<HSI_FRAME_STRUCT> batch_raw_frames;
+  std::vector<std::chrono::steady_clock::time_point> batch_enqueue_times;
+  std::vector<size_t> batch_devices;
+  batch.reserve(m_max_batch_size);
+  batch_raw_frames.reserve(m_max_batch_size);
+  batch_enqueue_times.reserve(m_max_batch_size);
+  batch_devices.reserve(m_max_batch_size);
+  auto batch_sent = std::make_unique<bool[]>(m_max_batch_size);
+
+  auto send_batch = [&]() {
+    if (batch.empty())
+      return;
+    send_hsi_events(batch.data(), batch.size(), batch_sent.get());
+    send_raw_hsi_frames(batch_raw_frames.data(), batch_raw_frames.size());
+
+    // events kept back by the output policy and sent later only count in the module total
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (batch_sent[i])
+        ++m_devices[batch_devices[i]]->sent_counter;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for (auto& enqueue_time : batch_enqueue_times)
+      m_dispatch_latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - enqueue_time).count());
+    batch.clear();
+    batch_raw_frames.clear();
+    batch_enqueue_times.clear();
+    batch_devices.clear();
+  };
+
+  bool draining = false;
+  while (true) {
+    // the shards are stopped first, after that everything they generated can go out without waiting
+    if (!draining && !running_flag.load()) {
+      for (auto& shard : m_shards)
+        shard->thread->stop_working_thread();
+      draining = true;
+    }
+
+    int input = -1;
+    if (m_ordered_output) {
+      input = merge.next(std::chrono::steady_clock::now(), draining);
+    } else {
+      // the shards in turn, each until it has nothing left
+      for (size_t i = 0; i < m_shards.size() && input < 0; ++i) {
+        size_t shard = (next_shard + i) % m_shards.size();
+        if (m_shards[shard]->event_buffer->frontPtr() != nullptr)
+          input = static_cast<int>(shard);
+      }
+      if (input < 0)
+        next_shard = (next_shard + 1) % m_shards.size();
+      else
+        next_shard = input;
+    }
+
+    if (input < 0) {
+      send_batch();
+      if (draining)
+        break;
+      flush_outputs();
+      std::this_thread::sleep_for(idle_period);
+      continue;
+    }
+
+    auto& event_buffer = *m_shards[input]->event_buffer;
+    auto generated = event_buffer.frontPtr();
+
+    // sent once nothing more is ready or the batch is full
+    batch.push_back(generated->event);
+    batch_raw_frames.push_back(generated->raw_data);
+    batch_enqueue_times.push_back(generated->enqueue_time);
+    batch_devices.push_back(generated->device);
+
+    event_buffer.popFront();
+
+    if (batch.size() >= m_max_batch_size) {
+      send_batch();
+      next_shard = (input + 1) % m_shards.size();
+    }
+  }
 }
 
 void
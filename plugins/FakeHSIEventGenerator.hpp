@@ -7,7 +7,10 @@
 #ifndef HSILIBS_PLUGINS_FAKEHSIEVENTGENERATOR_HPP_
 #define HSILIBS_PLUGINS_FAKEHSIEVENTGENERATOR_HPP_
 
+#include "hsilibs/ArrivalModel.hpp"
 #include "hsilibs/HSIEventSender.hpp"
+#include "hsilibs/SignalMapGenerator.hpp"
+#include "hsilibs/TimestampOrderedMerge.hpp"
 
 #include "timinglibs/TimestampEstimator.hpp"
 #include "hsilibs/fakehsieventgenerator/Nljs.hpp"
@@ -19,13 +22,15 @@
 #include "daqdataformats/Types.hpp"
 #include "dfmessages/TimeSync.hpp"
 #include "ers/Issue.hpp"
+#include "folly/ProducerConsumerQueue.h"
 #include "iomanager/Receiver.hpp"
 #include "utilities/WorkerThread.hpp"
 
+#include <atomic>
 #include <bitset>
 #include <chrono>
 #include <memory>
-#include <random>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -62,9 +67,13 @@ private:
   void do_scrap(const nlohmann::json& obj) override;
   void do_change_rate(const nlohmann::json& obj);
 
-  std::shared_ptr<raw_sender_ct> m_raw_hsi_data_sender;
   
   void do_hsi_work(std::atomic<bool>&);
+  // one event per wake-up, at the trigger rate
+  void generate_paced(std::atomic<bool>& running_flag);
+  // all due events in one burst per wake-up, or as fast as the outputs take them with saturate;
+  // also runs the stochastic arrival processes
+  void generate_batches(std::atomic<bool>& running_flag, bool saturate);
   dunedaq::utilities::WorkerThread m_thread;
 
   void dispatch_timesync(dfmessages::TimeSync& message);
@@ -77,17 +86,19 @@ private:
   // Helper class for estimating DAQ time
   std::unique_ptr<timinglibs::TimestampEstimator> m_timestamp_estimator;
 
-  // Random Generatior
-  std::default_random_engine m_random_generator;
-  std::uniform_int_distribution<uint32_t> m_uniform_distribution; // NOLINT(build/unsigned)
-  std::poisson_distribution<uint64_t> m_poisson_distribution;     // NOLINT(build/unsigned)
+  // Random signal maps, reseeded at each start
+  SignalMapGenerator m_signal_map_generator;
+  uint64_t m_random_seed; // NOLINT(build/unsigned)
 
-  uint32_t generate_signal_map(); // NOLINT(build/unsigned)
+  // event times of the stochastic arrival processes, none with the periodic one
+  std::unique_ptr<ArrivalModel> m_arrival_model;
+
+  uint32_t generate_signal_map(SignalMapGenerator& generator); // NOLINT(build/unsigned)
 
   uint64_t m_clock_frequency;                     // NOLINT(build/unsigned)
   std::atomic<float> m_trigger_rate;
   std::atomic<float> m_active_trigger_rate;
-  std::atomic<uint64_t> m_event_period;           // NOLINT(build/unsigned)
+  std::atomic<double> m_event_period; // ns
   int64_t m_timestamp_offset;
 
   uint32_t m_hsi_device_id;            // NOLINT(build/unsigned)
@@ -99,6 +110,67 @@ private:
   std::atomic<uint64_t> m_last_generated_timestamp; // NOLINT(build/unsigned)
 
   std::atomic<uint64_t> m_received_timesync_count; // NOLINT(build/unsigned)
+
+  fakehsieventgenerator::GenerationMode m_generation_mode;
+  uint32_t m_wakeup_period;  // NOLINT(build/unsigned) us
+  uint32_t m_max_batch_size; // NOLINT(build/unsigned)
+
+  LatencyHistogram m_pacing_jitter; // from the scheduled to the actual generation time of an event
+  std::chrono::steady_clock::time_point m_last_info_time;
+  uint64_t m_last_info_generated; // NOLINT(build/unsigned)
+
+  // an event on its way from a shard to the dispatcher
+  struct GeneratedHSIEvent
+  {
+    dfmessages::HSIEvent event;
+    HSI_FRAME_STRUCT raw_data;
+    std::chrono::steady_clock::time_point enqueue_time;
+    size_t device; // index in m_devices
+
+    uint64_t get_timestamp() const { return event.timestamp; } // NOLINT(build/unsigned)
+    std::chrono::steady_clock::time_point get_enqueue_time() const { return enqueue_time; }
+  };
+
+  // one emulated HSI device, only touched by the thread of its shard apart from the counters
+  struct EmulatedDevice
+  {
+    uint32_t hsi_device_id; // NOLINT(build/unsigned)
+    uint32_t link;          // NOLINT(build/unsigned) index of the device, written to the link field of its raw frames
+
+    SignalMapGenerator signal_map_generator;
+    // null with the periodic arrival process, which uses next_event_ns instead
+    std::unique_ptr<ArrivalModel> arrival_model;
+    double next_event_ns = 0;
+
+    std::atomic<uint64_t> generated_counter{ 0 };        // NOLINT(build/unsigned)
+    std::atomic<uint64_t> sent_counter{ 0 };             // NOLINT(build/unsigned)
+    std::atomic<uint64_t> last_generated_timestamp{ 0 }; // NOLINT(build/unsigned)
+  };
+
+  // a worker thread generating the events of some of the devices, in timestamp order
+  struct GeneratorShard
+  {
+    std::vector<EmulatedDevice*> devices;
+    std::unique_ptr<dunedaq::utilities::WorkerThread> thread;
+
+    // bounded single-producer/single-consumer hand-off to the dispatcher
+    std::unique_ptr<folly::ProducerConsumerQueue<GeneratedHSIEvent>> event_buffer;
+    std::atomic<size_t> event_buffer_high_water_mark{ 0 };
+  };
+
+  // with more than one device or shard, m_thread dispatches the events the shards generate;
+  // otherwise both are empty and m_thread generates the events of hsi_device_id itself
+  std::vector<std::unique_ptr<EmulatedDevice>> m_devices;
+  std::vector<std::unique_ptr<GeneratorShard>> m_shards;
+  // held by get_info while it reads the devices and shards, and by do_configure when it replaces them
+  std::mutex m_devices_mutex;
+  bool m_ordered_output;
+  uint32_t m_merge_window; // NOLINT(build/unsigned) us
+  // shared by all shards, so that the devices keep their relative phases
+  std::chrono::steady_clock::time_point m_schedule_start;
+
+  void generate_shard(GeneratorShard& shard, std::atomic<bool>& running_flag);
+  void dispatch_shards(std::atomic<bool>& running_flag);
 };
 } // namespace hsilibs
 } // namespace dunedaq
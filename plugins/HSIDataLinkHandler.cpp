@@ -10,14 +10,17 @@
 
 #include "hsilibs/Types.hpp"
 #include "HSIFrameProcessor.hpp"
+#include "HSIRequestHandlerModel.hpp"
+#include "HSISuperChunkProcessor.hpp"
+#include "TimeBucketLatencyBufferModel.hpp"
 
 #include "readoutlibs/concepts/ReadoutConcept.hpp"
 #include "readoutlibs/models/ReadoutModel.hpp"
-#include "readoutlibs/models/BinarySearchQueueModel.hpp"
-#include "readoutlibs/models/DefaultRequestHandlerModel.hpp"
 #include "readoutlibs/ReadoutLogging.hpp"
 
+#include "appfwk/DAQModuleHelper.hpp"
 #include "appfwk/cmd/Nljs.hpp"
+#include "iomanager/IOManager.hpp"
 #include "logging/Logging.hpp"
 #include "rcif/cmd/Nljs.hpp"
 
@@ -52,11 +55,25 @@ HSIDataLinkHandler::init(const data_t& args)
   
   namespace rol = dunedaq::readoutlibs;
 
-  m_readout_impl = std::make_unique<rol::ReadoutModel<
-                    hsilibs::HSI_FRAME_STRUCT,
-                    rol::DefaultRequestHandlerModel<hsilibs::HSI_FRAME_STRUCT, rol::BinarySearchQueueModel<hsilibs::HSI_FRAME_STRUCT>>,
-                    rol::BinarySearchQueueModel<hsilibs::HSI_FRAME_STRUCT>,
-                    hsilibs::HSIFrameProcessor>>(m_run_marker);
+  // the raw input carries either single frames or superchunks of frames
+  auto raw_input = appfwk::connection_uid(args, "raw_input");
+  auto datatypes = iomanager::IOManager::get()->get_datatypes(raw_input);
+  if (datatypes.size() == 1 && *datatypes.begin() == datatype_to_string<hsilibs::HSI_SUPERCHUNK_STRUCT>()) {
+    TLOG() << get_name() << ": Reading out HSI superchunks from " << raw_input;
+    m_readout_impl = std::make_unique<rol::ReadoutModel<
+                      hsilibs::HSI_SUPERCHUNK_STRUCT,
+                      HSIRequestHandlerModel<hsilibs::HSI_SUPERCHUNK_STRUCT,
+                                             TimeBucketLatencyBufferModel<hsilibs::HSI_SUPERCHUNK_STRUCT>>,
+                      TimeBucketLatencyBufferModel<hsilibs::HSI_SUPERCHUNK_STRUCT>,
+                      hsilibs::HSISuperChunkProcessor>>(m_run_marker);
+  } else {
+    m_readout_impl = std::make_unique<rol::ReadoutModel<
+                      hsilibs::HSI_FRAME_STRUCT,
+                      HSIRequestHandlerModel<hsilibs::HSI_FRAME_STRUCT,
+                                             TimeBucketLatencyBufferModel<hsilibs::HSI_FRAME_STRUCT>>,
+                      TimeBucketLatencyBufferModel<hsilibs::HSI_FRAME_STRUCT>,
+                      hsilibs::HSIFrameProcessor>>(m_run_marker);
+  }
   m_readout_impl->init(args);
   if (m_readout_impl == nullptr)
   {
@@ -13,13 +13,16 @@
 
 #include "timinglibs/TimingIssues.hpp"
 #include "timing/TimingIssues.hpp"
-#include "timing/HSIDesignInterface.hpp"
+
+#include "hsilibs/EmulatedHSIDevice.hpp"
+#include "hsilibs/HSIEventDecoder.hpp"
 
 #include "appfwk/DAQModuleHelper.hpp"
 #include "appfwk/app/Nljs.hpp"
 #include "logging/Logging.hpp"
 #include "rcif/cmd/Nljs.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <memory>
@@ -31,8 +34,62 @@ namespace dunedaq {
   ERS_DECLARE_ISSUE(hsilibs, InvalidHSIEventHeader, " Invalid hsi buffer event header: 0x" << std::hex << header, ((uint32_t)header)) // NOLINT(build/unsigned)
   ERS_DECLARE_ISSUE(hsilibs, InvalidHSIEventTimestamp, " Invalid hsi buffer event timestamp: 0x" << std::hex << timestamp, ((uint64_t)timestamp)) // NOLINT(build/unsigned)
   ERS_DECLARE_ISSUE(hsilibs, InvalidNumberReadoutHSIWords, " Invalid number of hsi words readout from buffer: 0x" << std::hex << n_words, ((uint16_t)n_words)) // NOLINT(build/unsigned)
+  ERS_DECLARE_ISSUE(hsilibs, HSIEventBufferOverflow, name << ": HSI event buffer full, dropped " << n_events << " decoded HSIEvent(s)", ((std::string)name)((uint64_t)n_events)) // NOLINT(build/unsigned)
 namespace hsilibs {
 
+static_assert(HSI_BUFFER_EVENT_SIZE == timing::g_hsi_event_size, "HSI buffer event size out of sync with timing");
+
+namespace {
+// fills the firmware buffer occupancy fields shared by hsireadoutinfo::Info and hsireadoutinfo::DeviceInfo
+template<class Info>
+void
+fill_buffer_occupancy_info(Info& info, const OccupancySummary& occupancy)
+{
+  const auto& bins = occupancy.bins;
+  info.average_buffer_occupancy = occupancy.average();
+  info.max_buffer_occupancy = occupancy.max;
+  info.p50_buffer_occupancy = occupancy.percentile(0.5);
+  info.p99_buffer_occupancy = occupancy.percentile(0.99);
+  info.buffer_occupancy_0 = bins[0];
+  info.buffer_occupancy_1_15 = bins[1] + bins[2] + bins[3] + bins[4];
+  info.buffer_occupancy_16_255 = bins[5] + bins[6] + bins[7] + bins[8];
+  info.buffer_occupancy_256_4095 = bins[9] + bins[10] + bins[11] + bins[12];
+  info.buffer_occupancy_4096_above = bins[13] + bins[14] + bins[15] + bins[16];
+}
+} // namespace
+
+/**
+ * @brief HSIDeviceInterface implementation for HSI timing firmware, accessed through uhal.
+ */
+class TimingHSIDevice : public HSIDeviceInterface
+{
+public:
+  explicit TimingHSIDevice(uhal::HwInterface& hw)
+    : m_hsi_design(dynamic_cast<const timing::HSIDesignInterface*>(&hw.getNode("")))
+    , m_hsi_node(m_hsi_design->get_hsi_node())
+    , m_ept_node(m_hsi_design->get_endpoint_node_plain(0))
+  {}
+
+  bool endpoint_ready() override { return m_ept_node->endpoint_ready(); }
+  uint32_t read_endpoint_state() override { return m_ept_node->read_endpoint_state(); } // NOLINT(build/unsigned)
+  bool read_signal_source_mode() override { return m_hsi_node.read_signal_source_mode(); }
+
+  void read_data_buffer(std::vector<uint32_t>& words, uint16_t& n_words_in_buffer) override // NOLINT
+  {
+    try {
+      auto hsi_words = m_hsi_node.read_data_buffer(n_words_in_buffer, false, true);
+      words.assign(hsi_words.begin(), hsi_words.end());
+    } catch (const uhal::exception::UdpTimeout& excpt) {
+      throw HSIReadoutNetworkIssue(ERS_HERE, excpt);
+    }
+  }
+
+private:
+  const timing::HSIDesignInterface* m_hsi_design;
+  const timing::HSINode& m_hsi_node;
+  const timing::EndpointNodeInterface* m_ept_node;
+};
+
 inline void
 resolve_environment_variables(std::string& input_string)
 {
@@ -47,11 +104,19 @@ resolve_environment_variables(std::string& input_string)
 
 HSIReadout::HSIReadout(const std::string& name)
   : HSIEventSender(name)
-  , m_thread(std::bind(&HSIReadout::do_hsi_work, this, std::placeholders::_1))
+  , m_dispatch_thread(std::bind(&HSIReadout::do_dispatch_work, this, std::placeholders::_1))
+  , m_dispatch_idle_period(100)
   , m_readout_period(1000)
+  , m_adaptive_readout_period(false)
+  , m_min_readout_period(100)
+  , m_max_readout_period(10000)
+  , m_buffer_occupancy_target(500)
+  , m_pipelined_readout(false)
+  , m_status_check_period(100000)
+  , m_merge_window(1000)
+  , m_clock_frequency(62500000)
   , m_connections_file("")
   , m_connection_manager(nullptr)
-  , m_hsi_device(nullptr)
   , m_readout_counter(0)
   , m_last_readout_timestamp(0)
 
@@ -66,7 +131,7 @@ void
 HSIReadout::init(const nlohmann::json& init_data)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering init() method";
-  m_raw_hsi_data_sender = get_iom_sender<HSI_FRAME_STRUCT>(appfwk::connection_uid(init_data, "output"));
+  set_raw_hsi_data_send_connection(appfwk::connection_uid(init_data, "output"));
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting init() method";
 }
 
@@ -77,13 +142,34 @@ HSIReadout::do_configure(const nlohmann::json& obj)
 
   m_cfg = obj.get<hsireadout::ConfParams>();
 
-  m_hsievent_send_connection = m_cfg.hsievent_connection_name;
+  set_hsievent_send_connection(m_cfg.hsievent_connection_name);
   m_connections_file = m_cfg.connections_file;
   m_readout_period = m_cfg.readout_period;
+  m_adaptive_readout_period = m_cfg.adaptive_readout_period;
+  m_min_readout_period = m_cfg.min_readout_period;
+  m_max_readout_period = m_cfg.max_readout_period;
+  m_buffer_occupancy_target = m_cfg.buffer_occupancy_target;
+  m_pipelined_readout = m_cfg.pipelined_readout;
+  m_status_check_period = m_cfg.status_check_period;
+  m_merge_window = m_cfg.merge_window;
+  m_clock_frequency = m_cfg.clock_frequency;
+  m_latency_budget = m_cfg.latency_budget;
+
+  configure_outputs(m_cfg.hsievent_output_policy, m_cfg.raw_output_policy);
+
+  if (m_adaptive_readout_period) {
+    if (m_min_readout_period == 0 || m_min_readout_period > m_max_readout_period) {
+      std::stringstream message;
+      message << "Invalid adaptive readout period bounds [" << m_min_readout_period << ", " << m_max_readout_period
+              << "] us";
+      throw HSIReadoutConfigurationIssue(ERS_HERE, message.str());
+    }
+    m_readout_period = std::clamp(m_readout_period, m_min_readout_period, m_max_readout_period);
+  }
 
-  TLOG_DEBUG(0) << get_name() << "conf: con. file before env var expansion: " << m_connections_file;
-  resolve_environment_variables(m_connections_file);
-  TLOG_DEBUG(0) << get_name() << "conf: con. file after env var expansion:  " << m_connections_file;
+  if (m_cfg.event_buffer_size < 2) {
+    throw HSIReadoutConfigurationIssue(ERS_HERE, "event_buffer_size must be at least 2");
+  }
 
   if (!m_cfg.uhal_log_level.compare("debug")) {
     uhal::setLogLevelTo(uhal::Debug());
@@ -101,27 +187,81 @@ HSIReadout::do_configure(const nlohmann::json& obj)
     throw InvalidUHALLogLevel(ERS_HERE, m_cfg.uhal_log_level);
   }
 
-  try {
-    m_connection_manager = std::make_unique<uhal::ConnectionManager>("file://" + m_connections_file);
-  } catch (const uhal::exception::FileNotFound& excpt) {
-    std::stringstream message;
-    message << m_connections_file << " not found. Has TIMING_SHARE been set?";
-    throw UHALConnectionsFileIssue(ERS_HERE, message.str(), excpt);
+  // a single device can still be given with hsi_device_name
+  std::vector<std::string> device_names(m_cfg.hsi_device_names.begin(), m_cfg.hsi_device_names.end());
+  if (device_names.empty())
+    device_names.push_back(m_cfg.hsi_device_name);
+
+  // the device index goes into the 6 bit link field of the raw frames
+  if (device_names.size() > 64) {
+    throw HSIReadoutConfigurationIssue(ERS_HERE, "at most 64 HSI devices can be read out by one HSIReadout");
   }
-  if (m_cfg.hsi_device_name.empty())
+
+  if (!m_cfg.emulate_device) {
+    TLOG_DEBUG(0) << get_name() << "conf: con. file before env var expansion: " << m_connections_file;
+    resolve_environment_variables(m_connections_file);
+    TLOG_DEBUG(0) << get_name() << "conf: con. file after env var expansion:  " << m_connections_file;
+
+    try {
+      m_connection_manager = std::make_unique<uhal::ConnectionManager>("file://" + m_connections_file);
+    } catch (const uhal::exception::FileNotFound& excpt) {
+      std::stringstream message;
+      message << m_connections_file << " not found. Has TIMING_SHARE been set?";
+      throw UHALConnectionsFileIssue(ERS_HERE, message.str(), excpt);
+    }
+  }
+
   {
-    throw UHALDeviceNameIssue(ERS_HERE, "Device name for HSIReadout should not be empty");
+    std::lock_guard<std::mutex> lock(m_devices_mutex);
+    m_devices.clear();
   }
-  m_hsi_device_name = m_cfg.hsi_device_name;
-
-  try {
-    m_hsi_device = std::make_unique<uhal::HwInterface>(m_connection_manager->getDevice(m_hsi_device_name));
-  } catch (const uhal::exception::ConnectionUIDDoesNotExist& exception) {
-    std::stringstream message;
-    message << "UHAL device name not " << m_hsi_device_name << " in connections file";
-    throw UHALDeviceNameIssue(ERS_HERE, message.str(), exception);
+  std::vector<std::unique_ptr<DeviceReadout>> devices;
+  for (size_t i = 0; i < device_names.size(); ++i) {
+    auto readout = std::make_unique<DeviceReadout>();
+    readout->name = device_names.at(i);
+    readout->link = i;
+
+    if (m_cfg.emulate_device) {
+      if (readout->name.empty())
+        readout->name = "emulated-" + std::to_string(i);
+
+      auto emulated_device_cfg = m_cfg.emulated_device;
+      if (emulated_device_cfg.random_seed)
+        emulated_device_cfg.random_seed += i;
+      readout->device = std::make_unique<EmulatedHSIDevice>(emulated_device_cfg);
+      TLOG() << get_name() << ": reading from emulated HSI device " << readout->name;
+    } else {
+      if (readout->name.empty())
+      {
+        throw UHALDeviceNameIssue(ERS_HERE, "Device name for HSIReadout should not be empty");
+      }
+
+      try {
+        readout->hw = std::make_unique<uhal::HwInterface>(m_connection_manager->getDevice(readout->name));
+      } catch (const uhal::exception::ConnectionUIDDoesNotExist& exception) {
+        std::stringstream message;
+        message << "UHAL device name not " << readout->name << " in connections file";
+        throw UHALDeviceNameIssue(ERS_HERE, message.str(), exception);
+      }
+      readout->device = std::make_unique<TimingHSIDevice>(*readout->hw);
+    }
+
+    // one slot of a folly::ProducerConsumerQueue is always kept free
+    readout->event_buffer =
+      std::make_unique<folly::ProducerConsumerQueue<DecodedHSIEvent>>(m_cfg.event_buffer_size + 1);
+
+    auto& readout_ref = *readout;
+    readout->reader_thread = std::make_unique<dunedaq::utilities::WorkerThread>(
+      std::bind(&HSIReadout::do_hsi_work, this, std::ref(readout_ref), std::placeholders::_1));
+    readout->fetch_thread = std::make_unique<dunedaq::utilities::WorkerThread>(
+      std::bind(&HSIReadout::do_fetch_work, this, std::ref(readout_ref), std::placeholders::_1));
+
+    devices.push_back(std::move(readout));
   }
 
+  std::lock_guard<std::mutex> lock(m_devices_mutex);
+  m_devices = std::move(devices);
+
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_configure() method";
 }
 
@@ -131,7 +271,39 @@ HSIReadout::do_start(const nlohmann::json& args)
   TLOG() << get_name() << ": Entering do_start() method";
   auto start_params = args.get<rcif::cmd::StartParams>();
   m_run_number.store(start_params.run);
-  m_thread.start_working_thread("read-hsi-events");
+
+  m_readout_counter = 0;
+  m_sent_counter = 0;
+  m_failed_to_send_counter = 0;
+  start_outputs(start_params.run);
+
+  m_last_readout_timestamp = 0;
+  m_last_sent_timestamp = 0;
+
+  m_readout_latency.reset();
+  m_end_to_end_latency.reset();
+  m_dispatch_latency.reset();
+  m_send_latency.reset();
+
+  for (auto& readout : m_devices) {
+    readout->readout_counter = 0;
+    readout->sent_counter = 0;
+    readout->last_readout_timestamp = 0;
+    readout->event_buffer_overflow_counter = 0;
+    readout->event_buffer_high_water_mark = 0;
+    readout->current_readout_period = m_readout_period;
+    readout->poll_ready.fill(false);
+    readout->buffer_occupancy.reset();
+    readout->next_status_check_time = std::chrono::steady_clock::time_point::min();
+  }
+
+  // the dispatcher is started first and stopped last so that it drains everything the readers decoded
+  m_dispatch_thread.start_working_thread("send-hsi-events");
+  for (auto& readout : m_devices) {
+    readout->reader_thread->start_working_thread("read-hsi-" + std::to_string(readout->link));
+    if (m_pipelined_readout)
+      readout->fetch_thread->start_working_thread("fetch-hsi-" + std::to_string(readout->link));
+  }
   TLOG() << get_name() << " successfully started";
   TLOG() << get_name() << ": Exiting do_start() method";
 }
@@ -140,7 +312,18 @@ void
 HSIReadout::do_stop(const nlohmann::json& /*args*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_stop() method";
-  m_thread.stop_working_thread();
+  for (auto& readout : m_devices) {
+    if (readout->fetch_thread->thread_running())
+      readout->fetch_thread->stop_working_thread();
+    readout->reader_thread->stop_working_thread();
+  }
+  m_dispatch_thread.stop_working_thread();
+
+  std::ostringstream oss_summ;
+  oss_summ << ": Read out " << m_readout_counter.load() << " HSIEvent messages from " << m_devices.size()
+           << " device(s) and successfully sent " << m_sent_counter.load() << " copies. ";
+  ers::info(hsilibs::ProgressUpdate(ERS_HERE, get_name(), oss_summ.str()));
+
   TLOG() << get_name() << " successfully stopped";
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_stop() method";
 }
@@ -149,188 +332,358 @@ void
 HSIReadout::do_scrap(const nlohmann::json& /*args*/)
 {
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_scrap() method";
+  {
+    std::lock_guard<std::mutex> lock(m_devices_mutex);
+    m_devices.clear();
+  }
+  m_connection_manager.reset(nullptr);
   TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_scrap() method";
 }
 
 void
-HSIReadout::do_hsi_work(std::atomic<bool>& running_flag)
+HSIReadout::do_hsi_work(DeviceReadout& readout, std::atomic<bool>& running_flag)
 {
-  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_hsievent_work() method";
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_hsievent_work() method for "
+                                      << readout.name;
 
-  m_readout_counter = 0;
-  m_sent_counter = 0;
-  m_failed_to_send_counter = 0;
+  if (m_pipelined_readout) {
+    // the fetch thread talks to the hardware, this thread only processes what it has read
+    uint poll_index = 0; // NOLINT(build/unsigned)
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(readout.poll_mutex);
+        readout.poll_cv.wait_for(lock, std::chrono::microseconds(readout.current_readout_period.load()), [&] {
+          return readout.poll_ready[poll_index];
+        });
+        if (!readout.poll_ready[poll_index]) {
+          // the fetch thread is stopped before this one, so nothing more will arrive
+          if (!running_flag.load())
+            break;
+          continue;
+        }
+      }
 
-  m_last_readout_timestamp = 0;
-  m_last_sent_timestamp = 0;
+      process_poll(readout, readout.polls[poll_index]);
+
+      {
+        std::lock_guard<std::mutex> lock(readout.poll_mutex);
+        readout.poll_ready[poll_index] = false;
+      }
+      readout.poll_cv.notify_all();
+      poll_index ^= 1;
+    }
+  } else {
+    // polls are scheduled on absolute deadlines so that the time spent on IPbus and sending does not add to the period
+    auto next_poll_time = std::chrono::steady_clock::now();
+
+    HSIPoll poll;
+    while (running_flag.load()) {
+      next_poll_time += std::chrono::microseconds(readout.current_readout_period.load());
+      poll_device(readout, poll);
+      process_poll(readout, poll);
+      wait_for_next_poll(next_poll_time);
+    }
+  }
 
-  auto hsi_design = dynamic_cast<const timing::HSIDesignInterface*> (&m_hsi_device->getNode(""));
-  auto hsi_node = hsi_design->get_hsi_node();
-  auto ept_node = hsi_design->get_endpoint_node_plain(0);
+  TLOG_DEBUG(2) << get_name() << ": Exiting do_work() method for " << readout.name << ", read out "
+                << readout.readout_counter.load() << " HSIEvent messages";
+}
+
+void
+HSIReadout::do_fetch_work(DeviceReadout& readout, std::atomic<bool>& running_flag)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_fetch_work() method for " << readout.name;
+
+  auto next_poll_time = std::chrono::steady_clock::now();
 
+  uint poll_index = 0; // NOLINT(build/unsigned)
   while (running_flag.load()) {
-        
-    // endpoint should be ready if already running
-    auto hsi_endpoint_ready = ept_node->endpoint_ready();
-    if (!hsi_endpoint_ready)
+    // wait for the reader to hand back this buffer; meanwhile it is processing the other one.
+    // The schedule only moves on with a poll, so a slow reader delays the next poll rather than skipping periods
     {
-      auto hsi_endpoint_state = ept_node->read_endpoint_state();
-      ers::error(timing::EndpointNotReady(ERS_HERE, "HSI", hsi_endpoint_state));
+      std::unique_lock<std::mutex> lock(readout.poll_mutex);
+      if (!readout.poll_cv.wait_for(
+            lock, std::chrono::milliseconds(1), [&] { return !readout.poll_ready[poll_index]; }))
+        continue;
     }
-    
-    auto hsi_emulation_mode = hsi_node.read_signal_source_mode();
 
-    uhal::ValVector<uint32_t> hsi_words;
-    try
-    {
-      uint16_t n_words_in_buffer; // NOLINT(build/unsigned)
+    poll_device(readout, readout.polls[poll_index]);
+    next_poll_time += std::chrono::microseconds(readout.current_readout_period.load());
 
-      hsi_words = hsi_node.read_data_buffer(n_words_in_buffer, false, true);
-      update_buffer_counts(n_words_in_buffer);
-      TLOG_DEBUG(5) << get_name() << ": Number of words in HSI buffer: " << n_words_in_buffer;
-    }
-    catch (const uhal::exception::UdpTimeout& excpt)
     {
-      ers::error(HSIReadoutNetworkIssue(ERS_HERE, excpt));
-      std::this_thread::sleep_for(std::chrono::microseconds(m_readout_period));
-      continue;
+      std::lock_guard<std::mutex> lock(readout.poll_mutex);
+      readout.poll_ready[poll_index] = true;
     }
-    
-    // one or more complete events
-    if (hsi_words.size() % timing::g_hsi_event_size == 0 && hsi_words.size() > 0)
-    { 
-      uint n_hsi_events = hsi_words.size() / timing::g_hsi_event_size;
+    readout.poll_cv.notify_all();
+    poll_index ^= 1;
 
-      TLOG_DEBUG(4) << get_name() << ": Have readout " << n_hsi_events << " HSIEvent(s) ";
+    wait_for_next_poll(next_poll_time);
+  }
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_fetch_work() method for " << readout.name;
+}
 
-      m_readout_counter.store(m_readout_counter.load() + n_hsi_events);
-      for (uint i = 0; i < n_hsi_events; ++i)
-      {
-        std::array<uint32_t, timing::g_hsi_event_size> raw_event;
+void
+HSIReadout::poll_device(DeviceReadout& readout, HSIPoll& poll)
+{
+  // status registers change rarely, so they are only sampled every m_status_check_period and cached in between,
+  // leaving the buffer read as the only hardware access of most polls
+  auto now = std::chrono::steady_clock::now();
+  poll.status_sampled = now >= readout.next_status_check_time;
+  if (poll.status_sampled) {
+    readout.next_status_check_time = now + std::chrono::microseconds(m_status_check_period);
 
-        auto event_start = hsi_words.begin() + (i * timing::g_hsi_event_size);
-        std::copy_n(event_start, timing::g_hsi_event_size, raw_event.begin());
+    // endpoint should be ready if already running
+    readout.endpoint_ready = readout.device->endpoint_ready();
+    if (!readout.endpoint_ready)
+      readout.endpoint_state = readout.device->read_endpoint_state();
 
-        uint32_t header = raw_event.at(0);  // NOLINT(build/unsigned)
-        uint32_t ts_low = raw_event.at(1);  // NOLINT(build/unsigned)
-        uint32_t ts_high = raw_event.at(2); // NOLINT(build/unsigned)
-        uint32_t data = raw_event.at(3);    // NOLINT(build/unsigned)
-        uint32_t trigger = raw_event.at(4); // NOLINT(build/unsigned)
+    readout.emulation_mode = readout.device->read_signal_source_mode();
+  }
+  poll.endpoint_ready = readout.endpoint_ready;
+  poll.endpoint_state = readout.endpoint_state;
+  poll.emulation_mode = readout.emulation_mode;
 
-        // put together the timestamp
-        uint64_t ts = ts_low | (static_cast<uint64_t>(ts_high) << 32); // NOLINT(build/unsigned)
+  poll.timed_out = false;
+  try
+  {
+    uint16_t n_words_in_buffer; // NOLINT(build/unsigned)
 
-        // bits 31-16 contain the HSI device ID
-        uint32_t hsi_device_id = header >> 16; // NOLINT(build/unsigned)
-        // bits 15-0 contain the sequence counter
-        uint32_t counter = header & 0x0000ffff; // NOLINT(build/unsigned)
+    readout.device->read_data_buffer(poll.words, n_words_in_buffer);
+    poll.daq_time = daq_time_now();
+    readout.buffer_occupancy.add(n_words_in_buffer);
+    update_readout_period(readout, n_words_in_buffer);
+    TLOG_DEBUG(5) << get_name() << ": Number of words in HSI buffer of " << readout.name << ": " << n_words_in_buffer;
+  }
+  catch (const HSIReadoutNetworkIssue& excpt)
+  {
+    ers::error(excpt);
+    poll.words.clear();
+    poll.timed_out = true;
+  }
+}
 
-        if ((header >> 16) != 0xaa00) {
-          ers::error(InvalidHSIEventHeader(ERS_HERE,header));
-          continue;
-        }
+void
+HSIReadout::process_poll(DeviceReadout& readout, HSIPoll& poll)
+{
+  if (poll.status_sampled && !poll.endpoint_ready)
+    ers::error(timing::EndpointNotReady(ERS_HERE, "HSI " + readout.name, poll.endpoint_state));
 
-        if (!ts)
-        {
-          ers::warning(InvalidHSIEventTimestamp(ERS_HERE,ts));
-          continue;
-        }
+  if (poll.timed_out)
+    return;
 
-        if (counter > 0 && counter % 60000 == 0)
-        {
-          TLOG_DEBUG(3) << "Sequence counter from firmware: " << counter;
-        }
+  // one or more complete events
+  if (poll.words.size() % timing::g_hsi_event_size == 0 && poll.words.size() > 0)
+  {
+    uint n_hsi_events = poll.words.size() / timing::g_hsi_event_size;
+
+    TLOG_DEBUG(4) << get_name() << ": Have readout " << n_hsi_events << " HSIEvent(s) from " << readout.name;
+
+    readout.readout_counter += n_hsi_events;
+    m_readout_counter += n_hsi_events;
+
+    auto& decoded_events = readout.decoded_events;
+    decode_hsi_events(poll.words.data(), poll.words.size(), decoded_events);
+
+    auto enqueue_time = std::chrono::steady_clock::now();
 
-        TLOG_DEBUG(3) << get_name() << ": read out data: " << std::showbase << std::hex << header << ", " << ts
-                      << ", " << data << ", " << std::bitset<32>(trigger) << ", "
-                      << "ts: " << ts << "\n";
-                  
-        // In lieu of propper HSI channel to signal mapping, fake signal map when HSI firmware+hardware is in emulation mode.
-        // TODO DAQ/HSI team 24/03/22 Put in place HSI channel to signal mapping.
-
-        if (hsi_emulation_mode)
-        {
-          TLOG_DEBUG(3) << " HSI hardware is in emulation mode, faking (overwriting) signal map from firmware+hardware to have (only) bit 7 high.";
-          trigger = 1UL << 7;
+    uint n_dropped_events = 0; // NOLINT(build/unsigned)
+    for (uint i = 0; i < n_hsi_events; ++i)
+    {
+      uint64_t ts = decoded_events.timestamps[i];            // NOLINT(build/unsigned)
+      uint32_t hsi_device_id = decoded_events.device_ids[i]; // NOLINT(build/unsigned)
+      uint32_t counter = decoded_events.counters[i];         // NOLINT(build/unsigned)
+      uint32_t data = decoded_events.data[i];                // NOLINT(build/unsigned)
+      uint32_t trigger = decoded_events.triggers[i];         // NOLINT(build/unsigned)
+
+      if (!decoded_events.is_valid(i)) {
+        if (hsi_device_id != HSI_BUFFER_EVENT_HEADER_MARKER) {
+          ers::error(InvalidHSIEventHeader(ERS_HERE, decoded_events.header(i)));
+        } else {
+          ers::warning(InvalidHSIEventTimestamp(ERS_HERE, ts));
         }
-        
-        dfmessages::HSIEvent event = dfmessages::HSIEvent(hsi_device_id, trigger, ts, counter, m_run_number);
-          
-        m_last_readout_timestamp.store(ts);
-
-        send_hsi_event(event);
-
-        // Send raw HSI data to a DLH 
-        std::array<uint32_t, 7> hsi_struct;
-        hsi_struct[0] = (0x1 << 6) | 0x1; // DAQHeader, frame version: 1, det id: 1
-        hsi_struct[1] = ts_low;
-        hsi_struct[2] = ts_high;
-        hsi_struct[3] = data;
-        hsi_struct[4] = 0x0;
-        hsi_struct[5] = trigger;
-        hsi_struct[6] = counter;
-
-        TLOG_DEBUG(3) << get_name() << ": Formed HSI_FRAME_STRUCT "
-              << std::hex 
-              << "0x"   << hsi_struct[0]
-              << ", 0x" << hsi_struct[1]
-              << ", 0x" << hsi_struct[2]
-              << ", 0x" << hsi_struct[3]
-              << ", 0x" << hsi_struct[4]
-              << ", 0x" << hsi_struct[5]
-              << ", 0x" << hsi_struct[6]
-              << "\n";
-
-        send_raw_hsi_data(hsi_struct, m_raw_hsi_data_sender.get());
+        continue;
       }
+
+      if (counter > 0 && counter % 60000 == 0)
+      {
+        TLOG_EVENT_DEBUG(3) << "Sequence counter from firmware: " << counter;
+      }
+
+      TLOG_EVENT_DEBUG(3) << get_name() << ": read out data: " << std::showbase << std::hex << decoded_events.header(i)
+                          << ", " << ts << ", " << data << ", " << std::bitset<32>(trigger) << ", "
+                          << "ts: " << ts << "\n";
+
+      // In lieu of propper HSI channel to signal mapping, fake signal map when HSI firmware+hardware is in emulation mode.
+      // TODO DAQ/HSI team 24/03/22 Put in place HSI channel to signal mapping.
+
+      if (poll.emulation_mode)
+      {
+        TLOG_EVENT_DEBUG(3) << " HSI hardware is in emulation mode, faking (overwriting) signal map from firmware+hardware to have (only) bit 7 high.";
+        trigger = 1UL << 7;
+      }
+
+      m_readout_latency.record(ticks_to_ns(ts, poll.daq_time));
+
+      readout.last_readout_timestamp.store(ts);
+      m_last_readout_timestamp.store(ts);
+
+      DecodedHSIEvent decoded;
+      decoded.event = dfmessages::HSIEvent(hsi_device_id, trigger, ts, counter, m_run_number);
+      decoded.enqueue_time = enqueue_time;
+
+      // Raw HSI data for a DLH, the link field identifies the device
+      fill_hsi_frame(decoded.raw_data, readout.link, ts, data, trigger, counter);
+
+      // never wait for the dispatcher here, the firmware buffer has to keep being drained
+      if (!readout.event_buffer->write(std::move(decoded))) {
+        ++n_dropped_events;
+        continue;
+      }
+      auto event_buffer_occupancy = readout.event_buffer->sizeGuess();
+      if (event_buffer_occupancy > readout.event_buffer_high_water_mark.load())
+        readout.event_buffer_high_water_mark.store(event_buffer_occupancy);
     }
-    // empty buffer is ok
-    else if (hsi_words.size() == 0)
-    {
-      TLOG_DEBUG(20) << "Empty HSI buffter";
-    }
-    // anything else is unexpected
-    else
-    {
-      ers::error(InvalidNumberReadoutHSIWords(ERS_HERE, hsi_words.size()));
+
+    if (n_dropped_events) {
+      readout.event_buffer_overflow_counter += n_dropped_events;
+      ers::warning(HSIEventBufferOverflow(ERS_HERE, get_name() + "/" + readout.name, n_dropped_events));
     }
-    std::this_thread::sleep_for(std::chrono::microseconds(m_readout_period));
   }
-  std::ostringstream oss_summ;
-  oss_summ << ": Exiting the read_hsievents() method, read out " << m_readout_counter.load()
-           << " HSIEvent messages and successfully sent " << m_sent_counter.load() << " copies. ";
-  ers::info(hsilibs::ProgressUpdate(ERS_HERE, get_name(), oss_summ.str()));
-  TLOG_DEBUG(2) << get_name() << ": Exiting do_work() method";
+  // empty buffer is ok
+  else if (poll.words.size() == 0)
+  {
+    TLOG_DEBUG(20) << "Empty HSI buffter";
+  }
+  // anything else is unexpected
+  else
+  {
+    ers::error(InvalidNumberReadoutHSIWords(ERS_HERE, poll.words.size()));
+  }
 }
 
 void
-HSIReadout::update_buffer_counts(uint16_t new_count) // NOLINT(build/unsigned)
+HSIReadout::do_dispatch_work(std::atomic<bool>& running_flag)
 {
-  std::unique_lock mon_data_lock(m_buffer_counts_mutex);
-  if (m_buffer_counts.size() > 1000)
-    m_buffer_counts.pop_front();
-  m_buffer_counts.push_back(new_count);
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_dispatch_work() method";
+
+  TimestampOrderedMerge<DecodedHSIEvent> merge{ std::chrono::microseconds(m_merge_window) };
+  for (auto& readout : m_devices)
+    merge.add_input(readout->event_buffer.get());
+
+  // events ready at the same time are sent together, see send_hsi_events and send_raw_hsi_frames
+  std::vector<dfmessages::HSIEvent> batch;
+  std::vector<HSI_FRAME_STRUCT> batch_raw_frames;
+  std::vector<std::chrono::steady_clock::time_point> batch_enqueue_times;
+  std::vector<DeviceReadout*> batch_devices;
+  batch.reserve(m_cfg.event_buffer_size);
+  batch_raw_frames.reserve(m_cfg.event_buffer_size);
+  batch_enqueue_times.reserve(m_cfg.event_buffer_size);
+  batch_devices.reserve(m_cfg.event_buffer_size);
+  auto batch_sent = std::make_unique<bool[]>(m_cfg.event_buffer_size);
+
+  auto send_batch = [&]() {
+    if (batch.empty())
+      return;
+    send_raw_hsi_frames(batch_raw_frames.data(), batch_raw_frames.size());
+    send_hsi_events(batch.data(), batch.size(), batch_sent.get());
+
+    // events kept back by the output policy and sent later only count in the module total
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (batch_sent[i])
+        ++batch_devices[i]->sent_counter;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto daq_time = daq_time_now();
+    for (size_t i = 0; i < batch.size(); ++i) {
+      m_dispatch_latency.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now - batch_enqueue_times[i]).count());
+      m_end_to_end_latency.record(ticks_to_ns(batch[i].timestamp, daq_time));
+    }
+    batch.clear();
+    batch_raw_frames.clear();
+    batch_enqueue_times.clear();
+    batch_devices.clear();
+  };
+
+  while (true) {
+    // the readers are stopped before the dispatcher, after that everything left can go out without waiting
+    bool draining = !running_flag.load();
+
+    int input = merge.next(std::chrono::steady_clock::now(), draining);
+    if (input < 0) {
+      send_batch();
+      if (draining)
+        break;
+      flush_outputs();
+      std::this_thread::sleep_for(std::chrono::microseconds(m_dispatch_idle_period));
+      continue;
+    }
+
+    auto& readout = *m_devices[input];
+    auto decoded = readout.event_buffer->frontPtr();
+
+    // sent once nothing more is ready or the batch is full
+    batch.push_back(decoded->event);
+    batch_raw_frames.push_back(decoded->raw_data);
+    batch_enqueue_times.push_back(decoded->enqueue_time);
+    batch_devices.push_back(&readout);
+
+    readout.event_buffer->popFront();
+
+    if (batch.size() >= m_cfg.event_buffer_size)
+      send_batch();
+  }
+  flush_outputs(true);
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_dispatch_work() method";
 }
 
-double
-HSIReadout::read_average_buffer_counts()
+void
+HSIReadout::update_readout_period(DeviceReadout& readout, uint16_t n_words_in_buffer) // NOLINT(build/unsigned)
 {
-  std::unique_lock mon_data_lock(m_buffer_counts_mutex);
+  if (!m_adaptive_readout_period)
+    return;
+
+  uint period = readout.current_readout_period.load(); // NOLINT(build/unsigned)
+  if (n_words_in_buffer >= m_buffer_occupancy_target) {
+    // firmware buffer is filling up, poll twice as often
+    period = std::max(period / 2, m_min_readout_period);
+  } else if (n_words_in_buffer == 0) {
+    // nothing to read, back off gently
+    period = std::min(period + period / 4 + 1, m_max_readout_period);
+  }
+  readout.current_readout_period.store(period);
+}
 
-  double total_counts;
-  uint32_t number_of_counts; // NOLINT(build/unsigned)
+void
+HSIReadout::wait_for_next_poll(std::chrono::steady_clock::time_point& next_poll_time)
+{
+  auto now = std::chrono::steady_clock::now();
+  // if we fell behind (e.g. slow IPbus or downstream), do not try to catch up with a burst of polls
+  if (next_poll_time < now) {
+    next_poll_time = now;
+    return;
+  }
+  std::this_thread::sleep_until(next_poll_time);
+}
 
-  total_counts = 0;
-  number_of_counts = m_buffer_counts.size();
+uint64_t // NOLINT(build/unsigned)
+HSIReadout::daq_time_now() const
+{
+  // timing system timestamps count clock ticks since the epoch
+  auto ns_since_epoch =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+  return (ns_since_epoch / 1000000000) * m_clock_frequency +
+         (ns_since_epoch % 1000000000) * m_clock_frequency / 1000000000;
+}
 
-  if (number_of_counts) {
-    for (uint i = 0; i < number_of_counts; ++i) { // NOLINT(build/unsigned)
-      total_counts = total_counts + m_buffer_counts.at(i);
-    }
-    return total_counts / number_of_counts;
-  } else {
+uint64_t // NOLINT(build/unsigned)
+HSIReadout::ticks_to_ns(uint64_t from_timestamp, uint64_t to_timestamp) const // NOLINT(build/unsigned)
+{
+  // an event from the future means the host and timing clocks disagree, it is counted as no latency
+  if (to_timestamp <= from_timestamp)
     return 0;
-  }
+  return static_cast<uint64_t>(static_cast<double>(to_timestamp - from_timestamp) * 1.e9 / m_clock_frequency); // NOLINT
 }
 
 void
@@ -342,11 +695,75 @@ HSIReadout::get_info(opmonlib::InfoCollector& ci, int /*level*/)
   module_info.readout_hsi_events_counter = m_readout_counter.load();
   module_info.sent_hsi_events_counter = m_sent_counter.load();
   module_info.failed_to_send_hsi_events_counter = m_failed_to_send_counter.load();
+  module_info.dropped_hsi_events_counter = get_dropped_hsi_events_counter();
+  module_info.dropped_raw_hsi_frames_counter = get_dropped_raw_hsi_frames_counter();
+  module_info.spilled_hsi_events_counter = get_spilled_hsi_events_counter();
+  module_info.spilled_raw_hsi_frames_counter = get_spilled_raw_hsi_frames_counter();
+  module_info.hsi_event_backlog = get_hsi_event_backlog_size();
+  module_info.raw_hsi_frame_backlog = get_raw_hsi_frame_backlog_size();
 
   module_info.last_readout_timestamp = m_last_readout_timestamp.load();
   module_info.last_sent_timestamp = m_last_sent_timestamp.load();
 
-  module_info.average_buffer_occupancy = read_average_buffer_counts();
+  // module level buffer figures summarise the per device ones
+  std::lock_guard<std::mutex> lock(m_devices_mutex);
+  OccupancySummary total_buffer_occupancy;
+  module_info.readout_period = m_devices.empty() ? m_readout_period : UINT32_MAX;
+  module_info.event_buffer_occupancy = 0;
+  module_info.event_buffer_high_water_mark = 0;
+  module_info.event_buffer_overflow_counter = 0;
+
+  for (auto& readout : m_devices) {
+    hsireadoutinfo::DeviceInfo device_info;
+
+    device_info.readout_hsi_events_counter = readout->readout_counter.load();
+    device_info.sent_hsi_events_counter = readout->sent_counter.load();
+    device_info.last_readout_timestamp = readout->last_readout_timestamp.load();
+    auto buffer_occupancy = readout->buffer_occupancy.read();
+    fill_buffer_occupancy_info(device_info, buffer_occupancy);
+    device_info.readout_period = readout->current_readout_period.load();
+    device_info.event_buffer_occupancy = readout->event_buffer->sizeGuess();
+    device_info.event_buffer_high_water_mark = readout->event_buffer_high_water_mark.load();
+    device_info.event_buffer_overflow_counter = readout->event_buffer_overflow_counter.load();
+
+    total_buffer_occupancy.merge(buffer_occupancy);
+    module_info.readout_period = std::min(module_info.readout_period, device_info.readout_period);
+    module_info.event_buffer_occupancy += device_info.event_buffer_occupancy;
+    module_info.event_buffer_high_water_mark =
+      std::max(module_info.event_buffer_high_water_mark, device_info.event_buffer_high_water_mark);
+    module_info.event_buffer_overflow_counter += device_info.event_buffer_overflow_counter;
+
+    opmonlib::InfoCollector device_ci;
+    device_ci.add(device_info);
+    ci.add(readout->name, device_ci);
+  }
+  fill_buffer_occupancy_info(module_info, total_buffer_occupancy);
+
+  auto readout_latency = m_readout_latency.read();
+  module_info.readout_latency_p50 = readout_latency.p50 / 1000.;
+  module_info.readout_latency_p90 = readout_latency.p90 / 1000.;
+  module_info.readout_latency_p99 = readout_latency.p99 / 1000.;
+  module_info.readout_latency_max = readout_latency.max / 1000.;
+
+  auto dispatch_latency = m_dispatch_latency.read();
+  module_info.dispatch_latency_p50 = dispatch_latency.p50 / 1000.;
+  module_info.dispatch_latency_p90 = dispatch_latency.p90 / 1000.;
+  module_info.dispatch_latency_p99 = dispatch_latency.p99 / 1000.;
+  module_info.dispatch_latency_max = dispatch_latency.max / 1000.;
+
+  auto send_latency = m_send_latency.read();
+  module_info.send_latency_p50 = send_latency.p50 / 1000.;
+  module_info.send_latency_p90 = send_latency.p90 / 1000.;
+  module_info.send_latency_p99 = send_latency.p99 / 1000.;
+  module_info.send_latency_max = send_latency.max / 1000.;
+
+  auto end_to_end_latency = m_end_to_end_latency.read();
+  module_info.end_to_end_latency_p50 = end_to_end_latency.p50 / 1000.;
+  module_info.end_to_end_latency_p90 = end_to_end_latency.p90 / 1000.;
+  module_info.end_to_end_latency_p99 = end_to_end_latency.p99 / 1000.;
+  module_info.end_to_end_latency_max = end_to_end_latency.max / 1000.;
+
+  check_latency_budget("end-to-end", end_to_end_latency);
 
   ci.add(module_info);
 }
@@ -7,7 +7,11 @@
 #ifndef HSILIBS_PLUGINS_HSIREADOUT_HPP_
 #define HSILIBS_PLUGINS_HSIREADOUT_HPP_
 
+#include "hsilibs/HSIDeviceInterface.hpp"
+#include "hsilibs/HSIEventDecoder.hpp"
 #include "hsilibs/HSIEventSender.hpp"
+#include "hsilibs/OccupancyStatistics.hpp"
+#include "hsilibs/TimestampOrderedMerge.hpp"
 #include "hsilibs/hsireadout/Nljs.hpp"
 #include "hsilibs/hsireadout/Structs.hpp"
 #include "hsilibs/hsireadoutinfo/InfoNljs.hpp"
@@ -15,6 +19,8 @@
 
 #include "appfwk/DAQModule.hpp"
 #include "dfmessages/HSIEvent.hpp"
+#include "folly/ProducerConsumerQueue.h"
+#include "timing/HSIDesignInterface.hpp"
 #include "timing/HSINode.hpp"
 #include "uhal/ConnectionManager.hpp"
 #include "uhal/ProtocolUDP.hpp"
@@ -23,12 +29,13 @@
 #include "utilities/WorkerThread.hpp"
 #include <ers/Issue.hpp>
 
+#include <array>
 #include <bitset>
 #include <chrono>
-#include <deque>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <random>
-#include <shared_mutex>
 #include <string>
 #include <vector>
 
@@ -36,8 +43,8 @@ namespace dunedaq {
 namespace hsilibs {
 
 /**
- * @brief HSIReadout generates fake HSIEvent messages
- * and pushes them to the configured output queue.
+ * @brief HSIReadout reads HSIEvents out of one or more HSI devices
+ * and pushes them, in timestamp order, to the configured output queues.
  */
 class HSIReadout : public hsilibs::HSIEventSender
 {
@@ -64,27 +71,114 @@ private:
   void do_stop(const nlohmann::json& obj) override;
   void do_scrap(const nlohmann::json& obj) override;
 
-  std::shared_ptr<raw_sender_ct> m_raw_hsi_data_sender;
-  
-  void do_hsi_work(std::atomic<bool>&);
-  dunedaq::utilities::WorkerThread m_thread;
+
+  // result of one hardware poll
+  struct HSIPoll
+  {
+    bool endpoint_ready = true;
+    uint32_t endpoint_state = 0; // NOLINT(build/unsigned)
+    bool emulation_mode = false;
+    bool status_sampled = false; // status fields were read from hardware in this poll rather than cached
+    bool timed_out = false;
+    std::vector<uint32_t> words; // NOLINT(build/unsigned)
+    uint64_t daq_time = 0;       // NOLINT(build/unsigned) estimated DAQ time when the buffer was read
+  };
+
+  struct DecodedHSIEvent
+  {
+    dfmessages::HSIEvent event;
+    HSI_FRAME_STRUCT raw_data;
+    std::chrono::steady_clock::time_point enqueue_time;
+
+    uint64_t get_timestamp() const { return event.timestamp; } // NOLINT(build/unsigned)
+    std::chrono::steady_clock::time_point get_enqueue_time() const { return enqueue_time; }
+  };
+
+  // everything belonging to the readout of one HSI device
+  struct DeviceReadout
+  {
+    std::string name;
+    uint32_t link; // NOLINT(build/unsigned) index of the device, written to the link field of its raw frames
+
+    std::unique_ptr<uhal::HwInterface> hw;
+    // hardware access used by the readout, either hw or an emulation
+    std::unique_ptr<HSIDeviceInterface> device;
+
+    // reader stage: drains the firmware buffer and decodes events into event_buffer
+    std::unique_ptr<dunedaq::utilities::WorkerThread> reader_thread;
+    // optional fetch stage: reads the hardware into one of two buffers while the reader decodes the other
+    std::unique_ptr<dunedaq::utilities::WorkerThread> fetch_thread;
+
+    // poll period currently in use [us]; only differs from m_readout_period in adaptive mode
+    std::atomic<uint> current_readout_period{ 1000 }; // NOLINT(build/unsigned)
+
+    // status register cache, only touched by the thread doing the hardware access
+    std::chrono::steady_clock::time_point next_status_check_time;
+    bool endpoint_ready = true;
+    uint32_t endpoint_state = 0; // NOLINT(build/unsigned)
+    bool emulation_mode = false;
+
+    // double buffer shared by the fetch and reader stages in pipelined mode
+    std::array<HSIPoll, 2> polls;
+    std::array<bool, 2> poll_ready{ false, false };
+    std::mutex poll_mutex;
+    std::condition_variable poll_cv;
+
+    // reused between polls by the reader stage
+    HSIDecodedEvents decoded_events;
+
+    // bounded single-producer/single-consumer hand-off between the reader and dispatcher stages
+    std::unique_ptr<folly::ProducerConsumerQueue<DecodedHSIEvent>> event_buffer;
+    std::atomic<size_t> event_buffer_high_water_mark{ 0 };
+    std::atomic<uint64_t> event_buffer_overflow_counter{ 0 }; // NOLINT(build/unsigned)
+
+    std::atomic<uint64_t> readout_counter{ 0 };        // NOLINT(build/unsigned)
+    std::atomic<uint64_t> sent_counter{ 0 };           // NOLINT(build/unsigned)
+    std::atomic<uint64_t> last_readout_timestamp{ 0 }; // NOLINT(build/unsigned)
+
+    // firmware buffer occupancy [words] of the recent polls
+    OccupancyStatistics buffer_occupancy;
+  };
+  std::vector<std::unique_ptr<DeviceReadout>> m_devices;
+  // held by get_info while it reads the devices, and by the commands that replace them
+  std::mutex m_devices_mutex;
+
+  void do_hsi_work(DeviceReadout& readout, std::atomic<bool>&);
+  void do_fetch_work(DeviceReadout& readout, std::atomic<bool>&);
+  void poll_device(DeviceReadout& readout, HSIPoll& poll);
+  void process_poll(DeviceReadout& readout, HSIPoll& poll);
+
+  // dispatcher stage: merges the decoded events of all devices in timestamp order and sends them downstream
+  void do_dispatch_work(std::atomic<bool>&);
+  dunedaq::utilities::WorkerThread m_dispatch_thread;
+  uint m_dispatch_idle_period; // NOLINT(build/unsigned)
 
   // Configuration
-  std::string m_hsi_device_name;
-  uint m_readout_period; // NOLINT(build/unsigned)
+  uint m_readout_period;          // NOLINT(build/unsigned)
+  bool m_adaptive_readout_period;
+  uint m_min_readout_period;      // NOLINT(build/unsigned)
+  uint m_max_readout_period;      // NOLINT(build/unsigned)
+  uint m_buffer_occupancy_target; // NOLINT(build/unsigned)
+  bool m_pipelined_readout;
+  uint m_status_check_period;     // NOLINT(build/unsigned)
+  uint m_merge_window;            // NOLINT(build/unsigned)
+  uint64_t m_clock_frequency;     // NOLINT(build/unsigned)
+
+  void update_readout_period(DeviceReadout& readout, uint16_t n_words_in_buffer); // NOLINT(build/unsigned)
+  void wait_for_next_poll(std::chrono::steady_clock::time_point& next_poll_time);
 
   std::string m_connections_file;
   std::unique_ptr<uhal::ConnectionManager> m_connection_manager;
-  std::unique_ptr<uhal::HwInterface> m_hsi_device;
   std::atomic<daqdataformats::run_number_t> m_run_number;
 
   std::atomic<uint64_t> m_readout_counter;        // NOLINT(build/unsigned)
   std::atomic<uint64_t> m_last_readout_timestamp; // NOLINT(build/unsigned)
 
-  std::deque<uint16_t> m_buffer_counts; // NOLINT(build/unsigned)
-  std::shared_mutex m_buffer_counts_mutex;
-  void update_buffer_counts(uint16_t new_count); // NOLINT(build/unsigned)
-  double read_average_buffer_counts();
+  // Latencies [ns] measured against the DAQ time estimated from the system clock
+  LatencyHistogram m_readout_latency;    // from the firmware timestamp until the event is read out
+  LatencyHistogram m_end_to_end_latency; // from the firmware timestamp until both copies of the event are sent
+  uint64_t daq_time_now() const;                                       // NOLINT(build/unsigned)
+  uint64_t ticks_to_ns(uint64_t from_timestamp, uint64_t to_timestamp) const; // NOLINT(build/unsigned)
 };
 } // namespace hsilibs
 } // namespace dunedaq
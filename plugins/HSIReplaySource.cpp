@@ -0,0 +1,287 @@
+/**
+ * @file HSIReplaySource.cpp HSIReplaySource class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "HSIReplaySource.hpp"
+
+#include "hsilibs/Issues.hpp"
+#include "hsilibs/hsireplaysource/Nljs.hpp"
+
+#include "timinglibs/TimingIssues.hpp"
+
+#include "appfwk/DAQModuleHelper.hpp"
+#include "appfwk/app/Nljs.hpp"
+#include "iomanager/IOManager.hpp"
+#include "logging/Logging.hpp"
+#include "rcif/cmd/Nljs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+HSIReplaySource::HSIReplaySource(const std::string& name)
+  : HSIEventSender(name)
+  , m_thread(std::bind(&HSIReplaySource::do_hsi_work, this, std::placeholders::_1))
+  , m_timestamp_estimator(nullptr)
+  , m_replayed_counter(0)
+  , m_replayed_events_counter(0)
+  , m_replay_passes(0)
+  , m_last_replayed_timestamp(0)
+  , m_max_lag(0)
+  , m_received_timesync_count(0)
+{
+  register_command("conf", &HSIReplaySource::do_configure);
+  register_command("start", &HSIReplaySource::do_start);
+  register_command("stop_trigger_sources", &HSIReplaySource::do_stop);
+  register_command("scrap", &HSIReplaySource::do_scrap);
+}
+
+void
+HSIReplaySource::init(const nlohmann::json& init_data)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering init() method";
+  set_raw_hsi_data_send_connection(appfwk::connection_uid(init_data, "output"));
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting init() method";
+}
+
+void
+HSIReplaySource::get_info(opmonlib::InfoCollector& ci, int /*level*/)
+{
+  hsireplaysourceinfo::Info module_info;
+
+  module_info.replayed_frames_counter = m_replayed_counter.load();
+  module_info.replayed_hsi_events_counter = m_replayed_events_counter.load();
+  module_info.sent_hsi_events_counter = m_sent_counter.load();
+  module_info.failed_to_send_hsi_events_counter = m_failed_to_send_counter.load();
+  module_info.dropped_hsi_events_counter = get_dropped_hsi_events_counter();
+  module_info.dropped_raw_hsi_frames_counter = get_dropped_raw_hsi_frames_counter();
+  module_info.replay_passes = m_replay_passes.load();
+  module_info.last_replayed_timestamp = m_last_replayed_timestamp.load();
+  module_info.max_lag = m_max_lag.exchange(0) / 1000.;
+
+  ci.add(module_info);
+}
+
+void
+HSIReplaySource::do_configure(const nlohmann::json& obj)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_configure() method";
+
+  m_conf = obj.get<hsireplaysource::Conf>();
+
+  set_hsievent_send_connection(m_conf.hsievent_connection_name);
+
+  if (m_conf.speed < 0)
+    throw HSIReadoutConfigurationIssue(ERS_HERE, "replay speed must not be negative");
+  if (!m_conf.batch_size)
+    m_conf.batch_size = 1;
+
+  m_reader = std::make_unique<HSIRecordingReader>(m_conf.input_file);
+  TLOG() << get_name() << ": Replaying " << (m_reader->is_raw() ? "raw HSI frames" : "the HSI recording") << " "
+         << m_conf.input_file << " at speed " << m_conf.speed << (m_conf.speed > 0 ? "" : " (as fast as possible)");
+
+  m_pending_frames.reserve(m_conf.batch_size);
+  m_pending_events.reserve(m_conf.batch_size);
+
+  configure_outputs(m_conf.hsievent_output_policy, m_conf.raw_output_policy);
+
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_configure() method";
+}
+
+void
+HSIReplaySource::do_start(const nlohmann::json& obj)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_start() method";
+  m_timestamp_estimator.reset(new timinglibs::TimestampEstimator(m_conf.clock_frequency));
+
+  m_received_timesync_count.store(0);
+
+  m_timesync_receiver = get_iom_receiver<dfmessages::TimeSync>(".*");
+  m_timesync_receiver->add_callback(std::bind(&HSIReplaySource::dispatch_timesync, this, std::placeholders::_1));
+
+  auto start_params = obj.get<rcif::cmd::StartParams>();
+  m_run_number.store(start_params.run);
+
+  start_outputs(start_params.run);
+
+  m_thread.start_working_thread("hsi-replay");
+  TLOG() << get_name() << " successfully started";
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_start() method";
+}
+
+void
+HSIReplaySource::do_stop(const nlohmann::json& /*args*/)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_stop() method";
+  m_thread.stop_working_thread();
+
+  m_timesync_receiver->remove_callback();
+  TLOG() << get_name() << ": received " << m_received_timesync_count.load() << " TimeSync messages.";
+
+  m_timestamp_estimator.reset(nullptr); // Calls TimestampEstimator dtor
+
+  TLOG() << get_name() << " successfully stopped";
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_stop() method";
+}
+
+void
+HSIReplaySource::do_scrap(const nlohmann::json& /*args*/)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_scrap() method";
+  m_reader.reset();
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_scrap() method";
+}
+
+void
+HSIReplaySource::send_pending()
+{
+  if (!m_pending_frames.empty()) {
+    send_raw_hsi_frames(m_pending_frames.data(), m_pending_frames.size());
+    m_last_replayed_timestamp.store(m_pending_frames.back().get_first_timestamp());
+    m_pending_frames.clear();
+  }
+  if (!m_pending_events.empty()) {
+    send_hsi_events(m_pending_events.data(), m_pending_events.size());
+    m_pending_events.clear();
+  }
+}
+
+bool
+HSIReplaySource::wait_until(std::chrono::steady_clock::time_point time, std::atomic<bool>& running_flag)
+{
+  // check running_flag periodically
+  auto flag_check_period = std::chrono::milliseconds(1);
+  while (time - std::chrono::steady_clock::now() > flag_check_period) {
+    if (!running_flag.load())
+      return false;
+    std::this_thread::sleep_for(flag_check_period);
+  }
+  std::this_thread::sleep_until(time);
+  return running_flag.load();
+}
+
+void
+HSIReplaySource::do_hsi_work(std::atomic<bool>& running_flag)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_hsi_work() method";
+
+  // Wait for there to be a valid timestsamp estimate before we start
+  if (m_timestamp_estimator.get() != nullptr &&
+      m_timestamp_estimator->wait_for_valid_timestamp(running_flag) == timinglibs::TimestampEstimatorBase::kInterrupted) {
+    ers::error(timinglibs::FailedToGetTimestampEstimate(ERS_HERE));
+    return;
+  }
+
+  m_replayed_counter = 0;
+  m_replayed_events_counter = 0;
+  m_replay_passes = 0;
+  m_sent_counter = 0;
+  m_last_replayed_timestamp = 0;
+  m_last_sent_timestamp = 0;
+  m_failed_to_send_counter = 0;
+
+  m_send_latency.reset();
+
+  const double speed = m_conf.speed;
+  const double ns_per_tick = 1.e9 / m_conf.clock_frequency;
+  detdataformats::HSIFrame frame;
+  uint64_t last_ts = 0; // NOLINT(build/unsigned)
+
+  while (running_flag.load()) {
+    m_reader->seek(0);
+    if (!m_reader->next(frame)) {
+      ers::warning(HSIRecordingIssue(ERS_HERE, m_conf.input_file, "no frames to replay"));
+      break;
+    }
+    ++m_replay_passes;
+
+    // the first frame of each pass is replayed now, at the current DAQ time
+    uint64_t recorded_base = frame.get_timestamp(); // NOLINT(build/unsigned)
+    uint64_t daq_base = std::max<uint64_t>(         // NOLINT(build/unsigned)
+      m_timestamp_estimator->get_timestamp_estimate() + m_conf.timestamp_offset,
+      last_ts + 1);
+    auto time_base = std::chrono::steady_clock::now();
+
+    do {
+      uint64_t recorded_ts = frame.get_timestamp(); // NOLINT(build/unsigned)
+      uint64_t delta = recorded_ts > recorded_base ? recorded_ts - recorded_base : 0; // NOLINT(build/unsigned)
+
+      uint64_t ts = daq_base + delta; // NOLINT(build/unsigned)
+      if (speed > 0) {
+        // the rebased timestamps follow the DAQ time at the sped up replay
+        ts = daq_base + static_cast<uint64_t>(delta / speed); // NOLINT(build/unsigned)
+        auto due = time_base + std::chrono::nanoseconds(static_cast<int64_t>(delta * ns_per_tick / speed));
+        auto now = std::chrono::steady_clock::now();
+        if (due > now) {
+          send_pending();
+          if (!wait_until(due, running_flag))
+            break;
+        } else {
+          int64_t lag = std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count();
+          if (lag > m_max_lag.load(std::memory_order_relaxed))
+            m_max_lag.store(lag, std::memory_order_relaxed);
+        }
+      }
+
+      HSI_FRAME_STRUCT raw;
+      raw.frame = frame;
+      raw.set_first_timestamp(ts);
+      m_pending_frames.push_back(raw);
+      if (frame.trigger) {
+        m_pending_events.emplace_back(m_conf.hsi_device_id, frame.trigger, ts, frame.sequence, m_run_number.load());
+        ++m_replayed_events_counter;
+      }
+      ++m_replayed_counter;
+      last_ts = ts;
+
+      if (m_pending_frames.size() >= m_conf.batch_size)
+        send_pending();
+    } while (running_flag.load() && m_reader->next(frame));
+
+    send_pending();
+    if (!m_conf.loop)
+      break;
+  }
+
+  flush_outputs(true);
+
+  std::ostringstream oss_summ;
+  oss_summ << ": Exiting the do_hsi_work() method, replayed " << m_replayed_counter << " HSI frames in "
+           << m_replay_passes << " pass(es) and successfully sent " << m_sent_counter << " HSIEvent messages. ";
+  ers::info(dunedaq::hsilibs::ProgressUpdate(ERS_HERE, get_name(), oss_summ.str()));
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_hsi_work() method";
+}
+
+void
+HSIReplaySource::dispatch_timesync(dfmessages::TimeSync& timesyncmsg)
+{
+  ++m_received_timesync_count;
+  if (m_timestamp_estimator.get() != nullptr) {
+    if (timesyncmsg.run_number == m_run_number) {
+      m_timestamp_estimator->add_timestamp_datapoint(timesyncmsg);
+    } else {
+      TLOG_DEBUG(0) << "Discarded TimeSync message from run " << timesyncmsg.run_number << " during run "
+                    << m_run_number;
+    }
+  }
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+DEFINE_DUNE_DAQ_MODULE(dunedaq::hsilibs::HSIReplaySource)
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
@@ -0,0 +1,105 @@
+/**
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_PLUGINS_HSIREPLAYSOURCE_HPP_
+#define HSILIBS_PLUGINS_HSIREPLAYSOURCE_HPP_
+
+#include "hsilibs/HSIEventSender.hpp"
+#include "hsilibs/HSIRecording.hpp"
+
+#include "timinglibs/TimestampEstimator.hpp"
+#include "hsilibs/hsireplaysource/Nljs.hpp"
+#include "hsilibs/hsireplaysource/Structs.hpp"
+#include "hsilibs/hsireplaysourceinfo/InfoNljs.hpp"
+#include "hsilibs/hsireplaysourceinfo/InfoStructs.hpp"
+
+#include "appfwk/DAQModule.hpp"
+#include "daqdataformats/Types.hpp"
+#include "dfmessages/HSIEvent.hpp"
+#include "dfmessages/TimeSync.hpp"
+#include "iomanager/Receiver.hpp"
+#include "utilities/WorkerThread.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief HSIReplaySource replays recorded HSI frames, as raw HSI frames and as
+ * HSIEvent messages, with their timestamps rebased onto the current DAQ time.
+ *
+ * Frames are replayed with their recorded spacing, optionally sped up, or as fast as
+ * the outputs take them. The recording is memory-mapped, see HSIRecordingReader.
+ */
+class HSIReplaySource : public hsilibs::HSIEventSender
+{
+public:
+  /**
+   * @brief HSIReplaySource Constructor
+   * @param name Instance name for this HSIReplaySource instance
+   */
+  explicit HSIReplaySource(const std::string& name);
+
+  HSIReplaySource(const HSIReplaySource&) = delete;            ///< HSIReplaySource is not copy-constructible
+  HSIReplaySource& operator=(const HSIReplaySource&) = delete; ///< HSIReplaySource is not copy-assignable
+  HSIReplaySource(HSIReplaySource&&) = delete;                 ///< HSIReplaySource is not move-constructible
+  HSIReplaySource& operator=(HSIReplaySource&&) = delete;      ///< HSIReplaySource is not move-assignable
+
+  void init(const nlohmann::json& obj) override;
+  void get_info(opmonlib::InfoCollector& ci, int level) override;
+
+private:
+  // Commands
+  void do_configure(const nlohmann::json& obj) override;
+  void do_start(const nlohmann::json& obj) override;
+  void do_stop(const nlohmann::json& obj) override;
+  void do_scrap(const nlohmann::json& obj) override;
+
+  void do_hsi_work(std::atomic<bool>&);
+  dunedaq::utilities::WorkerThread m_thread;
+
+  void dispatch_timesync(dfmessages::TimeSync& message);
+
+  // sends the frames and events collected so far
+  void send_pending();
+
+  // waits until time, or until running_flag goes down; @return false in the latter case
+  bool wait_until(std::chrono::steady_clock::time_point time, std::atomic<bool>& running_flag);
+
+  std::shared_ptr<iomanager::ReceiverConcept<dfmessages::TimeSync>> m_timesync_receiver;
+
+  // Configuration
+  std::atomic<daqdataformats::run_number_t> m_run_number;
+  hsireplaysource::Conf m_conf;
+
+  std::unique_ptr<HSIRecordingReader> m_reader;
+
+  // Helper class for estimating DAQ time
+  std::unique_ptr<timinglibs::TimestampEstimator> m_timestamp_estimator;
+
+  std::vector<HSI_FRAME_STRUCT> m_pending_frames;
+  std::vector<dfmessages::HSIEvent> m_pending_events;
+
+  std::atomic<uint64_t> m_replayed_counter;         // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_replayed_events_counter;  // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_replay_passes;            // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_last_replayed_timestamp;  // NOLINT(build/unsigned)
+  std::atomic<int64_t> m_max_lag;                   // ns
+  std::atomic<uint64_t> m_received_timesync_count;  // NOLINT(build/unsigned)
+};
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_PLUGINS_HSIREPLAYSOURCE_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
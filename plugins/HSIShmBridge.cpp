@@ -0,0 +1,168 @@
+/**
+ * @file HSIShmBridge.cpp HSIShmBridge class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "HSIShmBridge.hpp"
+
+#include "appfwk/DAQModuleHelper.hpp"
+#include "iomanager/IOManager.hpp"
+#include "logging/Logging.hpp"
+#include "readoutlibs/ReadoutLogging.hpp"
+
+#include <chrono>
+#include <string>
+
+using namespace dunedaq::readoutlibs::logging;
+
+namespace dunedaq {
+namespace hsilibs {
+
+HSIShmBridge::HSIShmBridge(const std::string& name)
+  : DAQModule(name)
+  , m_thread(std::bind(&HSIShmBridge::do_work, this, std::placeholders::_1))
+  , m_forwarded_counter(0)
+  , m_timeout_counter(0)
+  , m_discarded_counter(0)
+{
+  register_command("conf", &HSIShmBridge::do_configure);
+  register_command("start", &HSIShmBridge::do_start);
+  register_command("stop", &HSIShmBridge::do_stop);
+  register_command("scrap", &HSIShmBridge::do_scrap);
+}
+
+void
+HSIShmBridge::init(const nlohmann::json& init_data)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering init() method";
+  m_output_connection = appfwk::connection_uid(init_data, "output");
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting init() method";
+}
+
+void
+HSIShmBridge::do_configure(const nlohmann::json& obj)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_configure() method";
+
+  m_cfg = obj.get<hsishmbridge::ConfParams>();
+
+  // attaching first is fine, the ring is created by whichever side opens it first
+  switch (m_cfg.data_type) {
+    case hsishmbridge::DataType::hsievent:
+      m_hsievent_receiver =
+        std::make_unique<ShmRingReceiver<dfmessages::HSIEvent>>(m_cfg.shm_name, m_cfg.shm_capacity);
+      break;
+    case hsishmbridge::DataType::hsi_frame:
+      m_raw_hsi_data_receiver = std::make_unique<ShmRingReceiver<HSI_FRAME_STRUCT>>(m_cfg.shm_name, m_cfg.shm_capacity);
+      break;
+  }
+
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_configure() method";
+}
+
+void
+HSIShmBridge::do_start(const nlohmann::json& /*obj*/)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_start() method";
+  m_forwarded_counter = 0;
+  m_timeout_counter = 0;
+
+  // left over from the previous run
+  m_discarded_counter = 0;
+  if (m_hsievent_receiver)
+    m_discarded_counter = m_hsievent_receiver->discard();
+  if (m_raw_hsi_data_receiver)
+    m_discarded_counter = m_raw_hsi_data_receiver->discard();
+  if (m_discarded_counter.load())
+    ers::warning(ShmRingIssue(ERS_HERE,
+                              m_cfg.shm_name,
+                              "discarded " + std::to_string(m_discarded_counter.load()) +
+                                " item(s) left in the ring from the previous run"));
+
+  m_thread.start_working_thread("shm-bridge");
+  TLOG() << get_name() << " successfully started";
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_start() method";
+}
+
+void
+HSIShmBridge::do_stop(const nlohmann::json& /*obj*/)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_stop() method";
+  m_thread.stop_working_thread();
+  TLOG() << get_name() << " successfully stopped after forwarding " << m_forwarded_counter.load() << " items, with "
+         << m_timeout_counter.load() << " send timeouts";
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_stop() method";
+}
+
+void
+HSIShmBridge::do_scrap(const nlohmann::json& /*obj*/)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_scrap() method";
+  m_hsievent_receiver.reset();
+  m_raw_hsi_data_receiver.reset();
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_scrap() method";
+}
+
+void
+HSIShmBridge::do_work(std::atomic<bool>& running_flag)
+{
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Entering do_work() method";
+  if (m_hsievent_receiver)
+    forward(*m_hsievent_receiver, running_flag);
+  if (m_raw_hsi_data_receiver)
+    forward(*m_raw_hsi_data_receiver, running_flag);
+  TLOG_DEBUG(TLVL_ENTER_EXIT_METHODS) << get_name() << ": Exiting do_work() method";
+}
+
+template<class T>
+void
+HSIShmBridge::forward(ShmRingReceiver<T>& receiver, std::atomic<bool>& running_flag)
+{
+  auto sender = get_iom_sender<T>(m_output_connection);
+  auto wait_timeout = std::chrono::milliseconds(m_cfg.wait_timeout);
+
+  while (running_flag.load()) {
+    if (!receiver.wait(wait_timeout))
+      continue;
+    forward_available(receiver, *sender);
+  }
+
+  // what the producer wrote before the stop still belongs to this run
+  if (!forward_available(receiver, *sender))
+    TLOG() << get_name() << ": the output did not take all items left in the ring at stop, they are discarded at the "
+           << "next start";
+}
+
+template<class T>
+bool
+HSIShmBridge::forward_available(ShmRingReceiver<T>& receiver, iomanager::SenderConcept<T>& sender)
+{
+  auto send_timeout = std::chrono::milliseconds(m_cfg.send_timeout);
+
+  // items are read in place and only popped once sent, so a blocked output backs up into the ring
+  while (const T* item = receiver.front()) {
+    try {
+      T item_copy(*item);
+      sender.send(std::move(item_copy), send_timeout);
+    } catch (const dunedaq::iomanager::TimeoutExpired&) {
+      ++m_timeout_counter;
+      return false;
+    }
+    receiver.pop();
+    ++m_forwarded_counter;
+  }
+  return true;
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+DEFINE_DUNE_DAQ_MODULE(dunedaq::hsilibs::HSIShmBridge)
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
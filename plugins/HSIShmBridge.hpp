@@ -0,0 +1,96 @@
+/**
+ * @file HSIShmBridge.hpp
+ *
+ * HSIShmBridge is a DAQModule implementation that forwards the HSIEvents or raw
+ * HSI frames of a shared memory ring to a local connection.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#ifndef HSILIBS_PLUGINS_HSISHMBRIDGE_HPP_
+#define HSILIBS_PLUGINS_HSISHMBRIDGE_HPP_
+
+#include "hsilibs/ShmRing.hpp"
+#include "hsilibs/Types.hpp"
+#include "hsilibs/hsishmbridge/Nljs.hpp"
+#include "hsilibs/hsishmbridge/Structs.hpp"
+
+#include "appfwk/DAQModule.hpp"
+#include "dfmessages/HSIEvent.hpp"
+#include "ers/Issue.hpp"
+#include "iomanager/IOManager.hpp"
+#include "utilities/WorkerThread.hpp"
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief HSIShmBridge reads the shared memory ring written by an HSIReadout or
+ * FakeHSIEventGenerator output with the shm transport, in the process of the
+ * receivers, and sends the items to a queue connection there. Queues within a
+ * process pass items without serialising them, so nothing is serialised between
+ * the producer and the receivers.
+ *
+ * At stop, the items already in the ring are forwarded until the ring is empty or
+ * a send times out. Items still in the ring at the next start, including those the
+ * producer wrote after the bridge stopped, belong to the previous run and are
+ * discarded. The producer has to be started after the bridge.
+ */
+class HSIShmBridge : public dunedaq::appfwk::DAQModule
+{
+public:
+  /**
+   * @brief HSIShmBridge Constructor
+   * @param name Instance name for this HSIShmBridge instance
+   */
+  explicit HSIShmBridge(const std::string& name);
+
+  HSIShmBridge(const HSIShmBridge&) = delete;            ///< HSIShmBridge is not copy-constructible
+  HSIShmBridge& operator=(const HSIShmBridge&) = delete; ///< HSIShmBridge is not copy-assignable
+  HSIShmBridge(HSIShmBridge&&) = delete;                 ///< HSIShmBridge is not move-constructible
+  HSIShmBridge& operator=(HSIShmBridge&&) = delete;      ///< HSIShmBridge is not move-assignable
+
+  void init(const nlohmann::json& obj) override;
+
+private:
+  // Commands
+  void do_configure(const nlohmann::json& obj);
+  void do_start(const nlohmann::json& obj);
+  void do_stop(const nlohmann::json& obj);
+  void do_scrap(const nlohmann::json& obj);
+
+  void do_work(std::atomic<bool>&);
+  template<class T>
+  void forward(ShmRingReceiver<T>& receiver, std::atomic<bool>& running_flag);
+  // forwards items until the ring is empty, returns false if a send timed out first
+  template<class T>
+  bool forward_available(ShmRingReceiver<T>& receiver, iomanager::SenderConcept<T>& sender);
+
+  dunedaq::utilities::WorkerThread m_thread;
+
+  // Configuration
+  hsishmbridge::ConfParams m_cfg;
+  std::string m_output_connection;
+
+  // only the one matching the configured data type is set
+  std::unique_ptr<ShmRingReceiver<dfmessages::HSIEvent>> m_hsievent_receiver;
+  std::unique_ptr<ShmRingReceiver<HSI_FRAME_STRUCT>> m_raw_hsi_data_receiver;
+
+  std::atomic<uint64_t> m_forwarded_counter; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_timeout_counter;   // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_discarded_counter; // NOLINT(build/unsigned) left over from the previous run
+};
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_PLUGINS_HSISHMBRIDGE_HPP_
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
@@ -0,0 +1,121 @@
+/**
+ * @file ArrivalModel.cpp ArrivalModel class implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/ArrivalModel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+ArrivalModel::ArrivalModel(std::vector<ArrivalSource> sources,
+                           const ArrivalModulation& modulation,
+                           double coincidence_window,
+                           uint64_t seed) // NOLINT(build/unsigned)
+  : m_sources(std::move(sources))
+  , m_modulation(modulation)
+  , m_coincidence_window(std::max(coincidence_window, 0.))
+  , m_rng(seed)
+  , m_modulated(modulation.on_duration > 0 && modulation.off_duration > 0)
+  , m_next_switch(std::numeric_limits<double>::infinity())
+{
+  m_heap.reserve(m_sources.size());
+  bool any_rate = std::any_of(m_sources.begin(), m_sources.end(), [](const auto& s) { return s.rate > 0; });
+  bool any_factor = !m_modulated || m_modulation.on_rate_factor > 0 || m_modulation.off_rate_factor > 0;
+  m_has_arrivals = any_rate && any_factor;
+  restart(0);
+}
+
+void
+ArrivalModel::restart(double time)
+{
+  m_on = true;
+  m_next_switch = m_modulated ? time + state_duration() : std::numeric_limits<double>::infinity();
+  redraw(time);
+}
+
+void
+ArrivalModel::set_rate_scale(double scale, double time)
+{
+  m_rate_scale = std::max(scale, 0.);
+  redraw(time);
+}
+
+double
+ArrivalModel::next_time()
+{
+  if (!m_has_arrivals || m_rate_scale <= 0)
+    return std::numeric_limits<double>::infinity();
+
+  // switch state until the next arrival falls within the current one
+  while (m_heap.empty() || m_heap.front().first >= m_next_switch) {
+    double switch_time = m_next_switch;
+    m_on = !m_on;
+    m_next_switch = switch_time + state_duration();
+    redraw(switch_time);
+  }
+  return m_heap.front().first;
+}
+
+Arrival
+ArrivalModel::pop()
+{
+  Arrival arrival{ next_time(), 0, false };
+  double window_end = arrival.time + m_coincidence_window;
+  do {
+    std::pop_heap(m_heap.begin(), m_heap.end(), std::greater<Entry>());
+    auto [time, source] = m_heap.back();
+    m_heap.pop_back();
+    arrival.signal_map |= m_sources[source].signal_map;
+    arrival.draw_signals |= !m_sources[source].signal_map;
+    schedule(source, time);
+  } while (next_time() <= window_end);
+  return arrival;
+}
+
+void
+ArrivalModel::schedule(size_t source, double after)
+{
+  double factor = !m_modulated ? 1. : m_on ? m_modulation.on_rate_factor : m_modulation.off_rate_factor;
+  double rate = m_sources[source].rate * m_rate_scale * factor;
+  if (rate <= 0)
+    return;
+  m_heap.emplace_back(after + exponential(1.e9 / rate), source);
+  std::push_heap(m_heap.begin(), m_heap.end(), std::greater<Entry>());
+}
+
+void
+ArrivalModel::redraw(double time)
+{
+  m_heap.clear();
+  for (size_t i = 0; i < m_sources.size(); ++i)
+    schedule(i, time);
+}
+
+double
+ArrivalModel::exponential(double mean)
+{
+  // uniform in (0, 1] from the top 53 bits
+  double u = static_cast<double>((m_rng() >> 11) + 1) * 0x1p-53;
+  return -mean * std::log(u);
+}
+
+double
+ArrivalModel::state_duration()
+{
+  double mean = (m_on ? m_modulation.on_duration : m_modulation.off_duration) * 1.e9;
+  return m_modulation.random_durations ? exponential(mean) : mean;
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
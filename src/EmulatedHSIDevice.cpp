@@ -0,0 +1,152 @@
+/**
+ * @file EmulatedHSIDevice.cpp EmulatedHSIDevice class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/EmulatedHSIDevice.hpp"
+
+#include "hsilibs/HSIEventDecoder.hpp"
+#include "hsilibs/Issues.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+namespace {
+// largest occupancy the firmware buffer count register can report
+const constexpr uint32_t g_max_fifo_depth = 65535; // NOLINT(build/unsigned)
+// endpoint state reported by a ready timing endpoint
+const constexpr uint32_t g_endpoint_ready_state = 0x8; // NOLINT(build/unsigned)
+} // namespace
+
+EmulatedHSIDevice::EmulatedHSIDevice(const hsireadout::EmulatedDevice& cfg)
+  : m_cfg(cfg)
+  , m_random_generator(cfg.random_seed ? cfg.random_seed : std::random_device()())
+  , m_interarrival_distribution(cfg.event_rate > 0 ? cfg.event_rate : 1.)
+  , m_timeout_distribution(std::clamp(cfg.timeout_probability, 0., 1.))
+  , m_corrupt_header_distribution(std::clamp(cfg.corrupt_header_probability, 0., 1.))
+  , m_start_time(clock_t::now())
+  , m_next_event_time(m_start_time)
+  , m_steady_to_system_offset(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::system_clock::now().time_since_epoch()) -
+                              std::chrono::duration_cast<std::chrono::nanoseconds>(m_start_time.time_since_epoch()))
+  , m_sequence_counter(0)
+  , m_generated_counter(0)
+  , m_lost_counter(0)
+  , m_timeout_counter(0)
+{
+  m_cfg.fifo_depth = std::min(m_cfg.fifo_depth, g_max_fifo_depth);
+  m_fifo.reserve(m_cfg.fifo_depth);
+}
+
+bool
+EmulatedHSIDevice::endpoint_ready()
+{
+  emulate_round_trip();
+  return m_cfg.endpoint_ready;
+}
+
+uint32_t // NOLINT(build/unsigned)
+EmulatedHSIDevice::read_endpoint_state()
+{
+  emulate_round_trip();
+  return m_cfg.endpoint_ready ? g_endpoint_ready_state : 0x0;
+}
+
+bool
+EmulatedHSIDevice::read_signal_source_mode()
+{
+  emulate_round_trip();
+  return m_cfg.signal_source_mode;
+}
+
+void
+EmulatedHSIDevice::read_data_buffer(std::vector<uint32_t>& words, uint16_t& n_words_in_buffer) // NOLINT
+{
+  emulate_round_trip();
+
+  if (m_timeout_distribution(m_random_generator)) {
+    ++m_timeout_counter;
+    throw HSIReadoutNetworkIssue(ERS_HERE);
+  }
+
+  generate_events(clock_t::now());
+
+  n_words_in_buffer = m_fifo.size();
+
+  // hand over the buffer contents; both vectors keep their capacity
+  words.swap(m_fifo);
+  m_fifo.clear();
+}
+
+void
+EmulatedHSIDevice::generate_events(clock_t::time_point until)
+{
+  if (m_cfg.event_rate <= 0)
+    return;
+
+  while (m_next_event_time <= until) {
+    auto event_time = m_next_event_time;
+    m_next_event_time += std::chrono::duration_cast<clock_t::duration>(
+      std::chrono::duration<double>(m_interarrival_distribution(m_random_generator)));
+
+    if (!signal_on(event_time))
+      continue;
+
+    ++m_generated_counter;
+    if (m_fifo.size() + HSI_BUFFER_EVENT_SIZE > m_cfg.fifo_depth) {
+      ++m_lost_counter;
+      continue;
+    }
+
+    // timing system timestamps count clock ticks since the epoch
+    auto ns_since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(event_time.time_since_epoch()) +
+                          m_steady_to_system_offset;
+    uint64_t seconds = ns_since_epoch.count() / 1000000000;     // NOLINT(build/unsigned)
+    uint64_t nanoseconds = ns_since_epoch.count() % 1000000000; // NOLINT(build/unsigned)
+    uint64_t ts = seconds * m_cfg.clock_frequency + nanoseconds * m_cfg.clock_frequency / 1000000000; // NOLINT
+
+    uint32_t header = (HSI_BUFFER_EVENT_HEADER_MARKER << 16) | m_sequence_counter++; // NOLINT(build/unsigned)
+    if (m_corrupt_header_distribution(m_random_generator))
+      header ^= 0xffff0000;
+
+    m_fifo.push_back(header);
+    m_fifo.push_back(ts & 0xffffffff);
+    m_fifo.push_back(ts >> 32);
+    m_fifo.push_back(m_cfg.signal_map);
+    m_fifo.push_back(m_cfg.signal_map);
+  }
+}
+
+bool
+EmulatedHSIDevice::signal_on(clock_t::time_point time) const
+{
+  if (m_cfg.burst_on_period == 0 || m_cfg.burst_off_period == 0)
+    return true;
+
+  auto cycle = std::chrono::microseconds(m_cfg.burst_on_period + m_cfg.burst_off_period);
+  auto phase = (time - m_start_time) % cycle;
+  return phase < std::chrono::microseconds(m_cfg.burst_on_period);
+}
+
+void
+EmulatedHSIDevice::emulate_round_trip() const
+{
+  if (m_cfg.read_latency)
+    std::this_thread::sleep_for(std::chrono::microseconds(m_cfg.read_latency));
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
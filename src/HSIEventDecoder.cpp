@@ -0,0 +1,162 @@
+/**
+ * @file HSIEventDecoder.cpp HSI buffer batch decoder
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/HSIEventDecoder.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace dunedaq {
+namespace hsilibs {
+
+void
+HSIDecodedEvents::resize(std::size_t n_events)
+{
+  timestamps.resize(n_events);
+  device_ids.resize(n_events);
+  counters.resize(n_events);
+  data.resize(n_events);
+  triggers.resize(n_events);
+  valid_mask.assign((n_events + 63) / 64, 0);
+  size = n_events;
+  n_valid = 0;
+}
+
+namespace {
+
+void
+decode_scalar(const uint32_t* words, std::size_t first, std::size_t last, HSIDecodedEvents& events) // NOLINT
+{
+  for (std::size_t i = first; i < last; ++i) {
+    const uint32_t* event = words + i * HSI_BUFFER_EVENT_SIZE; // NOLINT(build/unsigned)
+
+    uint32_t header = event[0]; // NOLINT(build/unsigned)
+    // put together the timestamp
+    uint64_t ts = event[1] | (static_cast<uint64_t>(event[2]) << 32); // NOLINT(build/unsigned)
+
+    // bits 31-16 contain the HSI device ID, bits 15-0 the sequence counter
+    events.device_ids[i] = header >> 16;
+    events.counters[i] = header & 0x0000ffff;
+    events.timestamps[i] = ts;
+    events.data[i] = event[3];
+    events.triggers[i] = event[4];
+
+    uint64_t valid = (header >> 16) == HSI_BUFFER_EVENT_HEADER_MARKER && ts != 0; // NOLINT(build/unsigned)
+    events.valid_mask[i / 64] |= valid << (i % 64);
+  }
+}
+
+#if defined(__x86_64__)
+
+// Eight events per iteration: strided gathers of each word, then the two timestamp
+// halves are interleaved into 64 bit lanes and the validity mask is built with compares.
+__attribute__((target("avx2"))) std::size_t
+decode_avx2(const uint32_t* words, std::size_t n_events, HSIDecodedEvents& events) // NOLINT(build/unsigned)
+{
+  const __m256i stride = _mm256_setr_epi32(0, 5, 10, 15, 20, 25, 30, 35);
+  const __m256i marker = _mm256_set1_epi32(HSI_BUFFER_EVENT_HEADER_MARKER);
+  const __m256i counter_mask = _mm256_set1_epi32(0x0000ffff);
+  const __m256i zero = _mm256_setzero_si256();
+
+  std::size_t i = 0;
+  for (; i + 8 <= n_events; i += 8) {
+    const int* base = reinterpret_cast<const int*>(words + i * HSI_BUFFER_EVENT_SIZE);
+
+    __m256i header = _mm256_i32gather_epi32(base, stride, 4);
+    __m256i ts_low = _mm256_i32gather_epi32(base + 1, stride, 4);
+    __m256i ts_high = _mm256_i32gather_epi32(base + 2, stride, 4);
+    __m256i data = _mm256_i32gather_epi32(base + 3, stride, 4);
+    __m256i trigger = _mm256_i32gather_epi32(base + 4, stride, 4);
+
+    __m256i device_id = _mm256_srli_epi32(header, 16);
+    __m256i counter = _mm256_and_si256(header, counter_mask);
+
+    // lanes {0,1,4,5} and {2,3,6,7}, then restore event order
+    __m256i ts_lo_pairs = _mm256_unpacklo_epi32(ts_low, ts_high);
+    __m256i ts_hi_pairs = _mm256_unpackhi_epi32(ts_low, ts_high);
+    __m256i ts_0123 = _mm256_permute2x128_si256(ts_lo_pairs, ts_hi_pairs, 0x20);
+    __m256i ts_4567 = _mm256_permute2x128_si256(ts_lo_pairs, ts_hi_pairs, 0x31);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&events.device_ids[i]), device_id);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&events.counters[i]), counter);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&events.data[i]), data);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&events.triggers[i]), trigger);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&events.timestamps[i]), ts_0123);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&events.timestamps[i + 4]), ts_4567);
+
+    __m256i header_ok = _mm256_cmpeq_epi32(device_id, marker);
+    __m256i ts_zero = _mm256_cmpeq_epi32(_mm256_or_si256(ts_low, ts_high), zero);
+    __m256i valid = _mm256_andnot_si256(ts_zero, header_ok);
+    uint64_t valid_bits = static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(valid))); // NOLINT
+
+    // i is a multiple of 8, so the 8 bits never straddle two mask words
+    events.valid_mask[i / 64] |= valid_bits << (i % 64);
+  }
+  return i;
+}
+
+bool
+cpu_has_avx2()
+{
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  return has_avx2;
+}
+
+#endif
+
+void
+count_valid(HSIDecodedEvents& events)
+{
+  std::size_t n_valid = 0;
+  for (auto mask_word : events.valid_mask)
+    n_valid += __builtin_popcountll(mask_word);
+  events.n_valid = n_valid;
+}
+
+} // namespace
+
+std::size_t
+decode_hsi_events(const uint32_t* words, std::size_t n_words, HSIDecodedEvents& events) // NOLINT(build/unsigned)
+{
+  std::size_t n_events = n_words / HSI_BUFFER_EVENT_SIZE;
+  events.resize(n_events);
+
+  std::size_t n_decoded = 0;
+#if defined(__x86_64__)
+  if (cpu_has_avx2())
+    n_decoded = decode_avx2(words, n_events, events);
+#endif
+  decode_scalar(words, n_decoded, n_events, events);
+  count_valid(events);
+
+  return n_events;
+}
+
+std::size_t
+decode_hsi_events_scalar(const uint32_t* words, std::size_t n_words, HSIDecodedEvents& events) // NOLINT
+{
+  std::size_t n_events = n_words / HSI_BUFFER_EVENT_SIZE;
+  events.resize(n_events);
+
+  decode_scalar(words, 0, n_events, events);
+  count_valid(events);
+
+  return n_events;
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
@@ -14,10 +14,12 @@
 #include "iomanager/IOManager.hpp"
 #include "logging/Logging.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdlib>
 #include <string>
 #include <thread>
+#include <utility>
 #include <vector>
 
 namespace dunedaq {
@@ -25,74 +27,338 @@ namespace hsilibs {
 
 HSIEventSender::HSIEventSender(const std::string& name)
   : dunedaq::appfwk::DAQModule(name)
-  , m_queue_timeout(1)
+  , m_hsievent_output(
+      name + "/hsievent",
+      [this](size_t n_events, uint64_t last_timestamp) { // NOLINT(build/unsigned)
+        m_sent_counter += n_events;
+        m_last_sent_timestamp.store(last_timestamp);
+      },
+      [this]() { ++m_failed_to_send_counter; })
+  , m_hsievent_batch_output(
+      name + "/hsievent",
+      [this](size_t n_events, uint64_t last_timestamp) { // NOLINT(build/unsigned)
+        m_sent_counter += n_events;
+        if (n_events)
+          m_last_sent_timestamp.store(last_timestamp);
+      },
+      [this]() { ++m_failed_to_send_counter; })
+  , m_raw_hsi_data_output(
+      name + "/raw_hsi_data", [](size_t, uint64_t) {}, [this]() { ++m_failed_to_send_counter; }) // NOLINT
+  , m_raw_hsi_chunk_output(
+      name + "/raw_hsi_data", [](size_t, uint64_t) {}, [this]() { ++m_failed_to_send_counter; }) // NOLINT
   , m_sent_counter(0)
   , m_failed_to_send_counter(0)
   , m_last_sent_timestamp(0)
+  , m_hsievent_batch_size(256)
+  , m_latency_budget(0)
 {}
 
 void
+HSIEventSender::set_hsievent_send_connection(const std::string& connection)
+{
+  m_hsievent_send_connection = connection;
+  m_hsievent_sender.reset();
+  m_hsievent_batch_sender.reset();
+
+  // receivers that take batches declare the connection with the HSIEventBatch data type
+  auto datatypes = iomanager::IOManager::get()->get_datatypes(m_hsievent_send_connection);
+  if (datatypes.size() == 1 && *datatypes.begin() == datatype_to_string<HSIEventBatch>())
+    m_hsievent_batch_sender = get_iom_sender<HSIEventBatch>(m_hsievent_send_connection);
+  else
+    m_hsievent_sender = get_iom_sender<dfmessages::HSIEvent>(m_hsievent_send_connection);
+  TLOG_DEBUG(2) << get_name() << ": Sending HSIEvents to " << m_hsievent_send_connection
+                << (m_hsievent_batch_sender ? " in batches" : " one by one");
+}
+
+void
+HSIEventSender::set_raw_hsi_data_send_connection(const std::string& connection)
+{
+  m_raw_hsi_data_sender.reset();
+  m_raw_hsi_chunk_sender.reset();
+
+  // data link handlers that take superchunks declare the connection with the HSISuperChunk data type
+  auto datatypes = iomanager::IOManager::get()->get_datatypes(connection);
+  if (datatypes.size() == 1 && *datatypes.begin() == datatype_to_string<HSI_SUPERCHUNK_STRUCT>())
+    m_raw_hsi_chunk_sender = get_iom_sender<HSI_SUPERCHUNK_STRUCT>(connection);
+  else
+    m_raw_hsi_data_sender = get_iom_sender<HSI_FRAME_STRUCT>(connection);
+  TLOG_DEBUG(2) << get_name() << ": Sending raw HSI data to " << connection
+                << (m_raw_hsi_chunk_sender ? " in superchunks" : " frame by frame");
+}
+
+void
+HSIEventSender::configure_outputs(const hsieventsender::OutputPolicy& hsievent_policy,
+                                  const hsieventsender::OutputPolicy& raw_policy)
+{
+  m_hsievent_shm_sender.reset();
+  if (hsievent_policy.transport == hsieventsender::Transport::shm)
+    m_hsievent_shm_sender =
+      std::make_unique<ShmRingSender<dfmessages::HSIEvent>>(hsievent_policy.shm_name, hsievent_policy.shm_capacity);
+
+  if (send_hsievent_batches()) {
+    m_hsievent_batch_output.configure(hsievent_policy);
+    m_hsievent_batch_size = std::max<size_t>(hsievent_policy.batch_size, 1);
+    m_hsievent_batch.events.reserve(m_hsievent_batch_size);
+  } else {
+    m_hsievent_output.configure(hsievent_policy);
+  }
+
+  m_raw_hsi_shm_sender.reset();
+  if (raw_policy.transport == hsieventsender::Transport::shm)
+    m_raw_hsi_shm_sender = std::make_unique<ShmRingSender<HSI_FRAME_STRUCT>>(raw_policy.shm_name, raw_policy.shm_capacity);
+
+  if (send_raw_hsi_chunks())
+    m_raw_hsi_chunk_output.configure(raw_policy);
+  else
+    m_raw_hsi_data_output.configure(raw_policy);
+}
+
+void
+HSIEventSender::start_outputs(uint64_t run_number) // NOLINT(build/unsigned)
+{
+  if (send_hsievent_batches())
+    m_hsievent_batch_output.start(run_number);
+  else
+    m_hsievent_output.start(run_number);
+
+  if (send_raw_hsi_chunks())
+    m_raw_hsi_chunk_output.start(run_number);
+  else
+    m_raw_hsi_data_output.start(run_number);
+}
+
+bool
 HSIEventSender::send_hsi_event(dfmessages::HSIEvent& event, const std::string& location)
 {
-  TLOG_DEBUG(3) << get_name() << ": Sending HSIEvent to " << location << ". \n"
-                << event.header << ", " << std::bitset<32>(event.signal_map) << ", " << event.timestamp << ", "
-                << event.sequence_counter << "\n";
-
-  bool was_successfully_sent = false;
-  while (!was_successfully_sent) {
-    try {
-        dfmessages::HSIEvent event_copy(event);
-      get_iom_sender<dfmessages::HSIEvent>(location)->send(std::move(event_copy), m_queue_timeout);
-      ++m_sent_counter;
-      m_last_sent_timestamp.store(event.timestamp);
-      was_successfully_sent = true;
-    } catch (const dunedaq::iomanager::TimeoutExpired& excpt) {
-      std::ostringstream oss_warn;
-      oss_warn << "push to output connection \"" << location << "\"";
-      ers::error(dunedaq::iomanager::TimeoutExpired(ERS_HERE, get_name(), oss_warn.str(), m_queue_timeout.count()));
-      ++m_failed_to_send_counter;
-    }
+  if (location == m_hsievent_send_connection)
+    return send_hsi_event(event);
+
+
+  TLOG_EVENT_DEBUG(3) << get_name() << ": Sending HSIEvent to " << location << ". \n"
+                      << event.header << ", " << std::bitset<32>(event.signal_map) << ", " << event.timestamp << ", "
+                      << event.sequence_counter << "\n";
+
+  auto send_start = std::chrono::steady_clock::now();
+  bool sent = m_hsievent_output.send(event, get_iom_sender<dfmessages::HSIEvent>(location).get());
+  m_send_latency.record(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - send_start).count());
+  return sent;
+}
+
+bool
+HSIEventSender::send_hsi_event(dfmessages::HSIEvent& event)
+{
+  TLOG_EVENT_DEBUG(3) << get_name() << ": Sending HSIEvent to " << m_hsievent_send_connection << ". \n"
+                      << event.header << ", " << std::bitset<32>(event.signal_map) << ", " << event.timestamp << ", "
+                      << event.sequence_counter << "\n";
+
+  if (send_hsievent_batches()) {
+    bool sent = false;
+    send_hsi_events(&event, 1, &sent);
+    return sent;
+  }
+  if (!m_hsievent_shm_sender && !m_hsievent_sender) {
+    throw(QueueIsNullFatalError(ERS_HERE, get_name(), m_hsievent_send_connection));
   }
+  auto send_start = std::chrono::steady_clock::now();
+  bool sent = false;
+  if (m_hsievent_shm_sender)
+    sent = m_hsievent_output.send(event, m_hsievent_shm_sender.get());
+  else
+    sent = m_hsievent_output.send(event, m_hsievent_sender.get());
+  m_send_latency.record(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - send_start).count());
+
   if (m_sent_counter > 0 && m_sent_counter % 200000 == 0)
     TLOG_DEBUG(3) << "Have sent out " << m_sent_counter << " HSI events";
+  return sent;
 }
 
 void
-HSIEventSender::send_raw_hsi_data(const std::array<uint32_t, 7>& raw_data, raw_sender_ct* sender)
-{
-  HSI_FRAME_STRUCT payload;
-  ::memcpy(&payload,
-           &raw_data[0],
-           sizeof(HSI_FRAME_STRUCT));
-  
-  TLOG_DEBUG(3) << get_name() << ": Sending HSI_FRAME_STRUCT "
-                << std::hex 
-                << "0x"   << payload.frame.version
-                << ", 0x"   << payload.frame.detector_id
-            
-                << "; 0x"   << payload.frame.timestamp_low
-                << "; 0x"   << payload.frame.timestamp_high
-                << "; 0x"   << payload.frame.input_low
-                << "; 0x"   << payload.frame.input_high
-                << "; 0x"   << payload.frame.trigger
-                << "; 0x"   << payload.frame.sequence
-                << std::endl;
-
-  try
-  {
-   // TODO deal with this
-   if (!sender) {
-      throw(QueueIsNullFatalError(ERS_HERE, get_name(), "HSIEventSender output"));
+HSIEventSender::send_hsi_events(const dfmessages::HSIEvent* events, size_t n_events, bool* sent)
+{
+  if (!send_hsievent_batches()) {
+    // receiver does not take batches
+    for (size_t i = 0; i < n_events; ++i) {
+      dfmessages::HSIEvent event(events[i]);
+      bool event_sent = send_hsi_event(event);
+      if (sent)
+        sent[i] = event_sent;
     }
-    sender->send(std::move(payload), m_queue_timeout);
+    return;
+  }
+
+  for (size_t first = 0; first < n_events; first += m_hsievent_batch_size) {
+    size_t n_batch_events = std::min(n_events - first, m_hsievent_batch_size);
+    m_hsievent_batch.events.assign(events + first, events + first + n_batch_events);
+
+    TLOG_EVENT_DEBUG(3) << get_name() << ": Sending " << n_batch_events << " HSIEvents to "
+                        << m_hsievent_send_connection << ", timestamps " << m_hsievent_batch.events.front().timestamp
+                        << " to " << m_hsievent_batch.events.back().timestamp;
+
+    uint64_t sent_before = m_sent_counter.load(); // NOLINT(build/unsigned)
+    auto send_start = std::chrono::steady_clock::now();
+    // the batch goes to the sender without a copy where the output policy allows it
+    bool batch_sent = m_hsievent_batch_output.send(std::move(m_hsievent_batch), m_hsievent_batch_sender.get());
+    m_send_latency.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - send_start).count());
+    if (sent)
+      std::fill(sent + first, sent + first + n_batch_events, batch_sent);
+
+    if (m_sent_counter / 200000 != sent_before / 200000)
+      TLOG_DEBUG(3) << "Have sent out " << m_sent_counter << " HSI events";
   }
-  catch (const dunedaq::iomanager::TimeoutExpired& excpt)
-  {
-      std::ostringstream oss_warn;
-      oss_warn << "push to output raw hsi data queue failed";
-      ers::error(dunedaq::iomanager::TimeoutExpired(ERS_HERE, get_name(), oss_warn.str(), m_queue_timeout.count()));
-      ++m_failed_to_send_counter;
+}
+
+void
+HSIEventSender::send_raw_hsi_data(const HSI_FRAME_STRUCT& frame, raw_sender_ct* sender)
+{
+  TLOG_EVENT_DEBUG(3) << get_name() << ": Sending HSI_FRAME_STRUCT "
+                      << std::hex
+                      << "0x"   << frame.frame.version
+                      << ", 0x" << frame.frame.detector_id
+                      << "; 0x" << frame.frame.timestamp_low
+                      << "; 0x" << frame.frame.timestamp_high
+                      << "; 0x" << frame.frame.input_low
+                      << "; 0x" << frame.frame.input_high
+                      << "; 0x" << frame.frame.trigger
+                      << "; 0x" << frame.frame.sequence
+                      << std::endl;
+
+  // TODO deal with this
+  if (!sender) {
+    throw(QueueIsNullFatalError(ERS_HERE, get_name(), "HSIEventSender output"));
   }
+  auto send_start = std::chrono::steady_clock::now();
+  m_raw_hsi_data_output.send(frame, sender);
+  m_send_latency.record(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - send_start).count());
+}
+
+void
+HSIEventSender::send_raw_hsi_frames(const HSI_FRAME_STRUCT* frames, size_t n_frames)
+{
+  if (m_raw_hsi_shm_sender) {
+    for (size_t i = 0; i < n_frames; ++i) {
+      auto send_start = std::chrono::steady_clock::now();
+      m_raw_hsi_data_output.send(frames[i], m_raw_hsi_shm_sender.get());
+      m_send_latency.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - send_start).count());
+    }
+    return;
+  }
+
+  if (!m_raw_hsi_chunk_sender) {
+    // data link handler takes single frames
+    for (size_t i = 0; i < n_frames; ++i)
+      send_raw_hsi_data(frames[i], m_raw_hsi_data_sender.get());
+    return;
+  }
+
+  for (size_t first = 0; first < n_frames; first += HSI_SUPERCHUNK_MAX_FRAMES) {
+    m_raw_hsi_chunk.n_frames = 0;
+    for (size_t i = first; i < n_frames && !m_raw_hsi_chunk.full(); ++i)
+      m_raw_hsi_chunk.add_frame(frames[i]);
+
+    TLOG_EVENT_DEBUG(3) << get_name() << ": Sending HSI_SUPERCHUNK_STRUCT of " << m_raw_hsi_chunk.n_frames
+                        << " frames, timestamps " << m_raw_hsi_chunk.frames[0].get_timestamp() << " to "
+                        << m_raw_hsi_chunk.frames[m_raw_hsi_chunk.n_frames - 1].get_timestamp();
+
+    auto send_start = std::chrono::steady_clock::now();
+    m_raw_hsi_chunk_output.send(m_raw_hsi_chunk, m_raw_hsi_chunk_sender.get());
+    m_send_latency.record(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - send_start).count());
+  }
+}
+
+void
+HSIEventSender::flush_outputs(bool final)
+{
+  if (m_hsievent_output.get_backlog_size() || final) {
+    if (m_hsievent_shm_sender)
+      m_hsievent_output.flush(m_hsievent_shm_sender.get(), final);
+    else if (m_hsievent_sender)
+      m_hsievent_output.flush(m_hsievent_sender.get(), final);
+  }
+  if (send_hsievent_batches() && (m_hsievent_batch_output.get_backlog_size() || final))
+    m_hsievent_batch_output.flush(m_hsievent_batch_sender.get(), final);
+
+  if (m_raw_hsi_data_output.get_backlog_size() || final) {
+    if (m_raw_hsi_shm_sender)
+      m_raw_hsi_data_output.flush(m_raw_hsi_shm_sender.get(), final);
+    else if (m_raw_hsi_data_sender)
+      m_raw_hsi_data_output.flush(m_raw_hsi_data_sender.get(), final);
+  }
+  if (send_raw_hsi_chunks() && (m_raw_hsi_chunk_output.get_backlog_size() || final))
+    m_raw_hsi_chunk_output.flush(m_raw_hsi_chunk_sender.get(), final);
+}
+
+uint64_t // NOLINT(build/unsigned)
+HSIEventSender::get_dropped_hsi_events_counter() const
+{
+  return m_hsievent_output.get_dropped_counter() + m_hsievent_batch_output.get_dropped_counter();
+}
+
+uint64_t // NOLINT(build/unsigned)
+HSIEventSender::get_spilled_hsi_events_counter() const
+{
+  // batches cannot be spilled
+  return m_hsievent_output.get_spilled_counter();
+}
+
+size_t
+HSIEventSender::get_hsi_event_backlog_size() const
+{
+  return m_hsievent_output.get_backlog_size() + m_hsievent_batch_output.get_backlog_size();
+}
+
+uint64_t // NOLINT(build/unsigned)
+HSIEventSender::get_dropped_raw_hsi_frames_counter() const
+{
+  return m_raw_hsi_data_output.get_dropped_counter() + m_raw_hsi_chunk_output.get_dropped_counter();
+}
+
+uint64_t // NOLINT(build/unsigned)
+HSIEventSender::get_spilled_raw_hsi_frames_counter() const
+{
+  return m_raw_hsi_data_output.get_spilled_counter() + m_raw_hsi_chunk_output.get_spilled_counter();
+}
+
+size_t
+HSIEventSender::get_raw_hsi_frame_backlog_size() const
+{
+  // a superchunk backlog is counted in chunks
+  return m_raw_hsi_data_output.get_backlog_size() + m_raw_hsi_chunk_output.get_backlog_size();
+}
+
+void
+HSIEventSender::fill_hsi_frame(HSI_FRAME_STRUCT& frame,
+                               uint32_t link,    // NOLINT(build/unsigned)
+                               uint64_t ts,      // NOLINT(build/unsigned)
+                               uint32_t data,    // NOLINT(build/unsigned)
+                               uint32_t trigger, // NOLINT(build/unsigned)
+                               uint32_t counter) // NOLINT(build/unsigned)
+{
+  // DAQHeader
+  frame.frame.version = HSI_FRAME_VERSION;
+  frame.frame.detector_id = HSI_FRAME_DETECTOR_ID;
+  frame.frame.crate = 0x0;
+  frame.frame.slot = 0x0;
+  frame.frame.link = link;
+
+  frame.frame.timestamp_low = ts;
+  frame.frame.timestamp_high = ts >> 32;
+  frame.frame.input_low = data;
+  frame.frame.input_high = 0x0;
+  frame.frame.trigger = trigger;
+  frame.frame.sequence = counter;
+}
+
+void
+HSIEventSender::check_latency_budget(const std::string& interval, const LatencySummary& latency)
+{
+  if (m_latency_budget && latency.p99 > m_latency_budget * 1000)
+    ers::warning(LatencyBudgetExceeded(ERS_HERE, get_name(), interval, latency.p99 / 1000., m_latency_budget));
 }
 
 } // namespace hsilibs
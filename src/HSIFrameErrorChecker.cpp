@@ -0,0 +1,96 @@
+/**
+ * @file HSIFrameErrorChecker.cpp Checks of HSI frames on their way into the latency buffer
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "HSIFrameErrorChecker.hpp"
+
+#include "hsilibs/Issues.hpp"
+#include "hsilibs/hsidatalinkhandler/Nljs.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+namespace dunedaq {
+namespace hsilibs {
+
+void
+HSIFrameErrorChecker::conf(const nlohmann::json& args)
+{
+  uint32_t bits = 16; // NOLINT(build/unsigned) HSI firmware
+  if (args.contains("framecheckconf"))
+    bits = args["framecheckconf"].get<hsidatalinkhandler::FrameCheckConf>().sequence_counter_bits;
+  bits = std::min<uint32_t>(std::max<uint32_t>(bits, 1), 32); // NOLINT(build/unsigned)
+  m_sequence_mask = static_cast<uint32_t>((uint64_t(1) << bits) - 1); // NOLINT(build/unsigned)
+  TLOG_DEBUG(2) << "HSI frame sequence counter width [bits]: " << bits;
+}
+
+void
+HSIFrameErrorChecker::reset()
+{
+  m_links_seen = 0;
+  std::fill(std::begin(m_next_sequence), std::end(m_next_sequence), 0);
+  std::fill(std::begin(m_previous_link_ts), std::end(m_previous_link_ts), 0);
+  m_problem_reported = false;
+}
+
+void
+HSIFrameErrorChecker::get_info(opmonlib::InfoCollector& ci)
+{
+  hsidatalinkhandlerinfo::FrameErrorInfo info;
+  info.bad_header_frames = m_header_errors.exchange(0);
+  info.timestamp_errors = m_timestamp_errors.exchange(0);
+  info.sequence_errors = m_sequence_errors.exchange(0);
+  info.missing_frames = m_missing_frames.exchange(0);
+  ci.add(info);
+}
+
+void
+HSIFrameErrorChecker::record_errors(const detdataformats::HSIFrame& frame,
+                                    bool header_ok,
+                                    bool ts_ok,
+                                    bool sequence_ok)
+{
+  uint64_t ts = frame.get_timestamp(); // NOLINT(build/unsigned)
+  uint32_t link = frame.link;          // NOLINT(build/unsigned)
+  std::ostringstream oss;
+
+  if (!header_ok) {
+    ++m_header_errors;
+    m_error_registry->add_error(s_bad_header_error, readoutlibs::FrameErrorRegistry::ErrorInterval(ts, ts));
+    oss << "version " << frame.version << " and detector ID " << frame.detector_id << " instead of "
+        << HSI_FRAME_VERSION << " and " << HSI_FRAME_DETECTOR_ID << "; ";
+  }
+  if (!ts_ok) {
+    ++m_timestamp_errors;
+    ++m_ts_error_ctr;
+    m_error_registry->add_error(s_timestamp_error,
+                                readoutlibs::FrameErrorRegistry::ErrorInterval(ts, m_previous_link_ts[link]));
+    oss << "older than the previous frame of the link at " << m_previous_link_ts[link] << "; ";
+  }
+  if (!sequence_ok) {
+    // frames missing in between, modulo the counter width; a counter that went back counts as one error
+    uint32_t gap = (frame.sequence - m_next_sequence[link]) & m_sequence_mask; // NOLINT(build/unsigned)
+    ++m_sequence_errors;
+    if (gap <= m_sequence_mask / 2)
+      m_missing_frames += gap;
+    m_error_registry->add_error(s_sequence_error,
+                                readoutlibs::FrameErrorRegistry::ErrorInterval(
+                                  std::min(m_previous_link_ts[link], ts), std::max(m_previous_link_ts[link], ts)));
+    oss << "sequence counter " << frame.sequence << " instead of " << m_next_sequence[link] << "; ";
+  }
+
+  if (!m_problem_reported) {
+    std::string message = oss.str();
+    ers::warning(CorruptedHSIFrame(ERS_HERE, link, ts, message.substr(0, message.size() - 2)));
+    m_problem_reported = true;
+  }
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
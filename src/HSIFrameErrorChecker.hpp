@@ -0,0 +1,109 @@
+/**
+ * @file HSIFrameErrorChecker.hpp Checks of HSI frames on their way into the latency buffer
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef HSILIBS_SRC_HSI_HSIFRAMEERRORCHECKER_HPP_
+#define HSILIBS_SRC_HSI_HSIFRAMEERRORCHECKER_HPP_
+
+#include "hsilibs/Types.hpp"
+#include "hsilibs/hsidatalinkhandlerinfo/InfoNljs.hpp"
+
+#include "nlohmann/json.hpp"
+
+#include "opmonlib/InfoCollector.hpp"
+#include "readoutlibs/FrameErrorRegistry.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief Checks the DAQ header, and the timestamp order and sequence counter per link,
+ * of each frame. Frames of different links may come in any order, e.g. from a merge of
+ * several devices.
+ *
+ * check() runs in the raw processor thread for every frame. Good frames cost a few
+ * comparisons and state updates; errors are counted, recorded in the FrameErrorRegistry
+ * and reported once per run by a separate, out of line function.
+ */
+class HSIFrameErrorChecker
+{
+public:
+  static constexpr const char* s_bad_header_error = "HSI_BAD_HEADER";
+  static constexpr const char* s_timestamp_error = "HSI_TIMESTAMP_NOT_MONOTONIC";
+  static constexpr const char* s_sequence_error = "HSI_MISSING_SEQUENCE";
+
+  // ts_error_ctr counts the timestamp errors over the lifetime of the processor
+  HSIFrameErrorChecker(std::unique_ptr<readoutlibs::FrameErrorRegistry>& error_registry,
+                       std::atomic<int>& ts_error_ctr)
+    : m_error_registry(error_registry)
+    , m_ts_error_ctr(ts_error_ctr)
+  {}
+
+  // reads the sequence counter width from framecheckconf, if given
+  void conf(const nlohmann::json& args);
+
+  // forget the previous frames, e.g. at the start of a run
+  void reset();
+
+  // @return false if the frame has an error
+  bool check(const detdataformats::HSIFrame& frame)
+  {
+    uint64_t ts = frame.get_timestamp();    // NOLINT(build/unsigned)
+    uint32_t link = frame.link;             // NOLINT(build/unsigned)
+    uint32_t sequence = frame.sequence;     // NOLINT(build/unsigned)
+    uint64_t link_bit = uint64_t(1) << link; // NOLINT(build/unsigned)
+
+    bool header_ok = (frame.version == HSI_FRAME_VERSION) & (frame.detector_id == HSI_FRAME_DETECTOR_ID);
+    bool link_seen = m_links_seen & link_bit;
+    bool ts_ok = (ts >= m_previous_link_ts[link]) | !link_seen;
+    bool sequence_ok = ((sequence & m_sequence_mask) == m_next_sequence[link]) | !link_seen;
+
+    bool ok = header_ok & ts_ok & sequence_ok;
+    if (__builtin_expect(!ok, 0))
+      record_errors(frame, header_ok, ts_ok, sequence_ok);
+
+    m_previous_link_ts[link] = ts;
+    m_next_sequence[link] = (sequence + 1) & m_sequence_mask;
+    m_links_seen |= link_bit;
+    return ok;
+  }
+
+  // adds the error counters of the last interval, and resets them
+  void get_info(opmonlib::InfoCollector& ci);
+
+private:
+  void record_errors(const detdataformats::HSIFrame& frame, bool header_ok, bool ts_ok, bool sequence_ok);
+
+  // 6 bit link field
+  static constexpr size_t s_max_links = 64;
+
+  std::unique_ptr<readoutlibs::FrameErrorRegistry>& m_error_registry;
+  std::atomic<int>& m_ts_error_ctr;
+
+  // the sequence counter wraps to 0 after this value
+  uint32_t m_sequence_mask = 0xffff; // NOLINT(build/unsigned)
+
+  // only used by the processor thread
+  uint64_t m_links_seen = 0;                           // NOLINT(build/unsigned)
+  uint32_t m_next_sequence[s_max_links] = {};          // NOLINT(build/unsigned)
+  uint64_t m_previous_link_ts[s_max_links] = {};       // NOLINT(build/unsigned)
+  bool m_problem_reported = false;
+
+  // only written when there is an error
+  std::atomic<uint64_t> m_header_errors{ 0 };          // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_timestamp_errors{ 0 };       // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_sequence_errors{ 0 };        // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_missing_frames{ 0 };         // NOLINT(build/unsigned)
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_SRC_HSI_HSIFRAMEERRORCHECKER_HPP_
@@ -20,17 +20,32 @@ namespace hsilibs {
 void 
 HSIFrameProcessor::conf(const nlohmann::json& args)
 {
-  // m_tasklist.push_back( std::bind(&HSIFrameProcessor::frame_error_check, this, std::placeholders::_1) );
+  m_frame_checker.conf(args);
+  inherited::add_preprocess_task(std::bind(&HSIFrameProcessor::frame_error_check, this, std::placeholders::_1));
   inherited::conf(args);
 }
 
+void
+HSIFrameProcessor::start(const nlohmann::json& args)
+{
+  m_frame_checker.reset();
+  inherited::start(args);
+}
+
+void
+HSIFrameProcessor::get_info(opmonlib::InfoCollector& ci, int level)
+{
+  m_frame_checker.get_info(ci);
+  inherited::get_info(ci, level);
+}
+
 /**
  * Pipeline Stage 2.: Check for errors
  * */
 void 
-HSIFrameProcessor::frame_error_check(frameptr /*fp*/)
+HSIFrameProcessor::frame_error_check(frameptr fp)
 {
-  // check error fields
+  m_frame_checker.check(fp->frame);
 }
 
 } // namespace hsilibs
@@ -11,6 +11,7 @@
 #include "readoutlibs/ReadoutIssues.hpp"
 #include "readoutlibs/models/TaskRawDataProcessorModel.hpp"
 
+#include "HSIFrameErrorChecker.hpp"
 #include "hsilibs/Types.hpp"
 #include "logging/Logging.hpp"
 #include "readoutlibs/FrameErrorRegistry.hpp"
@@ -35,20 +36,25 @@ public:
   // Constructor
   explicit HSIFrameProcessor(std::unique_ptr<readoutlibs::FrameErrorRegistry>& error_registry)
     : TaskRawDataProcessorModel<hsilibs::HSI_FRAME_STRUCT>(error_registry)
+    , m_frame_checker(error_registry, m_ts_error_ctr)
   {}
 
   // Override config for pipeline setup
   void conf(const nlohmann::json& args) override;
+
+  void start(const nlohmann::json& args) override;
+
+  void get_info(opmonlib::InfoCollector& ci, int level) override;
   
 protected:
   /**
    * Pipeline Stage 2.: Check for error
    * */
-  void frame_error_check(frameptr /*fp*/);
+  void frame_error_check(frameptr fp);
 
   // Internals
-  bool m_problem_reported = false;
   std::atomic<int> m_ts_error_ctr{ 0 };
+  HSIFrameErrorChecker m_frame_checker;
 
 private:
 };
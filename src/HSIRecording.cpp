@@ -0,0 +1,513 @@
+/**
+ * @file HSIRecording.cpp HSIRecordingWriter and HSIRecordingReader class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/HSIRecording.hpp"
+
+#include "hsilibs/Issues.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace hsilibs {
+
+namespace {
+const constexpr uint64_t g_recording_magic = 0x31434552495348; // NOLINT(build/unsigned) "HSIREC1"
+const constexpr uint64_t g_index_magic = 0x31584449495348;     // NOLINT(build/unsigned) "HSIIDX1"
+const constexpr uint32_t g_chunk_magic = 0x4b4e4843;           // NOLINT(build/unsigned) "CHNK"
+
+// tag byte of an encoded frame
+const constexpr unsigned char g_tag_header = 0x1;    // the DAQ header word follows
+const constexpr unsigned char g_tag_sequence = 0x2;  // the sequence counter follows
+const constexpr unsigned g_tag_dictionary_shift = 2; // 4 bits of dictionary index, s_dictionary_size: the signal map follows
+const constexpr unsigned char g_tag_dictionary_mask = 0xf;
+const constexpr unsigned char g_tag_link = 0x40; // the link follows
+
+struct ChunkHeader
+{
+  uint32_t magic;           // NOLINT(build/unsigned)
+  uint32_t n_frames;        // NOLINT(build/unsigned)
+  uint64_t first_timestamp; // NOLINT(build/unsigned)
+  uint64_t last_timestamp;  // NOLINT(build/unsigned)
+  uint32_t payload_size;    // NOLINT(build/unsigned)
+  uint32_t reserved;        // NOLINT(build/unsigned)
+};
+
+// the words of an HSIFrame, in the order fill_hsi_frame writes them
+enum FrameWord
+{
+  kHeader = 0,
+  kTimestampLow,
+  kTimestampHigh,
+  kInputLow,
+  kInputHigh,
+  kTrigger,
+  kSequence,
+  kNumWords
+};
+static_assert(sizeof(detdataformats::HSIFrame) == kNumWords * sizeof(uint32_t), // NOLINT(build/unsigned)
+              "Check your assumptions on HSIFrame");
+
+size_t
+align(size_t size)
+{
+  return (size + HSI_RECORDING_ALIGNMENT - 1) & ~(HSI_RECORDING_ALIGNMENT - 1);
+}
+
+void
+put_varint(unsigned char*& out, uint64_t value) // NOLINT(build/unsigned)
+{
+  while (value >= 0x80) {
+    *out++ = static_cast<unsigned char>(value) | 0x80;
+    value >>= 7;
+  }
+  *out++ = static_cast<unsigned char>(value);
+}
+
+uint64_t // NOLINT(build/unsigned)
+get_varint(const unsigned char*& in)
+{
+  uint64_t value = 0; // NOLINT(build/unsigned)
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    unsigned char byte = *in++;
+    value |= uint64_t(byte & 0x7f) << shift; // NOLINT(build/unsigned)
+    if (!(byte & 0x80))
+      break;
+  }
+  return value;
+}
+
+// zigzag, so that small differences of either sign stay short
+uint64_t // NOLINT(build/unsigned)
+zigzag(int64_t value)
+{
+  return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63); // NOLINT(build/unsigned)
+}
+
+int64_t
+unzigzag(uint64_t value) // NOLINT(build/unsigned)
+{
+  return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void
+write_fully(int fd, const void* data, size_t size, uint64_t offset, const std::string& path) // NOLINT(build/unsigned)
+{
+  auto bytes = static_cast<const unsigned char*>(data);
+  while (size) {
+    ssize_t written = ::pwrite(fd, bytes, size, offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      throw HSIRecordingIssue(ERS_HERE, path, std::string("write failed: ") + std::strerror(errno));
+    }
+    bytes += written;
+    size -= written;
+    offset += written;
+  }
+}
+
+void
+read_fully(int fd, void* data, size_t size, uint64_t offset, const std::string& path) // NOLINT(build/unsigned)
+{
+  auto bytes = static_cast<unsigned char*>(data);
+  while (size) {
+    ssize_t n = ::pread(fd, bytes, size, offset);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      throw HSIRecordingIssue(ERS_HERE, path, n ? std::string("read failed: ") + std::strerror(errno) : "truncated file");
+    bytes += n;
+    size -= n;
+    offset += n;
+  }
+}
+} // namespace
+
+HSIRecordingWriter::HSIRecordingWriter(const std::string& path, size_t chunk_size, bool use_o_direct)
+  : m_path(path)
+  , m_chunk_size(align(std::max(chunk_size, 2 * s_max_encoded_frame_size * HSI_SUPERCHUNK_MAX_FRAMES)))
+  , m_fd(-1)
+  , m_index_fd(-1)
+  , m_o_direct(false)
+  , m_buffer(nullptr)
+  , m_position(0)
+  , m_offset(0)
+  , m_frames_written(0)
+{
+  // O_DIRECT keeps multi-day recordings out of the page cache; not all file systems support it
+  if (use_o_direct) {
+    m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    m_o_direct = m_fd >= 0;
+  }
+  if (m_fd < 0)
+    m_fd = ::open(m_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (m_fd < 0)
+    throw HSIRecordingIssue(ERS_HERE, m_path, std::string("open failed: ") + std::strerror(errno));
+
+  std::string index_path = m_path + ".idx";
+  m_index_fd = ::open(index_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (m_index_fd < 0) {
+    ::close(m_fd);
+    throw HSIRecordingIssue(ERS_HERE, index_path, std::string("open failed: ") + std::strerror(errno));
+  }
+
+  if (::posix_memalign(reinterpret_cast<void**>(&m_buffer), HSI_RECORDING_ALIGNMENT, m_chunk_size)) {
+    ::close(m_fd);
+    ::close(m_index_fd);
+    throw HSIRecordingIssue(ERS_HERE, m_path, "buffer allocation failed");
+  }
+
+  // the file header takes the first aligned block
+  std::memset(m_buffer, 0, HSI_RECORDING_ALIGNMENT);
+  std::memcpy(m_buffer, &g_recording_magic, sizeof(g_recording_magic));
+  write_fully(m_fd, m_buffer, HSI_RECORDING_ALIGNMENT, 0, m_path);
+  m_offset = HSI_RECORDING_ALIGNMENT;
+  write_fully(m_index_fd, &g_index_magic, sizeof(g_index_magic), 0, index_path);
+
+  start_chunk();
+}
+
+HSIRecordingWriter::~HSIRecordingWriter()
+{
+  try {
+    flush();
+  } catch (const HSIRecordingIssue& e) {
+    ers::error(e);
+  }
+  ::close(m_index_fd);
+  ::close(m_fd);
+  std::free(m_buffer);
+}
+
+void
+HSIRecordingWriter::start_chunk()
+{
+  m_position = sizeof(ChunkHeader);
+  m_n_frames = 0;
+  m_first_timestamp = 0;
+  m_previous_ts = 0;
+  m_previous_link = 0;
+  m_links_seen = 0;
+  m_dictionary_fill = 0;
+}
+
+void
+HSIRecordingWriter::write(const detdataformats::HSIFrame& frame)
+{
+  uint32_t words[kNumWords]; // NOLINT(build/unsigned)
+  std::memcpy(words, &frame, sizeof(words));
+  uint64_t ts = frame.get_timestamp(); // NOLINT(build/unsigned)
+
+  if (!m_n_frames) {
+    m_first_timestamp = ts;
+    m_previous_ts = ts;
+  }
+
+  unsigned char* tag = m_buffer + m_position;
+  unsigned char* out = tag + 1;
+  *tag = 0;
+
+  put_varint(out, zigzag(static_cast<int64_t>(ts - m_previous_ts)));
+
+  uint32_t link = frame.link; // NOLINT(build/unsigned)
+  uint64_t link_bit = uint64_t(1) << link; // NOLINT(build/unsigned)
+  bool link_seen = m_links_seen & link_bit;
+  if (link != m_previous_link) {
+    *tag |= g_tag_link;
+    *out++ = static_cast<unsigned char>(link);
+  }
+
+  if (!link_seen || words[kHeader] != m_link_header[link]) {
+    *tag |= g_tag_header;
+    std::memcpy(out, &words[kHeader], sizeof(uint32_t)); // NOLINT(build/unsigned)
+    out += sizeof(uint32_t);                             // NOLINT(build/unsigned)
+  }
+
+  if (!link_seen || words[kSequence] != m_link_sequence[link] + 1) {
+    *tag |= g_tag_sequence;
+    put_varint(out, words[kSequence]);
+  }
+
+  size_t n_entries = std::min(m_dictionary_fill, s_dictionary_size);
+  size_t entry = 0;
+  while (entry < n_entries &&
+         (m_dictionary[entry][0] != words[kInputLow] || m_dictionary[entry][1] != words[kInputHigh] ||
+          m_dictionary[entry][2] != words[kTrigger]))
+    ++entry;
+  if (entry == n_entries) {
+    entry = s_dictionary_size;
+    put_varint(out, words[kInputLow]);
+    put_varint(out, words[kInputHigh]);
+    put_varint(out, words[kTrigger]);
+    auto& slot = m_dictionary[m_dictionary_fill++ % s_dictionary_size];
+    slot[0] = words[kInputLow];
+    slot[1] = words[kInputHigh];
+    slot[2] = words[kTrigger];
+  }
+  *tag |= static_cast<unsigned char>(entry << g_tag_dictionary_shift);
+
+  m_position = out - m_buffer;
+  m_previous_ts = ts;
+  m_previous_link = link;
+  m_links_seen |= link_bit;
+  m_link_header[link] = words[kHeader];
+  m_link_sequence[link] = words[kSequence];
+  ++m_n_frames;
+  ++m_frames_written;
+}
+
+void
+HSIRecordingWriter::write(const HSI_SUPERCHUNK_STRUCT& chunk)
+{
+  for (uint32_t i = 0; i < chunk.n_frames; ++i) // NOLINT(build/unsigned)
+    write(chunk.frames[i]);
+}
+
+void
+HSIRecordingWriter::flush()
+{
+  if (!m_n_frames)
+    return;
+
+  ChunkHeader header{ g_chunk_magic, m_n_frames, m_first_timestamp, m_previous_ts,
+                      static_cast<uint32_t>(m_position - sizeof(ChunkHeader)), 0 }; // NOLINT(build/unsigned)
+  std::memcpy(m_buffer, &header, sizeof(header));
+  size_t size = align(m_position);
+  std::memset(m_buffer + m_position, 0, size - m_position);
+  write_fully(m_fd, m_buffer, size, m_offset, m_path);
+
+  HSIRecordingIndexEntry entry{ m_first_timestamp, m_previous_ts, m_offset, m_n_frames,
+                                static_cast<uint32_t>(size) }; // NOLINT(build/unsigned)
+  if (::write(m_index_fd, &entry, sizeof(entry)) != sizeof(entry))
+    throw HSIRecordingIssue(ERS_HERE, m_path + ".idx", std::string("write failed: ") + std::strerror(errno));
+
+  m_offset += size;
+  start_chunk();
+}
+
+HSIRecordingReader::HSIRecordingReader(const std::string& path)
+  : m_path(path)
+  , m_map(nullptr)
+  , m_file_size(0)
+  , m_raw(false)
+  , m_chunk(nullptr)
+  , m_chunk_number(0)
+  , m_position(0)
+  , m_frames_left(0)
+  , m_has_pending(false)
+{
+  int fd = ::open(m_path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw HSIRecordingIssue(ERS_HERE, m_path, std::string("open failed: ") + std::strerror(errno));
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat) < 0) {
+    ::close(fd);
+    throw HSIRecordingIssue(ERS_HERE, m_path, std::string("stat failed: ") + std::strerror(errno));
+  }
+  m_file_size = file_stat.st_size;
+  if (m_file_size) {
+    void* map = ::mmap(nullptr, m_file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      ::close(fd);
+      throw HSIRecordingIssue(ERS_HERE, m_path, std::string("mmap failed: ") + std::strerror(errno));
+    }
+    m_map = static_cast<const unsigned char*>(map);
+    ::madvise(map, m_file_size, MADV_SEQUENTIAL);
+  }
+  ::close(fd);
+
+  uint64_t magic = 0; // NOLINT(build/unsigned)
+  if (m_file_size >= sizeof(magic))
+    std::memcpy(&magic, m_map, sizeof(magic));
+  if (magic != g_recording_magic) {
+    // raw HSI_FRAME_STRUCTs, as written by the readoutlibs recorder
+    m_raw = true;
+    if (m_file_size % sizeof(HSI_FRAME_STRUCT)) {
+      ::munmap(const_cast<unsigned char*>(m_map), m_file_size);
+      throw HSIRecordingIssue(ERS_HERE, m_path, "neither an HSI recording nor a file of raw HSI frames");
+    }
+    return;
+  }
+
+  std::string index_path = m_path + ".idx";
+  int index_fd = ::open(index_path.c_str(), O_RDONLY);
+  try {
+    if (index_fd < 0)
+      throw HSIRecordingIssue(ERS_HERE, index_path, std::string("open failed: ") + std::strerror(errno));
+    off_t index_size = ::lseek(index_fd, 0, SEEK_END);
+    read_fully(index_fd, &magic, sizeof(magic), 0, index_path);
+    if (magic != g_index_magic)
+      throw HSIRecordingIssue(ERS_HERE, index_path, "not an HSI recording index");
+    m_index.resize((index_size - sizeof(magic)) / sizeof(HSIRecordingIndexEntry));
+    if (!m_index.empty())
+      read_fully(index_fd, m_index.data(), m_index.size() * sizeof(HSIRecordingIndexEntry), sizeof(magic), index_path);
+  } catch (const HSIRecordingIssue&) {
+    if (index_fd >= 0)
+      ::close(index_fd);
+    ::munmap(const_cast<unsigned char*>(m_map), m_file_size);
+    throw;
+  }
+  ::close(index_fd);
+
+  load_chunk(0);
+}
+
+HSIRecordingReader::~HSIRecordingReader()
+{
+  if (m_map)
+    ::munmap(const_cast<unsigned char*>(m_map), m_file_size);
+}
+
+void
+HSIRecordingReader::seek(uint64_t timestamp) // NOLINT(build/unsigned)
+{
+  m_has_pending = false;
+  if (m_raw) {
+    // binary search over the mapped frames
+    size_t first = 0;
+    size_t n = m_file_size / sizeof(HSI_FRAME_STRUCT);
+    while (n) {
+      size_t half = n / 2;
+      HSI_FRAME_STRUCT frame;
+      std::memcpy(&frame, m_map + (first + half) * sizeof(HSI_FRAME_STRUCT), sizeof(frame));
+      if (frame.get_first_timestamp() < timestamp) {
+        first += half + 1;
+        n -= half + 1;
+      } else {
+        n = half;
+      }
+    }
+    m_position = first;
+    return;
+  }
+
+  // first chunk that ends at or after timestamp
+  auto entry = std::lower_bound(
+    m_index.begin(), m_index.end(), timestamp, [](const HSIRecordingIndexEntry& e, uint64_t ts) { // NOLINT
+      return e.last_timestamp < ts;
+    });
+  if (!load_chunk(entry - m_index.begin()))
+    return;
+
+  // frames only decode in order, so keep the first one not before timestamp for next()
+  while (m_frames_left) {
+    decode(m_pending);
+    if (m_pending.get_timestamp() >= timestamp) {
+      m_has_pending = true;
+      return;
+    }
+  }
+}
+
+bool
+HSIRecordingReader::next(detdataformats::HSIFrame& frame)
+{
+  if (m_raw) {
+    if ((m_position + 1) * sizeof(HSI_FRAME_STRUCT) > m_file_size)
+      return false;
+    std::memcpy(&frame, m_map + m_position++ * sizeof(HSI_FRAME_STRUCT), sizeof(frame));
+    return true;
+  }
+
+  if (m_has_pending) {
+    frame = m_pending;
+    m_has_pending = false;
+    return true;
+  }
+  while (!m_frames_left) {
+    if (m_chunk_number >= m_index.size() || !load_chunk(m_chunk_number + 1))
+      return false;
+  }
+  decode(frame);
+  return true;
+}
+
+bool
+HSIRecordingReader::load_chunk(size_t chunk)
+{
+  m_chunk_number = chunk;
+  m_frames_left = 0;
+  m_has_pending = false;
+  if (chunk >= m_index.size())
+    return false;
+
+  const auto& entry = m_index[chunk];
+  if (entry.offset + entry.size > m_file_size)
+    throw HSIRecordingIssue(ERS_HERE, m_path, "truncated file, chunk at offset " + std::to_string(entry.offset));
+  m_chunk = m_map + entry.offset;
+  ChunkHeader header;
+  std::memcpy(&header, m_chunk, sizeof(header));
+  if (header.magic != g_chunk_magic || header.n_frames != entry.n_frames ||
+      sizeof(header) + header.payload_size > entry.size)
+    throw HSIRecordingIssue(ERS_HERE, m_path, "corrupted chunk at offset " + std::to_string(entry.offset));
+
+  m_position = sizeof(ChunkHeader);
+  m_frames_left = header.n_frames;
+  m_previous_ts = header.first_timestamp;
+  m_previous_link = 0;
+  m_dictionary_fill = 0;
+  return true;
+}
+
+void
+HSIRecordingReader::decode(detdataformats::HSIFrame& frame)
+{
+  const unsigned char* in = m_chunk + m_position;
+  unsigned char tag = *in++;
+
+  uint64_t ts = m_previous_ts + unzigzag(get_varint(in)); // NOLINT(build/unsigned)
+
+  uint32_t link = (tag & g_tag_link) ? *in++ : m_previous_link; // NOLINT(build/unsigned)
+  link %= HSIRecordingWriter::s_max_links;
+
+  uint32_t words[kNumWords]; // NOLINT(build/unsigned)
+  words[kHeader] = m_link_header[link];
+  if (tag & g_tag_header) {
+    std::memcpy(&words[kHeader], in, sizeof(uint32_t)); // NOLINT(build/unsigned)
+    in += sizeof(uint32_t);                             // NOLINT(build/unsigned)
+  }
+  words[kSequence] = (tag & g_tag_sequence) ? get_varint(in) : m_link_sequence[link] + 1;
+
+  size_t entry = (tag >> g_tag_dictionary_shift) & g_tag_dictionary_mask;
+  if (entry == HSIRecordingWriter::s_dictionary_size) {
+    auto& slot = m_dictionary[m_dictionary_fill++ % HSIRecordingWriter::s_dictionary_size];
+    slot[0] = get_varint(in);
+    slot[1] = get_varint(in);
+    slot[2] = get_varint(in);
+    words[kInputLow] = slot[0];
+    words[kInputHigh] = slot[1];
+    words[kTrigger] = slot[2];
+  } else {
+    words[kInputLow] = m_dictionary[entry][0];
+    words[kInputHigh] = m_dictionary[entry][1];
+    words[kTrigger] = m_dictionary[entry][2];
+  }
+  words[kTimestampLow] = static_cast<uint32_t>(ts);       // NOLINT(build/unsigned)
+  words[kTimestampHigh] = static_cast<uint32_t>(ts >> 32); // NOLINT(build/unsigned)
+  std::memcpy(&frame, words, sizeof(words));
+
+  m_position = in - m_chunk;
+  m_previous_ts = ts;
+  m_previous_link = link;
+  m_link_header[link] = words[kHeader];
+  m_link_sequence[link] = words[kSequence];
+  --m_frames_left;
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
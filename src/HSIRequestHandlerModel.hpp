@@ -0,0 +1,311 @@
+/**
+ * @file HSIRequestHandlerModel.hpp HSI request handler with time-based retention
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef HSILIBS_SRC_HSI_HSIREQUESTHANDLERMODEL_HPP_
+#define HSILIBS_SRC_HSI_HSIREQUESTHANDLERMODEL_HPP_
+
+#include "readoutlibs/models/DefaultRequestHandlerModel.hpp"
+
+#include "hsilibs/HSIRecording.hpp"
+#include "hsilibs/Issues.hpp"
+#include "hsilibs/Types.hpp"
+#include "hsilibs/hsidatalinkhandler/Nljs.hpp"
+#include "hsilibs/hsidatalinkhandlerinfo/InfoNljs.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace dunedaq {
+namespace hsilibs {
+
+/**
+ * @brief The frames of the buffered elements with a timestamp in [window_begin, window_end),
+ * as fragment pieces in buffer order.
+ *
+ * Elements are cut frame by frame, so a superchunk that straddles an edge of the window
+ * contributes only its frames inside the window.
+ */
+template<class ReadoutType, class LatencyBufferType>
+std::vector<std::pair<void*, size_t>>
+get_window_frame_pieces(LatencyBufferType& latency_buffer,
+                        uint64_t window_begin, // NOLINT(build/unsigned)
+                        uint64_t window_end)   // NOLINT(build/unsigned)
+{
+  std::vector<std::pair<void*, size_t>> pieces;
+  ReadoutType search;
+  search.set_first_timestamp(window_begin);
+  for (auto it = latency_buffer.lower_bound(search); it.good() && it->get_first_timestamp() < window_end; ++it) {
+    ReadoutType& element = *it;
+    for (auto frame = element.begin(); frame != element.end(); ++frame) {
+      uint64_t ts = frame->get_timestamp(); // NOLINT(build/unsigned)
+      if (ts >= window_begin && ts < window_end)
+        pieces.emplace_back(static_cast<void*>(&(*frame)), element.get_frame_size());
+    }
+  }
+  return pieces;
+}
+
+/**
+ * @brief DefaultRequestHandlerModel that also keeps the latency buffer to a time span.
+ *
+ * Frames older than the retention, counted back from the newest frame, are evicted, so
+ * the buffer holds the time window the dataflow asks for at any input rate. Eviction
+ * starts once the buffer spans an eighth more than the retention, so that it happens in
+ * batches, and waits for running requests like the count-based cleanup of the base
+ * class, which still applies as a cap.
+ *
+ * With a recordingconf, the record command writes the compact HSI recording format
+ * (see HSIRecording.hpp) instead of the readoutlibs raw recording. Frames are encoded
+ * while holding off the cleanup, like a data request; the chunks are written to disk
+ * after that, so a slow disk delays the recording thread only.
+ *
+ * Superchunks hold whatever frames one poll released and routinely span the edges of a
+ * request window. Their frames carry no fixed tick spacing (expected_tick_difference is 0),
+ * which the base class relies on to cut multi-frame elements, so fragments of superchunks
+ * are built from get_window_frame_pieces() instead.
+ *
+ * LatencyBufferType must provide get_time_span(), get_num_frames(), get_late_writes()
+ * and evict_before(), as TimeBucketLatencyBufferModel does.
+ */
+template<class ReadoutType, class LatencyBufferType>
+class HSIRequestHandlerModel : public readoutlibs::DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>
+{
+public:
+  using inherited = readoutlibs::DefaultRequestHandlerModel<ReadoutType, LatencyBufferType>;
+
+  HSIRequestHandlerModel(std::shared_ptr<LatencyBufferType>& latency_buffer,
+                         std::unique_ptr<readoutlibs::FrameErrorRegistry>& error_registry)
+    : inherited(latency_buffer, error_registry)
+  {}
+
+  ~HSIRequestHandlerModel() { stop_hsi_recording(); }
+
+  void conf(const nlohmann::json& args) override
+  {
+    m_retention_ticks = 0;
+    if (args.contains("retentionconf")) {
+      auto conf = args["retentionconf"].get<hsidatalinkhandler::RetentionConf>();
+      m_retention_ticks = conf.retention_ticks ? conf.retention_ticks
+                                               : static_cast<uint64_t>(conf.retention_time * conf.clock_frequency); // NOLINT
+      m_clock_frequency = conf.clock_frequency;
+    }
+    TLOG_DEBUG(2) << "Latency buffer retention [ticks]: " << m_retention_ticks;
+
+    if (args.contains("recordingconf")) {
+      auto conf = args["recordingconf"].get<hsidatalinkhandler::RecordingConf>();
+      if (!conf.output_file.empty())
+        m_hsi_recording_writer =
+          std::make_unique<HSIRecordingWriter>(conf.output_file, conf.chunk_size, conf.use_o_direct);
+    }
+    inherited::conf(args);
+  }
+
+  void scrap(const nlohmann::json& args) override
+  {
+    stop_hsi_recording();
+    m_hsi_recording_writer.reset();
+    inherited::scrap(args);
+  }
+
+  void stop(const nlohmann::json& args) override
+  {
+    stop_hsi_recording();
+    inherited::stop(args);
+  }
+
+  void record(const nlohmann::json& args) override
+  {
+    if (!m_hsi_recording_writer) {
+      inherited::record(args);
+      return;
+    }
+    if (m_hsi_recording.load()) {
+      ers::warning(HSIRecordingIssue(ERS_HERE, m_hsi_recording_writer->get_path(), "already recording"));
+      return;
+    }
+    auto conf = args.get<readoutlibs::readoutconfig::RecordingParams>();
+    stop_hsi_recording();
+    m_hsi_recording = true;
+    m_hsi_recording_thread = std::thread(&HSIRequestHandlerModel::run_hsi_recording, this, conf.duration);
+  }
+
+  void cleanup_check() override
+  {
+    if (m_retention_ticks && this->m_latency_buffer->get_time_span() > m_retention_ticks + m_retention_ticks / 8) {
+      std::unique_lock<std::mutex> lock(this->m_cv_mutex);
+      if (!this->m_cleanup_requested.exchange(true)) {
+        this->m_cv.wait(lock, [&] { return this->m_requests_running == 0; });
+        evict();
+        this->m_cleanup_requested = false;
+        this->m_cv.notify_all();
+      }
+    }
+    inherited::cleanup_check();
+  }
+
+  void get_info(opmonlib::InfoCollector& ci, int level) override
+  {
+    hsidatalinkhandlerinfo::Info info;
+    info.latency_buffer_frames = this->m_latency_buffer->get_num_frames();
+    info.latency_buffer_elements = this->m_latency_buffer->occupancy();
+    info.latency_buffer_buckets = this->m_latency_buffer->get_num_buckets();
+    info.latency_buffer_time_span = this->m_latency_buffer->get_time_span();
+    info.latency_buffer_time_span_s =
+      m_clock_frequency ? static_cast<double>(info.latency_buffer_time_span) / m_clock_frequency : 0.;
+    info.retention_ticks = m_retention_ticks;
+    info.evicted_frames = m_evicted_frames.exchange(0);
+    info.late_elements = this->m_latency_buffer->get_late_writes();
+    info.recorded_frames = m_recorded_frames.exchange(0);
+    info.recorded_bytes = m_recorded_bytes.exchange(0);
+    ci.add(info);
+
+    inherited::get_info(ci, level);
+  }
+
+protected:
+  typename inherited::RequestResult data_request(dfmessages::DataRequest dr) override
+  {
+    auto rres = inherited::data_request(dr);
+    if constexpr (std::is_same_v<ReadoutType, HSI_SUPERCHUNK_STRUCT>) {
+      // keep the header and result of the base class, replace the pieces
+      if (rres.fragment && (rres.result_code == inherited::ResultCode::kFound ||
+                            rres.result_code == inherited::ResultCode::kPartial)) {
+        auto header = rres.fragment->get_header();
+        rres.fragment = std::make_unique<daqdataformats::Fragment>(get_window_frame_pieces<ReadoutType>(
+          *this->m_latency_buffer, dr.request_information.window_begin, dr.request_information.window_end));
+        rres.fragment->set_header_fields(header);
+      }
+    }
+    return rres;
+  }
+
+private:
+  void evict()
+  {
+    auto newest = this->m_latency_buffer->back();
+    if (!newest)
+      return;
+    uint64_t newest_ts = newest->get_first_timestamp(); // NOLINT(build/unsigned)
+    if (newest_ts > m_retention_ticks)
+      m_evicted_frames += this->m_latency_buffer->evict_before(newest_ts - m_retention_ticks);
+  }
+
+  void stop_hsi_recording()
+  {
+    m_stop_hsi_recording = true;
+    if (m_hsi_recording_thread.joinable())
+      m_hsi_recording_thread.join();
+    m_stop_hsi_recording = false;
+  }
+
+  void run_hsi_recording(int duration) // seconds
+  {
+    auto& writer = *m_hsi_recording_writer;
+    TLOG() << "Start recording HSI frames to " << writer.get_path() << " for " << duration << " s";
+    uint64_t frames_before = writer.get_frames_written(); // NOLINT(build/unsigned)
+    uint64_t bytes_before = writer.get_bytes_written();   // NOLINT(build/unsigned)
+
+    // next element to record: the first with next_ts, after skipping the already recorded ones with it
+    uint64_t next_ts = 0;   // NOLINT(build/unsigned)
+    size_t n_recorded_at_next_ts = 0;
+    bool started = false;
+
+    auto end_time = std::chrono::steady_clock::now() + std::chrono::seconds(duration);
+    while (!m_stop_hsi_recording && std::chrono::steady_clock::now() < end_time) {
+      {
+        std::unique_lock<std::mutex> lock(this->m_cv_mutex);
+        this->m_cv.wait(lock, [&] { return !this->m_cleanup_requested; });
+        this->m_requests_running++;
+      }
+      this->m_cv.notify_all();
+
+      size_t n_written = 0;
+      auto it = this->m_latency_buffer->begin();
+      if (started) {
+        ReadoutType search;
+        search.set_first_timestamp(next_ts);
+        it = this->m_latency_buffer->lower_bound(search);
+        // also returns elements that start before next_ts and reach it, which were recorded already
+        while (it.good() && it->get_first_timestamp() < next_ts)
+          ++it;
+        for (size_t i = 0; i < n_recorded_at_next_ts && it.good() && it->get_first_timestamp() == next_ts; ++i)
+          ++it;
+      }
+      for (; it.good() && !writer.full(); ++it) {
+        const ReadoutType& element = *it;
+        writer.write(element);
+        uint64_t ts = element.get_first_timestamp(); // NOLINT(build/unsigned)
+        n_recorded_at_next_ts = (started && ts == next_ts) ? n_recorded_at_next_ts + 1 : 1;
+        next_ts = ts;
+        started = true;
+        ++n_written;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(this->m_cv_mutex);
+        this->m_requests_running--;
+      }
+      this->m_cv.notify_all();
+
+      try {
+        if (writer.full())
+          writer.flush();
+      } catch (const HSIRecordingIssue& e) {
+        ers::error(e);
+        break;
+      }
+      update_recording_counters(writer, frames_before, bytes_before);
+      if (!n_written)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    try {
+      writer.flush();
+    } catch (const HSIRecordingIssue& e) {
+      ers::error(e);
+    }
+    update_recording_counters(writer, frames_before, bytes_before);
+    TLOG() << "Stop recording HSI frames to " << writer.get_path();
+    m_hsi_recording = false;
+  }
+
+  void update_recording_counters(const HSIRecordingWriter& writer,
+                                 uint64_t& frames_before, // NOLINT(build/unsigned)
+                                 uint64_t& bytes_before)  // NOLINT(build/unsigned)
+  {
+    m_recorded_frames += writer.get_frames_written() - frames_before;
+    m_recorded_bytes += writer.get_bytes_written() - bytes_before;
+    frames_before = writer.get_frames_written();
+    bytes_before = writer.get_bytes_written();
+  }
+
+  uint64_t m_retention_ticks = 0;            // NOLINT(build/unsigned)
+  uint64_t m_clock_frequency = 62500000;     // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_evicted_frames{ 0 }; // NOLINT(build/unsigned)
+
+  std::unique_ptr<HSIRecordingWriter> m_hsi_recording_writer;
+  std::thread m_hsi_recording_thread;
+  std::atomic<bool> m_hsi_recording{ false };
+  std::atomic<bool> m_stop_hsi_recording{ false };
+  std::atomic<uint64_t> m_recorded_frames{ 0 }; // NOLINT(build/unsigned)
+  std::atomic<uint64_t> m_recorded_bytes{ 0 };  // NOLINT(build/unsigned)
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_SRC_HSI_HSIREQUESTHANDLERMODEL_HPP_
@@ -0,0 +1,53 @@
+/**
+ * @file HSISuperChunkProcessor.cpp HSI superchunk specific Task based raw processor
+ * implementation
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#include "hsilibs/Types.hpp"
+#include "HSISuperChunkProcessor.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace dunedaq {
+namespace hsilibs {
+
+void
+HSISuperChunkProcessor::conf(const nlohmann::json& args)
+{
+  m_frame_checker.conf(args);
+  inherited::add_preprocess_task(std::bind(&HSISuperChunkProcessor::frame_error_check, this, std::placeholders::_1));
+  inherited::conf(args);
+}
+
+void
+HSISuperChunkProcessor::start(const nlohmann::json& args)
+{
+  m_frame_checker.reset();
+  inherited::start(args);
+}
+
+void
+HSISuperChunkProcessor::get_info(opmonlib::InfoCollector& ci, int level)
+{
+  m_frame_checker.get_info(ci);
+  inherited::get_info(ci, level);
+}
+
+/**
+ * Pipeline Stage 2.: Check for errors
+ * */
+void
+HSISuperChunkProcessor::frame_error_check(frameptr fp)
+{
+  for (auto& frame : *fp)
+    m_frame_checker.check(frame);
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
@@ -0,0 +1,65 @@
+/**
+ * @file HSISuperChunkProcessor.hpp HSI superchunk specific Task based raw processor
+ *
+ * This is part of the DUNE DAQ , copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+#ifndef HSILIBS_SRC_HSI_HSISUPERCHUNKPROCESSOR_HPP_
+#define HSILIBS_SRC_HSI_HSISUPERCHUNKPROCESSOR_HPP_
+
+#include "readoutlibs/ReadoutIssues.hpp"
+#include "readoutlibs/models/TaskRawDataProcessorModel.hpp"
+
+#include "HSIFrameErrorChecker.hpp"
+#include "hsilibs/Types.hpp"
+#include "logging/Logging.hpp"
+#include "readoutlibs/FrameErrorRegistry.hpp"
+#include "readoutlibs/ReadoutLogging.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace dunedaq {
+namespace hsilibs {
+
+class HSISuperChunkProcessor : public readoutlibs::TaskRawDataProcessorModel<hsilibs::HSI_SUPERCHUNK_STRUCT>
+{
+
+public:
+  using inherited = readoutlibs::TaskRawDataProcessorModel<hsilibs::HSI_SUPERCHUNK_STRUCT>;
+  using frameptr = hsilibs::HSI_SUPERCHUNK_STRUCT*;
+  using timestamp_t = std::uint64_t; // NOLINT(build/unsigned)
+
+  // Constructor
+  explicit HSISuperChunkProcessor(std::unique_ptr<readoutlibs::FrameErrorRegistry>& error_registry)
+    : TaskRawDataProcessorModel<hsilibs::HSI_SUPERCHUNK_STRUCT>(error_registry)
+    , m_frame_checker(error_registry, m_ts_error_ctr)
+  {}
+
+  // Override config for pipeline setup
+  void conf(const nlohmann::json& args) override;
+
+  void start(const nlohmann::json& args) override;
+
+  void get_info(opmonlib::InfoCollector& ci, int level) override;
+
+protected:
+  /**
+   * Pipeline Stage 2.: Check for error, frame by frame
+   * */
+  void frame_error_check(frameptr fp);
+
+  // Internals
+  std::atomic<int> m_ts_error_ctr{ 0 };
+  HSIFrameErrorChecker m_frame_checker;
+
+private:
+};
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+#endif // HSILIBS_SRC_HSI_HSISUPERCHUNKPROCESSOR_HPP_
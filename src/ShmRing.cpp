@@ -0,0 +1,254 @@
+/**
+ * @file ShmRing.cpp ShmRing class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/ShmRing.hpp"
+
+#include "hsilibs/Issues.hpp"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace hsilibs {
+
+namespace {
+const constexpr uint64_t g_ring_magic = 0x474e495249534800; // NOLINT(build/unsigned) "\0HSIRING"
+const constexpr uint32_t g_ring_version = 1;                // NOLINT(build/unsigned)
+
+// how long an attaching side waits for the creating side to initialise the segment
+const constexpr auto g_init_timeout = std::chrono::seconds(1);
+
+// checks of the other side's position before going to sleep, to skip the futex calls in a steady stream
+const constexpr int g_spin_count = 1000;
+
+// the segment is shared between processes, so the private futex operations cannot be used
+void
+futex_wait(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::nanoseconds timeout) // NOLINT
+{
+  timespec ts;
+  ts.tv_sec = timeout.count() / 1000000000;
+  ts.tv_nsec = timeout.count() % 1000000000;
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &ts, nullptr, 0); // NOLINT
+}
+
+void
+futex_wake(std::atomic<uint32_t>& word) // NOLINT(build/unsigned)
+{
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0); // NOLINT
+}
+} // namespace
+
+struct ShmRing::Header
+{
+  std::atomic<uint64_t> magic; // NOLINT(build/unsigned) set last by the creating side
+  uint32_t version;            // NOLINT(build/unsigned)
+  uint32_t record_size;        // NOLINT(build/unsigned)
+  uint64_t capacity;           // NOLINT(build/unsigned)
+
+  // written by the producer
+  alignas(64) std::atomic<uint64_t> head;       // NOLINT(build/unsigned) sequence number of the next record to write
+  std::atomic<uint32_t> data_futex;             // NOLINT(build/unsigned) bumped on every commit
+  std::atomic<uint32_t> consumer_waiting;       // NOLINT(build/unsigned)
+
+  // written by the consumer
+  alignas(64) std::atomic<uint64_t> tail;       // NOLINT(build/unsigned) sequence number of the oldest record
+  std::atomic<uint32_t> space_futex;            // NOLINT(build/unsigned) bumped on every pop
+  std::atomic<uint32_t> producer_waiting;       // NOLINT(build/unsigned)
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring positions are shared between processes"); // NOLINT
+
+ShmRing::ShmRing(const std::string& name, size_t record_size, size_t capacity)
+  : m_name(name)
+  , m_record_size(record_size)
+  , m_slot_size((record_size + 7) & ~size_t(7))
+  , m_capacity(capacity)
+  , m_segment_size(sizeof(Header) + m_slot_size * capacity)
+  , m_map(nullptr)
+  , m_header(nullptr)
+  , m_remove_on_close(false)
+{
+  if (!capacity)
+    throw ShmRingIssue(ERS_HERE, m_name, "capacity must not be 0");
+
+  bool created = true;
+  int fd = ::shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660);
+  if (fd < 0 && errno == EEXIST) {
+    created = false;
+    fd = ::shm_open(m_name.c_str(), O_RDWR, 0660);
+  }
+  if (fd < 0)
+    throw ShmRingIssue(ERS_HERE, m_name, std::string("shm_open failed: ") + std::strerror(errno));
+
+  if (created) {
+    if (::ftruncate(fd, m_segment_size) != 0) {
+      auto error = errno;
+      ::close(fd);
+      ::shm_unlink(m_name.c_str());
+      throw ShmRingIssue(ERS_HERE, m_name, std::string("ftruncate failed: ") + std::strerror(error));
+    }
+  } else {
+    // the other side may still be sizing the segment
+    auto deadline = std::chrono::steady_clock::now() + g_init_timeout;
+    struct stat status;
+    while (::fstat(fd, &status) == 0 && static_cast<size_t>(status.st_size) < m_segment_size &&
+           std::chrono::steady_clock::now() < deadline)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    if (::fstat(fd, &status) != 0 || static_cast<size_t>(status.st_size) != m_segment_size) {
+      ::close(fd);
+      throw ShmRingIssue(ERS_HERE, m_name, "existing segment has a different size");
+    }
+  }
+
+  void* map = ::mmap(nullptr, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED)
+    throw ShmRingIssue(ERS_HERE, m_name, std::string("mmap failed: ") + std::strerror(errno));
+  m_map = static_cast<unsigned char*>(map);
+  m_header = reinterpret_cast<Header*>(m_map);
+
+  if (created) {
+    // a new segment is zero-filled, so the positions and futex words already start at 0
+    m_header->version = g_ring_version;
+    m_header->record_size = m_record_size;
+    m_header->capacity = m_capacity;
+    m_header->magic.store(g_ring_magic, std::memory_order_release);
+    return;
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + g_init_timeout;
+  while (m_header->magic.load(std::memory_order_acquire) != g_ring_magic && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  if (m_header->magic.load(std::memory_order_acquire) != g_ring_magic || m_header->version != g_ring_version ||
+      m_header->record_size != m_record_size || m_header->capacity != m_capacity) {
+    ::munmap(m_map, m_segment_size);
+    throw ShmRingIssue(ERS_HERE, m_name, "existing segment is not a ring with the same record size and capacity");
+  }
+}
+
+ShmRing::~ShmRing()
+{
+  ::munmap(m_map, m_segment_size);
+  if (m_remove_on_close)
+    ::shm_unlink(m_name.c_str());
+}
+
+void*
+ShmRing::claim()
+{
+  uint64_t head = m_header->head.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+  if (head - m_header->tail.load(std::memory_order_acquire) >= m_capacity)
+    return nullptr;
+  return slot(head);
+}
+
+void
+ShmRing::commit()
+{
+  m_header->head.fetch_add(1, std::memory_order_release);
+  m_header->data_futex.fetch_add(1, std::memory_order_seq_cst);
+  if (m_header->consumer_waiting.load(std::memory_order_seq_cst))
+    futex_wake(m_header->data_futex);
+}
+
+bool
+ShmRing::wait_for_space(std::chrono::milliseconds timeout)
+{
+  for (int spin = 0; spin < g_spin_count; ++spin)
+    if (m_header->head.load(std::memory_order_relaxed) - m_header->tail.load(std::memory_order_acquire) < m_capacity)
+      return true;
+
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (true) {
+    uint32_t seen = m_header->space_futex.load(std::memory_order_seq_cst); // NOLINT(build/unsigned)
+    m_header->producer_waiting.store(1, std::memory_order_seq_cst);
+    // checked again after announcing the wait, so that a pop in between is not missed
+    bool full = m_header->head.load(std::memory_order_relaxed) - m_header->tail.load(std::memory_order_seq_cst) >=
+                m_capacity;
+    auto now = std::chrono::steady_clock::now();
+    if (!full || now >= deadline) {
+      m_header->producer_waiting.store(0, std::memory_order_relaxed);
+      return !full;
+    }
+    futex_wait(m_header->space_futex, seen, deadline - now);
+  }
+}
+
+const void*
+ShmRing::front() const
+{
+  uint64_t tail = m_header->tail.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+  if (tail == m_header->head.load(std::memory_order_acquire))
+    return nullptr;
+  return slot(tail);
+}
+
+void
+ShmRing::pop_front()
+{
+  uint64_t tail = m_header->tail.load(std::memory_order_relaxed); // NOLINT(build/unsigned)
+  if (tail == m_header->head.load(std::memory_order_acquire))
+    return;
+  m_header->tail.store(tail + 1, std::memory_order_release);
+  m_header->space_futex.fetch_add(1, std::memory_order_seq_cst);
+  if (m_header->producer_waiting.load(std::memory_order_seq_cst))
+    futex_wake(m_header->space_futex);
+}
+
+bool
+ShmRing::wait_for_data(std::chrono::milliseconds timeout)
+{
+  for (int spin = 0; spin < g_spin_count; ++spin)
+    if (m_header->tail.load(std::memory_order_relaxed) != m_header->head.load(std::memory_order_acquire))
+      return true;
+
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  while (true) {
+    uint32_t seen = m_header->data_futex.load(std::memory_order_seq_cst); // NOLINT(build/unsigned)
+    m_header->consumer_waiting.store(1, std::memory_order_seq_cst);
+    // checked again after announcing the wait, so that a commit in between is not missed
+    bool empty = m_header->tail.load(std::memory_order_relaxed) == m_header->head.load(std::memory_order_seq_cst);
+    auto now = std::chrono::steady_clock::now();
+    if (!empty || now >= deadline) {
+      m_header->consumer_waiting.store(0, std::memory_order_relaxed);
+      return !empty;
+    }
+    futex_wait(m_header->data_futex, seen, deadline - now);
+  }
+}
+
+size_t
+ShmRing::size() const
+{
+  return m_header->head.load(std::memory_order_acquire) - m_header->tail.load(std::memory_order_acquire);
+}
+
+unsigned char*
+ShmRing::slot(uint64_t sequence) const // NOLINT(build/unsigned)
+{
+  return m_map + sizeof(Header) + (sequence % m_capacity) * m_slot_size;
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
@@ -0,0 +1,210 @@
+/**
+ * @file SpillJournal.cpp SpillJournal class
+ * implementation
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/SpillJournal.hpp"
+
+#include "hsilibs/Issues.hpp"
+
+#include <boost/crc.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dunedaq {
+namespace hsilibs {
+
+namespace {
+const constexpr uint64_t g_journal_magic = 0x4c4e524a49534800; // NOLINT(build/unsigned) "\0HSIJRNL"
+const constexpr uint32_t g_journal_version = 1;                // NOLINT(build/unsigned)
+} // namespace
+
+struct SpillJournal::Header
+{
+  uint64_t magic;       // NOLINT(build/unsigned)
+  uint32_t version;     // NOLINT(build/unsigned)
+  uint32_t record_size; // NOLINT(build/unsigned)
+  uint64_t capacity;    // NOLINT(build/unsigned)
+  uint64_t head;        // NOLINT(build/unsigned) sequence number of the next record to append
+  uint64_t tail;        // NOLINT(build/unsigned) sequence number of the oldest record
+};
+
+struct SpillJournal::SlotHeader
+{
+  uint64_t sequence; // NOLINT(build/unsigned)
+  uint32_t crc;      // NOLINT(build/unsigned)
+  uint32_t reserved; // NOLINT(build/unsigned)
+};
+
+SpillJournal::SpillJournal(const std::string& path, size_t record_size, size_t capacity)
+  : m_path(path)
+  , m_record_size(record_size)
+  , m_slot_size((sizeof(SlotHeader) + record_size + 7) & ~size_t(7))
+  , m_capacity(capacity)
+  , m_file_size(sizeof(Header) + m_slot_size * capacity)
+  , m_fd(-1)
+  , m_map(nullptr)
+  , m_header(nullptr)
+  , m_remove_on_close(false)
+{
+  if (!capacity)
+    throw SpillJournalIssue(ERS_HERE, m_path, "capacity must not be 0");
+
+  m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (m_fd < 0)
+    throw SpillJournalIssue(ERS_HERE, m_path, std::string("open failed: ") + std::strerror(errno));
+
+  // reserve the blocks up front so that a full disk shows up now rather than as SIGBUS during an outage
+  int error = ::posix_fallocate(m_fd, 0, m_file_size);
+  if (error) {
+    ::close(m_fd);
+    throw SpillJournalIssue(ERS_HERE, m_path, std::string("allocation failed: ") + std::strerror(error));
+  }
+
+  map_file();
+  m_header->magic = g_journal_magic;
+  m_header->version = g_journal_version;
+  m_header->record_size = m_record_size;
+  m_header->capacity = m_capacity;
+  m_header->head = 0;
+  m_header->tail = 0;
+}
+
+SpillJournal::SpillJournal(const std::string& path)
+  : m_path(path)
+  , m_record_size(0)
+  , m_slot_size(0)
+  , m_capacity(0)
+  , m_file_size(0)
+  , m_fd(-1)
+  , m_map(nullptr)
+  , m_header(nullptr)
+  , m_remove_on_close(false)
+{
+  m_fd = ::open(m_path.c_str(), O_RDWR);
+  if (m_fd < 0)
+    throw SpillJournalIssue(ERS_HERE, m_path, std::string("open failed: ") + std::strerror(errno));
+
+  Header header;
+  if (::pread(m_fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)) ||
+      header.magic != g_journal_magic || header.version != g_journal_version || !header.capacity ||
+      header.head - header.tail > header.capacity) {
+    ::close(m_fd);
+    throw SpillJournalIssue(ERS_HERE, m_path, "not a spill journal");
+  }
+
+  m_record_size = header.record_size;
+  m_slot_size = (sizeof(SlotHeader) + m_record_size + 7) & ~size_t(7);
+  m_capacity = header.capacity;
+  m_file_size = sizeof(Header) + m_slot_size * m_capacity;
+
+  struct stat status;
+  if (::fstat(m_fd, &status) != 0 || static_cast<size_t>(status.st_size) != m_file_size) {
+    ::close(m_fd);
+    throw SpillJournalIssue(ERS_HERE, m_path, "file size does not match the journal header");
+  }
+
+  map_file();
+}
+
+SpillJournal::~SpillJournal()
+{
+  ::munmap(m_map, m_file_size);
+  ::close(m_fd);
+  if (m_remove_on_close)
+    ::unlink(m_path.c_str());
+}
+
+bool
+SpillJournal::append(const void* record)
+{
+  if (size() >= m_capacity)
+    return false;
+
+  uint64_t sequence = m_header->head; // NOLINT(build/unsigned)
+  auto slot_ptr = slot(sequence);
+  std::memcpy(slot_ptr + sizeof(SlotHeader), record, m_record_size);
+
+  auto slot_header = reinterpret_cast<SlotHeader*>(slot_ptr);
+  slot_header->sequence = sequence;
+  slot_header->crc = checksum(sequence, record);
+  slot_header->reserved = 0;
+
+  // published last, so that an interrupted append leaves the previous state intact
+  m_header->head = sequence + 1;
+  return true;
+}
+
+const void*
+SpillJournal::front(bool& valid) const
+{
+  if (empty())
+    return nullptr;
+
+  uint64_t sequence = m_header->tail; // NOLINT(build/unsigned)
+  auto slot_ptr = slot(sequence);
+  auto slot_header = reinterpret_cast<const SlotHeader*>(slot_ptr);
+  const void* record = slot_ptr + sizeof(SlotHeader);
+
+  valid = slot_header->sequence == sequence && slot_header->crc == checksum(sequence, record);
+  return record;
+}
+
+void
+SpillJournal::pop_front()
+{
+  if (!empty())
+    ++m_header->tail;
+}
+
+size_t
+SpillJournal::size() const
+{
+  return m_header->head - m_header->tail;
+}
+
+void
+SpillJournal::map_file()
+{
+  void* map = ::mmap(nullptr, m_file_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+  if (map == MAP_FAILED) {
+    auto error = errno;
+    ::close(m_fd);
+    throw SpillJournalIssue(ERS_HERE, m_path, std::string("mmap failed: ") + std::strerror(error));
+  }
+  m_map = static_cast<unsigned char*>(map);
+  m_header = reinterpret_cast<Header*>(m_map);
+}
+
+unsigned char*
+SpillJournal::slot(uint64_t sequence) const // NOLINT(build/unsigned)
+{
+  return m_map + sizeof(Header) + (sequence % m_capacity) * m_slot_size;
+}
+
+uint32_t // NOLINT(build/unsigned)
+SpillJournal::checksum(uint64_t sequence, const void* record) const // NOLINT(build/unsigned)
+{
+  boost::crc_32_type crc;
+  crc.process_bytes(&sequence, sizeof(sequence));
+  crc.process_bytes(record, m_record_size);
+  return crc.checksum();
+}
+
+} // namespace hsilibs
+} // namespace dunedaq
+
+// Local Variables:
+// c-basic-offset: 2
+// End:
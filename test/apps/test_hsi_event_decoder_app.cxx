@@ -0,0 +1,137 @@
+/**
+ * @file test_hsi_event_decoder_app.cxx Decoding speed of raw HSI buffer words
+ *
+ * Blocks of HSI buffer words are decoded with the per-event loop HSIReadout used
+ * before (a copy into a std::array, bounds-checked reads, a branch per check),
+ * with decode_hsi_events_scalar and with decode_hsi_events, which uses AVX2 when
+ * the CPU supports it. One event in 64 has a corrupt header.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/HSIEventDecoder.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace dunedaq;
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+std::vector<uint32_t> // NOLINT(build/unsigned)
+make_words(size_t n_events)
+{
+  std::mt19937 rng(n_events);
+  std::vector<uint32_t> words; // NOLINT(build/unsigned)
+  words.reserve(n_events * HSI_BUFFER_EVENT_SIZE);
+  uint64_t ts = 0x123456789; // NOLINT(build/unsigned)
+  for (size_t i = 0; i < n_events; ++i) {
+    ts += 1 + rng() % 2000;
+    uint32_t marker = i % 64 == 63 ? 0xbad0 : HSI_BUFFER_EVENT_HEADER_MARKER; // NOLINT(build/unsigned)
+    words.push_back((marker << 16) | (i & 0xffff));
+    words.push_back(static_cast<uint32_t>(ts));       // NOLINT(build/unsigned)
+    words.push_back(static_cast<uint32_t>(ts >> 32)); // NOLINT(build/unsigned)
+    words.push_back(rng());
+    words.push_back(rng());
+  }
+  return words;
+}
+
+// the loop of HSIReadout::do_hsi_work before the batch decoder, returns the sum of the valid timestamps
+uint64_t // NOLINT(build/unsigned)
+decode_per_event(const std::vector<uint32_t>& words) // NOLINT(build/unsigned)
+{
+  uint64_t checksum = 0; // NOLINT(build/unsigned)
+  size_t n_events = words.size() / HSI_BUFFER_EVENT_SIZE;
+  for (size_t i = 0; i < n_events; ++i) {
+    std::array<uint32_t, HSI_BUFFER_EVENT_SIZE> raw_event; // NOLINT(build/unsigned)
+    auto event_start = words.begin() + (i * HSI_BUFFER_EVENT_SIZE);
+    std::copy_n(event_start, HSI_BUFFER_EVENT_SIZE, raw_event.begin());
+
+    uint32_t header = raw_event.at(0);  // NOLINT(build/unsigned)
+    uint32_t ts_low = raw_event.at(1);  // NOLINT(build/unsigned)
+    uint32_t ts_high = raw_event.at(2); // NOLINT(build/unsigned)
+    uint32_t data = raw_event.at(3);    // NOLINT(build/unsigned)
+    uint32_t trigger = raw_event.at(4); // NOLINT(build/unsigned)
+
+    uint64_t ts = ts_low | (static_cast<uint64_t>(ts_high) << 32); // NOLINT(build/unsigned)
+    if ((header >> 16) != HSI_BUFFER_EVENT_HEADER_MARKER)
+      continue;
+    if (ts == 0)
+      continue;
+    checksum += ts + data + trigger;
+  }
+  return checksum;
+}
+
+template<class Decode>
+uint64_t // NOLINT(build/unsigned)
+decode_batch(Decode&& decode, const std::vector<uint32_t>& words, HSIDecodedEvents& events) // NOLINT
+{
+  size_t n_events = decode(words.data(), words.size(), events);
+  uint64_t checksum = 0; // NOLINT(build/unsigned)
+  for (size_t i = 0; i < n_events; ++i)
+    if (events.is_valid(i))
+      checksum += events.timestamps[i] + events.data[i] + events.triggers[i];
+  return checksum;
+}
+
+// decodes the block until about n_total events are done, returns the sum of the checksums
+template<class Decode>
+uint64_t // NOLINT(build/unsigned)
+measure(Decode&& decode, size_t n_events, size_t n_total, const std::string& label)
+{
+  size_t n_repeats = std::max<size_t>(1, n_total / n_events);
+  uint64_t checksum = 0; // NOLINT(build/unsigned)
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n_repeats; ++i)
+    checksum += decode();
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+  double ns_per_event = static_cast<double>(ns) / (n_repeats * n_events);
+  TLOG() << "  " << label << ": " << ns_per_event << " ns/event, " << 1.e3 / ns_per_event << " Mevents/s";
+  return checksum;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  size_t n_total = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000000;
+  TLOG() << "Decoding about " << n_total << " events per block size";
+
+  bool ok = true;
+  for (size_t n_events : { 16, 256, 4096, 65536 }) {
+    auto words = make_words(n_events);
+    HSIDecodedEvents events;
+
+    TLOG() << "Blocks of " << n_events << " events";
+    auto legacy = measure([&] { return decode_per_event(words); }, n_events, n_total, "per event loop");
+    auto scalar = measure([&] { return decode_batch(decode_hsi_events_scalar, words, events); },
+                          n_events,
+                          n_total,
+                          "decode_hsi_events_scalar");
+    auto batch =
+      measure([&] { return decode_batch(decode_hsi_events, words, events); }, n_events, n_total, "decode_hsi_events");
+
+    // the decoders agree, and the checksums keep their work from being optimised away
+    if (scalar != legacy || batch != legacy) {
+      TLOG() << "Checksums differ: " << legacy << ", " << scalar << ", " << batch;
+      ok = false;
+    }
+  }
+
+  return ok ? 0 : 1;
+}
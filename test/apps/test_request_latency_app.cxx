@@ -0,0 +1,163 @@
+/**
+ * @file test_request_latency_app.cxx Request serving latency of the HSI latency
+ * buffer as its depth grows
+ *
+ * Data requests for a short window are served from a TimeBucketLatencyBufferModel,
+ * which searches the contiguous timestamp index of its buckets, and from a sorted
+ * array of HSI frames searched with their operator<, as BinarySearchQueueModel
+ * does, for buffer depths from a thousand to a few million frames. The search for
+ * the start of the window is also timed on its own.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "../../src/HSIRequestHandlerModel.hpp"
+#include "../../src/TimeBucketLatencyBufferModel.hpp"
+
+#include "hsilibs/LatencyHistogram.hpp"
+#include "hsilibs/Types.hpp"
+
+#include "logging/Logging.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace dunedaq;
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+// about the spacing of HSI frames with signals at 62.5 kHz, in 62.5 MHz clock ticks
+const uint64_t g_mean_tick_spacing = 1000; // NOLINT(build/unsigned)
+// windows of about 10 frames
+const uint64_t g_window_ticks = 10 * g_mean_tick_spacing; // NOLINT(build/unsigned)
+
+using frame_buffer_t = TimeBucketLatencyBufferModel<HSI_FRAME_STRUCT>;
+
+std::vector<uint64_t> // NOLINT(build/unsigned)
+make_timestamps(size_t depth)
+{
+  std::mt19937_64 rng(depth);
+  std::vector<uint64_t> timestamps(depth); // NOLINT(build/unsigned)
+  uint64_t ts = 1000000;                    // NOLINT(build/unsigned)
+  for (auto& element : timestamps) {
+    ts += 1 + rng() % (2 * g_mean_tick_spacing);
+    element = ts;
+  }
+  return timestamps;
+}
+
+HSI_FRAME_STRUCT
+make_frame(uint64_t ts) // NOLINT(build/unsigned)
+{
+  HSI_FRAME_STRUCT frame{};
+  frame.set_first_timestamp(ts);
+  return frame;
+}
+
+// the frames of a sorted array in [window_begin, window_end), found with a search over whole frames
+std::vector<std::pair<void*, size_t>>
+get_array_window_pieces(std::vector<HSI_FRAME_STRUCT>& frames,
+                        uint64_t window_begin, // NOLINT(build/unsigned)
+                        uint64_t window_end)   // NOLINT(build/unsigned)
+{
+  std::vector<std::pair<void*, size_t>> pieces;
+  auto search = make_frame(window_begin);
+  for (auto it = std::lower_bound(frames.begin(), frames.end(), search);
+       it != frames.end() && it->get_first_timestamp() < window_end;
+       ++it)
+    pieces.emplace_back(static_cast<void*>(&(*it)), it->get_frame_size());
+  return pieces;
+}
+
+// serves n_requests random windows inside the buffered range and reports their latency;
+// serve_request returns the number of frames found
+template<class ServeRequest>
+void
+measure(ServeRequest&& serve_request,
+        const std::vector<uint64_t>& timestamps, // NOLINT(build/unsigned)
+        size_t n_requests,
+        const std::string& label)
+{
+  std::mt19937_64 rng(n_requests);
+  std::uniform_int_distribution<uint64_t> window_begin(timestamps.front(), timestamps.back()); // NOLINT
+  LatencyHistogram latency;
+  size_t n_frames = 0;
+  uint64_t total_ns = 0; // NOLINT(build/unsigned)
+
+  for (size_t i = 0; i < n_requests; ++i) {
+    uint64_t begin = window_begin(rng); // NOLINT(build/unsigned)
+    auto start = std::chrono::steady_clock::now();
+    // used, so that the request is not optimised away
+    n_frames += serve_request(begin, begin + g_window_ticks);
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    latency.record(ns);
+    total_ns += ns;
+  }
+
+  auto summary = latency.read();
+  TLOG() << label << ": mean " << total_ns / n_requests << " ns, p50 " << summary.p50 << " ns, p99 " << summary.p99
+         << " ns, " << static_cast<double>(n_frames) / n_requests << " frames per request";
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  size_t n_requests = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 100000;
+  TLOG() << "Serving " << n_requests << " requests for windows of " << g_window_ticks << " ticks per buffer depth";
+
+  for (size_t depth = 1 << 10; depth <= (1 << 22); depth <<= 2) {
+    auto timestamps = make_timestamps(depth);
+
+    frame_buffer_t buffer;
+    buffer.allocate_memory(depth);
+    std::vector<HSI_FRAME_STRUCT> frames;
+    frames.reserve(depth);
+    for (auto ts : timestamps) {
+      buffer.write(make_frame(ts));
+      frames.push_back(make_frame(ts));
+    }
+
+    TLOG() << "Depth " << depth << " frames, " << buffer.get_num_buckets() << " buckets";
+    measure(
+      [&](uint64_t begin, uint64_t end) { // NOLINT(build/unsigned)
+        return get_window_frame_pieces<HSI_FRAME_STRUCT>(buffer, begin, end).size();
+      },
+      timestamps,
+      n_requests,
+      "  time buckets, timestamp index, request");
+    measure(
+      [&](uint64_t begin, uint64_t end) { // NOLINT(build/unsigned)
+        return get_array_window_pieces(frames, begin, end).size();
+      },
+      timestamps,
+      n_requests,
+      "  sorted frames, frame operator<, request");
+    measure(
+      [&](uint64_t begin, uint64_t /*end*/) { // NOLINT(build/unsigned)
+        auto search = make_frame(begin);
+        return static_cast<size_t>(buffer.lower_bound(search).good());
+      },
+      timestamps,
+      n_requests,
+      "  time buckets, timestamp index, search");
+    measure(
+      [&](uint64_t begin, uint64_t /*end*/) { // NOLINT(build/unsigned)
+        return static_cast<size_t>(std::lower_bound(frames.begin(), frames.end(), make_frame(begin)) != frames.end());
+      },
+      timestamps,
+      n_requests,
+      "  sorted frames, frame operator<, search");
+  }
+
+  return 0;
+}
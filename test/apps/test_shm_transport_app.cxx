@@ -0,0 +1,216 @@
+/**
+ * @file test_shm_transport_app.cxx Throughput and latency of the shared memory
+ * ring transport compared with serialised messages through the kernel
+ *
+ * HSIEvents go from this process to a forked consumer process, either through a
+ * ShmRing or serialised with msgpack and written to a pipe, as iomanager network
+ * connections serialise every message and pass it through a socket.
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/LatencyHistogram.hpp"
+#include "hsilibs/ShmRing.hpp"
+
+#include "dfmessages/HSIEvent.hpp"
+#include "logging/Logging.hpp"
+#include "serialization/Serialization.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace dunedaq;
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+const size_t g_ring_capacity = 65536;
+const auto g_timeout = std::chrono::milliseconds(1000);
+
+uint64_t // NOLINT(build/unsigned)
+now_ns()
+{
+  // steady_clock is CLOCK_MONOTONIC, the same in both processes
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+
+// sends n_events events; at rate [Hz], or as fast as the transport takes them if rate is 0
+template<class Send>
+void
+produce(Send&& send, uint64_t n_events, double rate) // NOLINT(build/unsigned)
+{
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < n_events; ++i) { // NOLINT(build/unsigned)
+    if (rate > 0)
+      std::this_thread::sleep_until(start + std::chrono::nanoseconds(static_cast<int64_t>(i * 1.e9 / rate)));
+    // the timestamp carries the send time, for the latency measured by the consumer
+    send(dfmessages::HSIEvent(0x1, 0x1, now_ns(), i, 1));
+  }
+}
+
+// receives events until the last one, returns false on a gap or a timeout
+template<class Receive>
+bool
+consume(Receive&& receive, uint64_t n_events, const std::string& label) // NOLINT(build/unsigned)
+{
+  LatencyHistogram latency;
+  dfmessages::HSIEvent event;
+  uint64_t first_ns = 0; // NOLINT(build/unsigned)
+  for (uint64_t i = 0; i < n_events; ++i) { // NOLINT(build/unsigned)
+    if (!receive(event) || event.sequence_counter != static_cast<uint32_t>(i)) { // NOLINT(build/unsigned)
+      TLOG() << label << ": lost event " << i;
+      return false;
+    }
+    uint64_t received_ns = now_ns(); // NOLINT(build/unsigned)
+    if (i == 0)
+      first_ns = received_ns;
+    latency.record(received_ns - event.timestamp);
+  }
+
+  double elapsed = (now_ns() - first_ns) / 1.e9;
+  auto summary = latency.read();
+  TLOG() << label << ": " << n_events / elapsed / 1.e6 << " Mevents/s, latency p50 " << summary.p50 / 1000.
+         << " us, p99 " << summary.p99 / 1000. << " us, max " << summary.max / 1000. << " us";
+  return true;
+}
+
+bool
+write_all(int fd, const void* data, size_t size)
+{
+  auto bytes = static_cast<const char*>(data);
+  while (size) {
+    auto written = ::write(fd, bytes, size);
+    if (written <= 0)
+      return false;
+    bytes += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool
+read_all(int fd, void* data, size_t size)
+{
+  auto bytes = static_cast<char*>(data);
+  while (size) {
+    auto n_read = ::read(fd, bytes, size);
+    if (n_read <= 0)
+      return false;
+    bytes += n_read;
+    size -= n_read;
+  }
+  return true;
+}
+
+// runs consumer in a child process and producer in this one, returns whether both succeeded
+template<class Producer, class Consumer>
+bool
+run_forked(Producer&& producer, Consumer&& consumer)
+{
+  pid_t pid = ::fork();
+  if (pid < 0)
+    return false;
+  if (pid == 0)
+    std::_Exit(consumer() ? 0 : 1);
+
+  producer();
+  int status = 0;
+  ::waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+bool
+run_shm(uint64_t n_events, double rate, const std::string& label) // NOLINT(build/unsigned)
+{
+  std::string name = "/hsilibs_test_shm_transport_" + std::to_string(getpid());
+  // created before the fork and removed once both sides are done
+  ShmRingSender<dfmessages::HSIEvent> sender(name, g_ring_capacity);
+
+  return run_forked(
+    [&] {
+      produce([&](dfmessages::HSIEvent&& event) { sender.send(std::move(event), g_timeout); }, n_events, rate);
+    },
+    [&] {
+      ShmRingReceiver<dfmessages::HSIEvent> receiver(name, g_ring_capacity);
+      auto receive = [&](dfmessages::HSIEvent& event) {
+        if (!receiver.front() && !receiver.wait(g_timeout))
+          return false;
+        event = *receiver.front();
+        receiver.pop();
+        return true;
+      };
+      return consume(receive, n_events, label);
+    });
+}
+
+bool
+run_serialised(uint64_t n_events, double rate, const std::string& label) // NOLINT(build/unsigned)
+{
+  int fds[2];
+  if (::pipe(fds) != 0)
+    return false;
+
+  bool ok = run_forked(
+    [&] {
+      ::close(fds[0]);
+      auto send = [&](dfmessages::HSIEvent&& event) {
+        auto bytes = serialization::serialize(event, serialization::kMsgPack);
+        uint32_t size = bytes.size(); // NOLINT(build/unsigned)
+        write_all(fds[1], &size, sizeof(size));
+        write_all(fds[1], bytes.data(), bytes.size());
+      };
+      produce(send, n_events, rate);
+      ::close(fds[1]);
+    },
+    [&] {
+      ::close(fds[1]);
+      std::vector<uint8_t> bytes; // NOLINT(build/unsigned)
+      auto receive = [&](dfmessages::HSIEvent& event) {
+        uint32_t size = 0; // NOLINT(build/unsigned)
+        if (!read_all(fds[0], &size, sizeof(size)))
+          return false;
+        bytes.resize(size);
+        if (!read_all(fds[0], bytes.data(), size))
+          return false;
+        event = serialization::deserialize<dfmessages::HSIEvent>(bytes);
+        return true;
+      };
+      return consume(receive, n_events, label);
+    });
+  ::close(fds[0]);
+  return ok;
+}
+
+} // namespace
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t n_events = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000; // NOLINT(build/unsigned)
+  // paced well below the throughput of either transport, so that the latency is not queueing
+  const double paced_rate = 100000;
+  uint64_t n_paced_events = std::min<uint64_t>(n_events, paced_rate * 2); // NOLINT(build/unsigned)
+
+  TLOG() << "Sending " << n_events << " HSIEvents to another process as fast as possible, then " << n_paced_events
+         << " at " << paced_rate / 1000. << " kHz";
+
+  bool ok = true;
+  ok &= run_shm(n_events, 0, "shm ring, unpaced");
+  ok &= run_serialised(n_events, 0, "msgpack over a pipe, unpaced");
+  ok &= run_shm(n_paced_events, paced_rate, "shm ring, paced");
+  ok &= run_serialised(n_paced_events, paced_rate, "msgpack over a pipe, paced");
+
+  return ok ? 0 : 1;
+}
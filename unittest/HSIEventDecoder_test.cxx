@@ -0,0 +1,166 @@
+/**
+ * @file HSIEventDecoder_test.cxx HSI buffer batch decoder unit tests
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/HSIEventDecoder.hpp"
+
+#define BOOST_TEST_MODULE HSIEventDecoder_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+enum class EventKind
+{
+  valid,
+  corrupt_header,
+  zero_timestamp,
+  high_timestamp_only
+};
+
+// n_events buffer events of random kinds, followed by n_trailing words of an incomplete event
+std::vector<uint32_t> // NOLINT(build/unsigned)
+make_buffer(std::size_t n_events, std::size_t n_trailing, std::vector<EventKind>& kinds, uint32_t seed) // NOLINT
+{
+  std::mt19937 rng(seed);
+  std::uniform_int_distribution<uint32_t> word(0, 0xffffffff);      // NOLINT(build/unsigned)
+  std::uniform_int_distribution<uint32_t> kind(0, 3);               // NOLINT(build/unsigned)
+  std::uniform_int_distribution<uint32_t> corrupt_id(0, 0xffff - 1); // NOLINT(build/unsigned)
+
+  std::vector<uint32_t> words; // NOLINT(build/unsigned)
+  kinds.clear();
+  for (std::size_t i = 0; i < n_events; ++i) {
+    kinds.push_back(static_cast<EventKind>(kind(rng)));
+
+    uint32_t device_id = HSI_BUFFER_EVENT_HEADER_MARKER; // NOLINT(build/unsigned)
+    if (kinds.back() == EventKind::corrupt_header) {
+      device_id = corrupt_id(rng);
+      if (device_id >= HSI_BUFFER_EVENT_HEADER_MARKER)
+        ++device_id;
+    }
+    uint32_t ts_low = word(rng) | 0x1; // NOLINT(build/unsigned)
+    uint32_t ts_high = word(rng);      // NOLINT(build/unsigned)
+    if (kinds.back() == EventKind::zero_timestamp) {
+      ts_low = 0;
+      ts_high = 0;
+    } else if (kinds.back() == EventKind::high_timestamp_only) {
+      ts_low = 0;
+      ts_high |= 0x1;
+    }
+
+    words.push_back((device_id << 16) | (i & 0xffff));
+    words.push_back(ts_low);
+    words.push_back(ts_high);
+    words.push_back(word(rng));
+    words.push_back(word(rng));
+  }
+  for (std::size_t i = 0; i < n_trailing; ++i)
+    words.push_back(word(rng));
+  return words;
+}
+
+void
+check_event(const std::vector<uint32_t>& words, const HSIDecodedEvents& events, std::size_t i, EventKind kind) // NOLINT
+{
+  const uint32_t* event = words.data() + i * HSI_BUFFER_EVENT_SIZE; // NOLINT(build/unsigned)
+  BOOST_REQUIRE_EQUAL(events.header(i), event[0]);
+  BOOST_REQUIRE_EQUAL(events.device_ids[i], event[0] >> 16);
+  BOOST_REQUIRE_EQUAL(events.counters[i], event[0] & 0xffff);
+  BOOST_REQUIRE_EQUAL(events.timestamps[i], event[1] | (static_cast<uint64_t>(event[2]) << 32)); // NOLINT
+  BOOST_REQUIRE_EQUAL(events.data[i], event[3]);
+  BOOST_REQUIRE_EQUAL(events.triggers[i], event[4]);
+  BOOST_REQUIRE_EQUAL(events.is_valid(i), kind == EventKind::valid || kind == EventKind::high_timestamp_only);
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(HSIEventDecoder_test)
+
+BOOST_AUTO_TEST_CASE(ScalarDecoding)
+{
+  std::vector<EventKind> kinds;
+  auto words = make_buffer(100, 3, kinds, 1);
+
+  HSIDecodedEvents events;
+  BOOST_REQUIRE_EQUAL(decode_hsi_events_scalar(words.data(), words.size(), events), 100);
+  BOOST_REQUIRE_EQUAL(events.size, 100);
+
+  std::size_t n_valid = 0;
+  for (std::size_t i = 0; i < kinds.size(); ++i) {
+    check_event(words, events, i, kinds[i]);
+    n_valid += events.is_valid(i);
+  }
+  BOOST_REQUIRE_EQUAL(events.n_valid, n_valid);
+}
+
+// decode_hsi_events takes the AVX2 path on CPUs that support it; it has to give the same
+// result as the scalar loop for batches that do and do not fill whole vectors
+BOOST_AUTO_TEST_CASE(DispatchedDecodingMatchesScalar)
+{
+#if defined(__x86_64__)
+  if (!__builtin_cpu_supports("avx2"))
+    BOOST_TEST_MESSAGE("No AVX2 on this CPU, decode_hsi_events uses the scalar loop as well");
+#endif
+
+  HSIDecodedEvents events;
+  HSIDecodedEvents reference;
+
+  uint32_t seed = 1; // NOLINT(build/unsigned)
+  for (std::size_t n_events : { 0, 1, 7, 8, 9, 15, 16, 63, 64, 65, 127, 128, 1003 }) {
+    for (std::size_t n_trailing : { 0, 4 }) {
+      std::vector<EventKind> kinds;
+      auto words = make_buffer(n_events, n_trailing, kinds, ++seed);
+
+      BOOST_TEST_CONTEXT("events " << n_events << ", trailing words " << n_trailing)
+      {
+        BOOST_REQUIRE_EQUAL(decode_hsi_events(words.data(), words.size(), events), n_events);
+        BOOST_REQUIRE_EQUAL(decode_hsi_events_scalar(words.data(), words.size(), reference), n_events);
+
+        BOOST_REQUIRE_EQUAL(events.size, reference.size);
+        BOOST_REQUIRE_EQUAL(events.n_valid, reference.n_valid);
+        BOOST_REQUIRE(events.timestamps == reference.timestamps);
+        BOOST_REQUIRE(events.device_ids == reference.device_ids);
+        BOOST_REQUIRE(events.counters == reference.counters);
+        BOOST_REQUIRE(events.data == reference.data);
+        BOOST_REQUIRE(events.triggers == reference.triggers);
+        BOOST_REQUIRE(events.valid_mask == reference.valid_mask);
+
+        for (std::size_t i = 0; i < n_events; ++i)
+          check_event(words, events, i, kinds[i]);
+      }
+    }
+  }
+}
+
+// the arrays are reused; a smaller batch must not keep validity bits of a larger one
+BOOST_AUTO_TEST_CASE(ReusedEvents)
+{
+  std::vector<EventKind> kinds;
+  auto large = make_buffer(200, 0, kinds, 7);
+  HSIDecodedEvents events;
+  decode_hsi_events(large.data(), large.size(), events);
+
+  auto small = make_buffer(20, 0, kinds, 8);
+  BOOST_REQUIRE_EQUAL(decode_hsi_events(small.data(), small.size(), events), 20);
+
+  std::size_t n_valid = 0;
+  for (std::size_t i = 0; i < kinds.size(); ++i) {
+    check_event(small, events, i, kinds[i]);
+    n_valid += events.is_valid(i);
+  }
+  BOOST_REQUIRE_EQUAL(events.n_valid, n_valid);
+  BOOST_REQUIRE_EQUAL(events.valid_mask.size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,312 @@
+/**
+ * @file HSIEventSender_test.cxx Send paths of HSIEventSender and their allocation counts
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/HSIEventSender.hpp"
+
+#define BOOST_TEST_MODULE HSIEventSender_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace {
+std::atomic<size_t> g_allocations{ 0 };
+} // namespace
+
+// counts every allocation of the test process; array and nothrow forms end up here too
+void*
+operator new(std::size_t size)
+{
+  ++g_allocations;
+  if (void* ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void
+operator delete(void* ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void
+operator delete(void* ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
+using namespace dunedaq;
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+// exposes the send path of HSIEventSender
+class SendPathTestModule : public HSIEventSender
+{
+public:
+  explicit SendPathTestModule(const std::string& name)
+    : HSIEventSender(name)
+  {}
+
+  void init(const nlohmann::json&) override {}
+
+  using HSIEventSender::configure_outputs;
+  using HSIEventSender::fill_hsi_frame;
+  using HSIEventSender::m_hsievent_batch_sender;
+  using HSIEventSender::m_hsievent_sender;
+  using HSIEventSender::m_last_sent_timestamp;
+  using HSIEventSender::m_raw_hsi_chunk_sender;
+  using HSIEventSender::m_sent_counter;
+  using HSIEventSender::send_hsi_event;
+  using HSIEventSender::send_hsi_events;
+  using HSIEventSender::send_raw_hsi_frames;
+  using HSIEventSender::start_outputs;
+
+private:
+  void do_configure(const nlohmann::json&) override {}
+  void do_start(const nlohmann::json&) override {}
+  void do_stop(const nlohmann::json&) override {}
+  void do_scrap(const nlohmann::json&) override {}
+};
+
+const size_t s_ring_capacity = 4096;
+
+hsieventsender::OutputPolicy
+shm_policy(const std::string& name)
+{
+  hsieventsender::OutputPolicy policy;
+  policy.transport = hsieventsender::Transport::shm;
+  policy.shm_name = "/hsilibs_HSIEventSender_test_" + std::to_string(getpid()) + "_" + name;
+  policy.shm_capacity = s_ring_capacity;
+  return policy;
+}
+
+// an iomanager sender that keeps everything it is sent
+template<class T>
+class CountingSender : public iomanager::SenderConcept<T>
+{
+public:
+  CountingSender()
+    : iomanager::SenderConcept<T>(iomanager::ConnectionId{ "counting_sender", datatype_to_string<T>() })
+  {}
+
+  void send(T&& data, iomanager::Sender::timeout_t) override { items.push_back(std::move(data)); }
+
+  bool try_send(T&& data, iomanager::Sender::timeout_t timeout) override
+  {
+    send(std::move(data), timeout);
+    return true;
+  }
+
+  void send_with_topic(T&& data, iomanager::Sender::timeout_t timeout, std::string) override
+  {
+    send(std::move(data), timeout);
+  }
+
+  std::vector<T> items;
+};
+
+// both outputs use the shm transport: its sender copies items into the ring in place, so
+// any allocation counted comes from hsilibs itself
+struct SendPathFixture
+{
+  SendPathFixture()
+    : hsievent_policy(shm_policy("hsievent"))
+    , raw_policy(shm_policy("raw"))
+    , module("test_sender")
+  {
+    module.configure_outputs(hsievent_policy, raw_policy);
+    module.start_outputs(1);
+  }
+
+  hsieventsender::OutputPolicy hsievent_policy;
+  hsieventsender::OutputPolicy raw_policy;
+  SendPathTestModule module;
+};
+
+std::vector<dfmessages::HSIEvent>
+make_events(size_t n_events)
+{
+  std::vector<dfmessages::HSIEvent> events;
+  for (size_t i = 0; i < n_events; ++i)
+    events.emplace_back(0x1, 0x5, 1000 + 100 * i, i, 1);
+  return events;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(HSIEventSender_test)
+
+BOOST_FIXTURE_TEST_CASE(SendHSIEventDoesNotAllocate, SendPathFixture)
+{
+  ShmRingReceiver<dfmessages::HSIEvent> receiver(hsievent_policy.shm_name, hsievent_policy.shm_capacity);
+
+  const size_t n_events = 1000;
+  dfmessages::HSIEvent event(0x1, 0x5, 1000, 0, 1);
+
+  // the first send may initialise things lazily
+  module.send_hsi_event(event);
+  receiver.pop();
+
+  size_t allocations_before = g_allocations.load();
+  for (size_t i = 0; i < n_events; ++i) {
+    event.timestamp += 100;
+    event.sequence_counter = i + 1;
+    module.send_hsi_event(event);
+  }
+  size_t allocations = g_allocations.load() - allocations_before;
+
+  BOOST_REQUIRE_EQUAL(allocations, 0);
+  BOOST_REQUIRE_EQUAL(module.m_sent_counter.load(), n_events + 1);
+
+  for (size_t i = 0; i < n_events; ++i) {
+    const dfmessages::HSIEvent* received = receiver.front();
+    BOOST_REQUIRE(received != nullptr);
+    BOOST_REQUIRE_EQUAL(received->sequence_counter, i + 1);
+    BOOST_REQUIRE_EQUAL(received->timestamp, 1000 + 100 * (i + 1));
+    receiver.pop();
+  }
+  BOOST_REQUIRE(receiver.front() == nullptr);
+}
+
+BOOST_FIXTURE_TEST_CASE(SendRawHSIFramesDoesNotAllocate, SendPathFixture)
+{
+  ShmRingReceiver<HSI_FRAME_STRUCT> receiver(raw_policy.shm_name, raw_policy.shm_capacity);
+
+  const size_t n_polls = 32;
+  const size_t n_frames = 256;
+  std::vector<HSI_FRAME_STRUCT> frames(n_frames);
+
+  HSI_FRAME_STRUCT first;
+  SendPathTestModule::fill_hsi_frame(first, 0, 1000, 0x5, 0x5, 0);
+  module.send_raw_hsi_frames(&first, 1);
+  receiver.pop();
+
+  size_t allocations = 0;
+  for (size_t poll = 0; poll < n_polls; ++poll) {
+    for (size_t i = 0; i < n_frames; ++i) {
+      uint32_t counter = poll * n_frames + i + 1; // NOLINT(build/unsigned)
+      SendPathTestModule::fill_hsi_frame(frames[i], 0, 1000 + 100 * counter, 0x5, 0x5, counter);
+    }
+
+    size_t allocations_before = g_allocations.load();
+    module.send_raw_hsi_frames(frames.data(), n_frames);
+    allocations += g_allocations.load() - allocations_before;
+
+    // read in step with the sender, the ring does not hold all polls
+    for (size_t i = 0; i < n_frames; ++i) {
+      const HSI_FRAME_STRUCT* received = receiver.front();
+      BOOST_REQUIRE(received != nullptr);
+      BOOST_REQUIRE_EQUAL(received->frame.sequence, poll * n_frames + i + 1);
+      BOOST_REQUIRE_EQUAL(received->get_first_timestamp(), 1000 + 100 * (poll * n_frames + i + 1));
+      receiver.pop();
+    }
+  }
+
+  BOOST_REQUIRE_EQUAL(allocations, 0);
+  BOOST_REQUIRE(receiver.front() == nullptr);
+}
+
+// a connection with the HSIEvent data type gets one message per event, through the OutputChannel
+BOOST_AUTO_TEST_CASE(SendHSIEventsOneByOne)
+{
+  SendPathTestModule module("test_sender");
+  auto sender = std::make_shared<CountingSender<dfmessages::HSIEvent>>();
+  module.m_hsievent_sender = sender;
+  module.configure_outputs(hsieventsender::OutputPolicy(), hsieventsender::OutputPolicy());
+  module.start_outputs(1);
+
+  auto events = make_events(10);
+  BOOST_REQUIRE(module.send_hsi_event(events[0]));
+  bool sent[9] = {};
+  module.send_hsi_events(events.data() + 1, 9, sent);
+
+  BOOST_REQUIRE(std::all_of(std::begin(sent), std::end(sent), [](bool event_sent) { return event_sent; }));
+  BOOST_REQUIRE_EQUAL(sender->items.size(), events.size());
+  for (size_t i = 0; i < events.size(); ++i) {
+    BOOST_REQUIRE_EQUAL(sender->items[i].sequence_counter, events[i].sequence_counter);
+    BOOST_REQUIRE_EQUAL(sender->items[i].timestamp, events[i].timestamp);
+  }
+  BOOST_REQUIRE_EQUAL(module.m_sent_counter.load(), events.size());
+  BOOST_REQUIRE_EQUAL(module.m_last_sent_timestamp.load(), events.back().timestamp);
+}
+
+// a connection with the HSIEventBatch data type gets the events in batches of up to batch_size
+BOOST_AUTO_TEST_CASE(SendHSIEventBatches)
+{
+  SendPathTestModule module("test_sender");
+  auto sender = std::make_shared<CountingSender<HSIEventBatch>>();
+  module.m_hsievent_batch_sender = sender;
+  hsieventsender::OutputPolicy policy;
+  policy.batch_size = 4;
+  module.configure_outputs(policy, hsieventsender::OutputPolicy());
+  module.start_outputs(1);
+
+  auto events = make_events(11);
+  bool sent[10] = {};
+  module.send_hsi_events(events.data(), 10, sent);
+  // a single event is a batch of its own
+  BOOST_REQUIRE(module.send_hsi_event(events[10]));
+
+  BOOST_REQUIRE(std::all_of(std::begin(sent), std::end(sent), [](bool event_sent) { return event_sent; }));
+  const std::vector<size_t> batch_sizes = { 4, 4, 2, 1 };
+  BOOST_REQUIRE_EQUAL(sender->items.size(), batch_sizes.size());
+  size_t n_events = 0;
+  for (size_t batch = 0; batch < batch_sizes.size(); ++batch) {
+    BOOST_REQUIRE_EQUAL(sender->items[batch].events.size(), batch_sizes[batch]);
+    for (auto& event : sender->items[batch].events) {
+      BOOST_REQUIRE_EQUAL(event.sequence_counter, events[n_events].sequence_counter);
+      BOOST_REQUIRE_EQUAL(event.timestamp, events[n_events].timestamp);
+      ++n_events;
+    }
+  }
+  BOOST_REQUIRE_EQUAL(module.m_sent_counter.load(), events.size());
+  BOOST_REQUIRE_EQUAL(module.m_last_sent_timestamp.load(), events.back().timestamp);
+}
+
+// a connection with the HSISuperChunk data type gets the frames packed in full superchunks
+BOOST_AUTO_TEST_CASE(SendRawHSIFramesInSuperChunks)
+{
+  SendPathTestModule module("test_sender");
+  auto sender = std::make_shared<CountingSender<HSI_SUPERCHUNK_STRUCT>>();
+  module.m_raw_hsi_chunk_sender = sender;
+  module.configure_outputs(hsieventsender::OutputPolicy(), hsieventsender::OutputPolicy());
+  module.start_outputs(1);
+
+  const size_t n_frames = 2 * HSI_SUPERCHUNK_MAX_FRAMES + 3;
+  std::vector<HSI_FRAME_STRUCT> frames(n_frames);
+  for (size_t i = 0; i < n_frames; ++i)
+    SendPathTestModule::fill_hsi_frame(frames[i], 0, 1000 + 100 * i, 0x5, 0x5, i);
+  module.send_raw_hsi_frames(frames.data(), n_frames);
+
+  const std::vector<size_t> chunk_sizes = { HSI_SUPERCHUNK_MAX_FRAMES, HSI_SUPERCHUNK_MAX_FRAMES, 3 };
+  BOOST_REQUIRE_EQUAL(sender->items.size(), chunk_sizes.size());
+  size_t n_sent_frames = 0;
+  for (size_t chunk = 0; chunk < chunk_sizes.size(); ++chunk) {
+    auto& superchunk = sender->items[chunk];
+    BOOST_REQUIRE_EQUAL(superchunk.n_frames, chunk_sizes[chunk]);
+    for (size_t i = 0; i < superchunk.n_frames; ++i) {
+      BOOST_REQUIRE_EQUAL(superchunk.frames[i].sequence, n_sent_frames);
+      BOOST_REQUIRE_EQUAL(superchunk.frames[i].get_timestamp(), frames[n_sent_frames].get_timestamp());
+      ++n_sent_frames;
+    }
+  }
+  // raw data is not counted in the HSIEvent statistics
+  BOOST_REQUIRE_EQUAL(module.m_sent_counter.load(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
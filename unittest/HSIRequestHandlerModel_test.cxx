@@ -0,0 +1,125 @@
+/**
+ * @file HSIRequestHandlerModel_test.cxx Request windows over HSI superchunks
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "../src/HSIRequestHandlerModel.hpp"
+#include "../src/TimeBucketLatencyBufferModel.hpp"
+
+#define BOOST_TEST_MODULE HSIRequestHandlerModel_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+using namespace dunedaq;
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+using chunk_buffer_t = TimeBucketLatencyBufferModel<HSI_SUPERCHUNK_STRUCT>;
+
+HSI_SUPERCHUNK_STRUCT
+make_chunk(const std::vector<uint64_t>& timestamps) // NOLINT(build/unsigned)
+{
+  HSI_SUPERCHUNK_STRUCT chunk;
+  for (auto ts : timestamps) {
+    HSI_FRAME_STRUCT frame{};
+    frame.set_first_timestamp(ts);
+    chunk.add_frame(frame);
+  }
+  return chunk;
+}
+
+std::vector<uint64_t> // NOLINT(build/unsigned)
+window_timestamps(chunk_buffer_t& buffer, uint64_t window_begin, uint64_t window_end) // NOLINT(build/unsigned)
+{
+  std::vector<uint64_t> timestamps; // NOLINT(build/unsigned)
+  for (auto& piece : get_window_frame_pieces<HSI_SUPERCHUNK_STRUCT>(buffer, window_begin, window_end)) {
+    BOOST_REQUIRE_EQUAL(piece.second, HSI_FRAME_STRUCT_SIZE);
+    timestamps.push_back(static_cast<const detdataformats::HSIFrame*>(piece.first)->get_timestamp());
+  }
+  return timestamps;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(HSIRequestHandlerModel_test)
+
+BOOST_AUTO_TEST_CASE(ChunksStraddlingTheWindowEdges)
+{
+  // buckets of 16 ticks, so that chunks span several of them
+  chunk_buffer_t buffer(4);
+  buffer.allocate_memory(100);
+  buffer.write(make_chunk({ 100, 110, 120, 130 }));
+  buffer.write(make_chunk({ 140, 150 }));
+  buffer.write(make_chunk({ 160, 170, 180, 190, 200 }));
+  buffer.write(make_chunk({ 300 }));
+
+  using ts_t = std::vector<uint64_t>; // NOLINT(build/unsigned)
+
+  // the first chunk starts before the window, the third one ends after it
+  BOOST_TEST(window_timestamps(buffer, 115, 175) == ts_t({ 120, 130, 140, 150, 160, 170 }));
+  // window inside a single chunk
+  BOOST_TEST(window_timestamps(buffer, 165, 185) == ts_t({ 170, 180 }));
+  // the end of the window is excluded, its start included
+  BOOST_TEST(window_timestamps(buffer, 120, 160) == ts_t({ 120, 130, 140, 150 }));
+  // windows between frames or chunks
+  BOOST_TEST(window_timestamps(buffer, 121, 129).empty());
+  BOOST_TEST(window_timestamps(buffer, 201, 300).empty());
+  // windows around and outside the buffered range
+  BOOST_TEST(window_timestamps(buffer, 0, 1000) ==
+             ts_t({ 100, 110, 120, 130, 140, 150, 160, 170, 180, 190, 200, 300 }));
+  BOOST_TEST(window_timestamps(buffer, 0, 100).empty());
+  BOOST_TEST(window_timestamps(buffer, 301, 1000).empty());
+
+  // the buffer finds a chunk that starts before a timestamp but reaches it
+  HSI_SUPERCHUNK_STRUCT search;
+  search.set_first_timestamp(195);
+  auto it = buffer.lower_bound(search);
+  BOOST_REQUIRE(it.good());
+  BOOST_REQUIRE_EQUAL(it->get_first_timestamp(), 160);
+}
+
+BOOST_AUTO_TEST_CASE(RandomWindowsMatchAllFrames)
+{
+  std::mt19937_64 rng(3);
+  chunk_buffer_t buffer(6);
+  buffer.allocate_memory(100000);
+
+  // chunks of 1 to 32 frames, as polls release them
+  std::vector<uint64_t> all_frames; // NOLINT(build/unsigned)
+  uint64_t ts = 1000;               // NOLINT(build/unsigned)
+  for (size_t i = 0; i < 2000; ++i) {
+    std::vector<uint64_t> chunk_frames(1 + rng() % HSI_SUPERCHUNK_MAX_FRAMES); // NOLINT(build/unsigned)
+    for (auto& frame_ts : chunk_frames) {
+      ts += rng() % 50;
+      frame_ts = ts;
+      all_frames.push_back(ts);
+    }
+    ts += rng() % 500;
+    buffer.write(make_chunk(chunk_frames));
+  }
+
+  for (size_t i = 0; i < 2000; ++i) {
+    uint64_t window_begin = 900 + rng() % (ts - 800); // NOLINT(build/unsigned)
+    uint64_t window_end = window_begin + rng() % 2000; // NOLINT(build/unsigned)
+
+    std::vector<uint64_t> expected; // NOLINT(build/unsigned)
+    for (auto frame_ts : all_frames)
+      if (frame_ts >= window_begin && frame_ts < window_end)
+        expected.push_back(frame_ts);
+
+    BOOST_TEST_CONTEXT("window " << window_begin << " to " << window_end)
+    {
+      BOOST_REQUIRE(window_timestamps(buffer, window_begin, window_end) == expected);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,247 @@
+/**
+ * @file ShmRing_test.cxx ShmRing class unit tests
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/ShmRing.hpp"
+
+#define BOOST_TEST_MODULE ShmRing_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+struct Record
+{
+  uint64_t sequence; // NOLINT(build/unsigned)
+  uint32_t payload;  // NOLINT(build/unsigned)
+};
+
+std::string
+ring_name(const std::string& test)
+{
+  return "/hsilibs_ShmRing_test_" + std::to_string(getpid()) + "_" + test;
+}
+
+bool
+push(ShmRing& ring, uint64_t sequence) // NOLINT(build/unsigned)
+{
+  void* slot = ring.claim();
+  if (!slot)
+    return false;
+  Record record{ sequence, static_cast<uint32_t>(sequence * 3) }; // NOLINT(build/unsigned)
+  std::memcpy(slot, &record, sizeof(record));
+  ring.commit();
+  return true;
+}
+
+// sequence number of the front record, which is popped
+uint64_t // NOLINT(build/unsigned)
+pop(ShmRing& ring)
+{
+  Record record;
+  std::memcpy(&record, ring.front(), sizeof(record));
+  ring.pop_front();
+  BOOST_REQUIRE_EQUAL(record.payload, static_cast<uint32_t>(record.sequence * 3)); // NOLINT(build/unsigned)
+  return record.sequence;
+}
+
+const auto s_timeout = std::chrono::milliseconds(20);
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(ShmRing_test)
+
+BOOST_AUTO_TEST_CASE(EmptyWaitTimesOut)
+{
+  ShmRing ring(ring_name("empty"), sizeof(Record), 8);
+  ring.remove_on_close();
+
+  BOOST_REQUIRE(ring.empty());
+  BOOST_REQUIRE(ring.front() == nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  BOOST_REQUIRE(!ring.wait_for_data(s_timeout));
+  BOOST_REQUIRE(std::chrono::steady_clock::now() - start >= s_timeout);
+
+  // popping an empty ring does nothing
+  ring.pop_front();
+  BOOST_REQUIRE_EQUAL(ring.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(FullWaitTimesOut)
+{
+  const size_t capacity = 8;
+  ShmRing ring(ring_name("full"), sizeof(Record), capacity);
+  ring.remove_on_close();
+
+  for (uint64_t i = 0; i < capacity; ++i) // NOLINT(build/unsigned)
+    BOOST_REQUIRE(push(ring, i));
+  BOOST_REQUIRE_EQUAL(ring.size(), capacity);
+  BOOST_REQUIRE(ring.claim() == nullptr);
+
+  auto start = std::chrono::steady_clock::now();
+  BOOST_REQUIRE(!ring.wait_for_space(s_timeout));
+  BOOST_REQUIRE(std::chrono::steady_clock::now() - start >= s_timeout);
+
+  // data is there straight away
+  BOOST_REQUIRE(ring.wait_for_data(s_timeout));
+  BOOST_REQUIRE_EQUAL(pop(ring), 0);
+  BOOST_REQUIRE(ring.wait_for_space(s_timeout));
+  BOOST_REQUIRE(push(ring, capacity));
+}
+
+BOOST_AUTO_TEST_CASE(SenderThrowsWhenFull)
+{
+  const size_t capacity = 4;
+  ShmRingSender<Record> sender(ring_name("sender"), capacity);
+  ShmRingReceiver<Record> receiver(ring_name("sender"), capacity);
+
+  for (uint64_t i = 0; i < capacity; ++i) // NOLINT(build/unsigned)
+    sender.send(Record{ i, 0 }, s_timeout);
+  BOOST_REQUIRE_THROW(sender.send(Record{ capacity, 0 }, s_timeout), ShmRingTimeout);
+
+  BOOST_REQUIRE_EQUAL(receiver.front()->sequence, 0);
+  receiver.pop();
+  BOOST_REQUIRE_NO_THROW(sender.send(Record{ capacity, 0 }, s_timeout));
+  BOOST_REQUIRE_EQUAL(receiver.get_ring().size(), capacity);
+}
+
+BOOST_AUTO_TEST_CASE(ReceiverDiscardsLeftovers)
+{
+  const size_t capacity = 4;
+  ShmRingSender<Record> sender(ring_name("discard"), capacity);
+  ShmRingReceiver<Record> receiver(ring_name("discard"), capacity);
+
+  BOOST_REQUIRE_EQUAL(receiver.discard(), 0);
+  for (uint64_t i = 0; i < capacity; ++i) // NOLINT(build/unsigned)
+    sender.send(Record{ i, 0 }, s_timeout);
+  BOOST_REQUIRE_EQUAL(receiver.discard(), capacity);
+  BOOST_REQUIRE(receiver.front() == nullptr);
+
+  // the ring is usable as before
+  sender.send(Record{ capacity, 0 }, s_timeout);
+  BOOST_REQUIRE_EQUAL(receiver.front()->sequence, capacity);
+}
+
+BOOST_AUTO_TEST_CASE(WaitsAreWokenUp)
+{
+  const size_t capacity = 4;
+  const auto long_timeout = std::chrono::seconds(10);
+  ShmRing producer(ring_name("wake"), sizeof(Record), capacity);
+  producer.remove_on_close();
+  ShmRing consumer(ring_name("wake"), sizeof(Record), capacity);
+
+  // consumer sleeping on an empty ring
+  auto start = std::chrono::steady_clock::now();
+  std::thread commit_later([&] {
+    std::this_thread::sleep_for(s_timeout);
+    push(producer, 0);
+  });
+  BOOST_REQUIRE(consumer.wait_for_data(long_timeout));
+  commit_later.join();
+  BOOST_REQUIRE(std::chrono::steady_clock::now() - start < long_timeout / 2);
+  BOOST_REQUIRE_EQUAL(pop(consumer), 0);
+
+  // producer sleeping on a full ring
+  for (uint64_t i = 1; i <= capacity; ++i) // NOLINT(build/unsigned)
+    BOOST_REQUIRE(push(producer, i));
+  start = std::chrono::steady_clock::now();
+  std::thread pop_later([&] {
+    std::this_thread::sleep_for(s_timeout);
+    consumer.pop_front();
+  });
+  BOOST_REQUIRE(producer.wait_for_space(long_timeout));
+  pop_later.join();
+  BOOST_REQUIRE(std::chrono::steady_clock::now() - start < long_timeout / 2);
+}
+
+BOOST_AUTO_TEST_CASE(MismatchedGeometry)
+{
+  const std::string name = ring_name("geometry");
+  ShmRing ring(name, sizeof(Record), 16);
+  ring.remove_on_close();
+
+  // a different capacity changes the segment size
+  BOOST_REQUIRE_THROW(ShmRing(name, sizeof(Record), 32), ShmRingIssue);
+  // a different record size with the same slot size is caught by the header
+  BOOST_REQUIRE_THROW(ShmRing(name, sizeof(Record) - 4, 16), ShmRingIssue);
+  // a different record size and capacity that give the same segment size
+  BOOST_REQUIRE_THROW(ShmRing(name, 2 * sizeof(Record), 8), ShmRingIssue);
+
+  BOOST_REQUIRE_THROW(ShmRing(ring_name("zero"), sizeof(Record), 0), ShmRingIssue);
+
+  // the same geometry attaches to the ring and sees its records
+  BOOST_REQUIRE(push(ring, 42));
+  ShmRing attached(name, sizeof(Record), 16);
+  BOOST_REQUIRE_EQUAL(attached.size(), 1);
+  BOOST_REQUIRE_EQUAL(pop(attached), 42);
+  BOOST_REQUIRE(ring.empty());
+}
+
+BOOST_AUTO_TEST_CASE(InOrderAcrossWrapAround)
+{
+  // a capacity that does not divide the sequence numbers evenly
+  const size_t capacity = 7;
+  ShmRing ring(ring_name("wrap"), sizeof(Record), capacity);
+  ring.remove_on_close();
+
+  uint64_t next_push = 0; // NOLINT(build/unsigned)
+  uint64_t next_pop = 0;  // NOLINT(build/unsigned)
+  for (size_t round = 0; round < 100; ++round) {
+    // fill up, then drain part of the ring, so the positions go round at every offset
+    while (push(ring, next_push))
+      ++next_push;
+    BOOST_REQUIRE_EQUAL(ring.size(), capacity);
+    for (size_t i = 0; i < round % capacity + 1; ++i)
+      BOOST_REQUIRE_EQUAL(pop(ring), next_pop++);
+  }
+  while (!ring.empty())
+    BOOST_REQUIRE_EQUAL(pop(ring), next_pop++);
+  BOOST_REQUIRE_EQUAL(next_pop, next_push);
+}
+
+BOOST_AUTO_TEST_CASE(InOrderAcrossThreads)
+{
+  const size_t capacity = 13;
+  const uint64_t n_records = 200000; // NOLINT(build/unsigned)
+  ShmRing producer(ring_name("threads"), sizeof(Record), capacity);
+  producer.remove_on_close();
+  ShmRing consumer(ring_name("threads"), sizeof(Record), capacity);
+
+  std::thread producer_thread([&] {
+    for (uint64_t i = 0; i < n_records; ++i) // NOLINT(build/unsigned)
+      while (!push(producer, i))
+        producer.wait_for_space(std::chrono::milliseconds(100));
+  });
+
+  uint64_t expected = 0; // NOLINT(build/unsigned)
+  bool in_order = true;
+  while (expected < n_records && consumer.wait_for_data(std::chrono::seconds(10))) {
+    Record record;
+    std::memcpy(&record, consumer.front(), sizeof(record));
+    consumer.pop_front();
+    in_order &= record.sequence == expected && record.payload == static_cast<uint32_t>(expected * 3); // NOLINT
+    ++expected;
+  }
+  producer_thread.join();
+
+  BOOST_REQUIRE(in_order);
+  BOOST_REQUIRE_EQUAL(expected, n_records);
+  BOOST_REQUIRE(consumer.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,199 @@
+/**
+ * @file SpillJournal_test.cxx SpillJournal class unit tests
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "hsilibs/SpillJournal.hpp"
+
+#include "hsilibs/Issues.hpp"
+
+#define BOOST_TEST_MODULE SpillJournal_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+struct Record
+{
+  uint64_t marker;   // NOLINT(build/unsigned)
+  uint64_t sequence; // NOLINT(build/unsigned)
+  uint32_t payload;  // NOLINT(build/unsigned)
+};
+
+// makes a record easy to find in the journal file
+const constexpr uint64_t s_marker = 0x5245434f52444d4b; // NOLINT(build/unsigned)
+
+Record
+make_record(uint64_t sequence) // NOLINT(build/unsigned)
+{
+  return Record{ s_marker, sequence, static_cast<uint32_t>(sequence * 7) }; // NOLINT(build/unsigned)
+}
+
+// sequence number of the front record, which has to be valid and is popped
+uint64_t // NOLINT(build/unsigned)
+pop_valid(SpillJournal& journal)
+{
+  bool valid = false;
+  Record record;
+  std::memcpy(&record, journal.front(valid), sizeof(record));
+  BOOST_REQUIRE(valid);
+  BOOST_REQUIRE_EQUAL(record.marker, s_marker);
+  BOOST_REQUIRE_EQUAL(record.payload, static_cast<uint32_t>(record.sequence * 7)); // NOLINT(build/unsigned)
+  journal.pop_front();
+  return record.sequence;
+}
+
+// removes the journal file when the test ends, whatever happens to the journals
+struct JournalFixture
+{
+  JournalFixture()
+    : path("/tmp/hsilibs_SpillJournal_test_" + std::to_string(getpid()) + ".journal")
+  {}
+  ~JournalFixture() { std::remove(path.c_str()); }
+
+  // flips a payload byte of the record with the given sequence number, as a torn write would leave it
+  void corrupt_record(uint64_t sequence) // NOLINT(build/unsigned)
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    std::vector<char> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Record record = make_record(sequence);
+    for (size_t offset = 0; offset + sizeof(record) <= content.size(); ++offset) {
+      if (std::memcmp(&content[offset], &record, offsetof(Record, payload)) == 0) {
+        file.seekp(offset + offsetof(Record, payload));
+        file.put(static_cast<char>(content[offset + offsetof(Record, payload)] ^ 0x1));
+        return;
+      }
+    }
+    BOOST_FAIL("record " << sequence << " not found in the journal file");
+  }
+
+  std::string path;
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_SUITE(SpillJournal_test, JournalFixture)
+
+BOOST_AUTO_TEST_CASE(RejectsTornRecord)
+{
+  {
+    SpillJournal journal(path, sizeof(Record), 8);
+    for (uint64_t i = 0; i < 3; ++i) { // NOLINT(build/unsigned)
+      Record record = make_record(i);
+      BOOST_REQUIRE(journal.append(&record));
+    }
+  }
+  corrupt_record(1);
+
+  SpillJournal journal(path);
+  BOOST_REQUIRE_EQUAL(journal.size(), 3);
+  BOOST_REQUIRE_EQUAL(pop_valid(journal), 0);
+
+  // the torn record fails its checksum but still takes its place in the order
+  bool valid = true;
+  BOOST_REQUIRE(journal.front(valid) != nullptr);
+  BOOST_REQUIRE(!valid);
+  journal.pop_front();
+
+  BOOST_REQUIRE_EQUAL(pop_valid(journal), 2);
+  BOOST_REQUIRE(journal.empty());
+  BOOST_REQUIRE(journal.front(valid) == nullptr);
+}
+
+BOOST_AUTO_TEST_CASE(InOrderAcrossWrapAround)
+{
+  const size_t capacity = 5;
+  SpillJournal journal(path, sizeof(Record), capacity);
+
+  uint64_t next_append = 0; // NOLINT(build/unsigned)
+  uint64_t next_pop = 0;    // NOLINT(build/unsigned)
+  for (size_t round = 0; round < 50; ++round) {
+    // fill up, then replay part of the journal, so the positions go round at every offset
+    Record record = make_record(next_append);
+    while (journal.append(&record))
+      record = make_record(++next_append);
+    BOOST_REQUIRE_EQUAL(journal.size(), capacity);
+
+    for (size_t i = 0; i < round % capacity + 1; ++i)
+      BOOST_REQUIRE_EQUAL(pop_valid(journal), next_pop++);
+  }
+  while (!journal.empty())
+    BOOST_REQUIRE_EQUAL(pop_valid(journal), next_pop++);
+  BOOST_REQUIRE_EQUAL(next_pop, next_append);
+
+  // popping an empty journal does nothing
+  journal.pop_front();
+  BOOST_REQUIRE_EQUAL(journal.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(ReplayOrderAfterRestart)
+{
+  const size_t capacity = 8;
+  {
+    // the journal has gone round once when the process stops
+    SpillJournal journal(path, sizeof(Record), capacity);
+    for (uint64_t i = 0; i < capacity; ++i) { // NOLINT(build/unsigned)
+      Record record = make_record(i);
+      BOOST_REQUIRE(journal.append(&record));
+    }
+    for (uint64_t i = 0; i < 5; ++i) // NOLINT(build/unsigned)
+      BOOST_REQUIRE_EQUAL(pop_valid(journal), i);
+    for (uint64_t i = capacity; i < capacity + 3; ++i) { // NOLINT(build/unsigned)
+      Record record = make_record(i);
+      BOOST_REQUIRE(journal.append(&record));
+    }
+  }
+
+  SpillJournal journal(path);
+  BOOST_REQUIRE_EQUAL(journal.size(), 6);
+
+  // the reopened journal takes appends after the records left in it
+  for (uint64_t i = capacity + 3; i < capacity + 5; ++i) { // NOLINT(build/unsigned)
+    Record record = make_record(i);
+    BOOST_REQUIRE(journal.append(&record));
+  }
+  Record record = make_record(capacity + 5);
+  BOOST_REQUIRE(!journal.append(&record));
+
+  for (uint64_t i = 5; i < capacity + 5; ++i) // NOLINT(build/unsigned)
+    BOOST_REQUIRE_EQUAL(pop_valid(journal), i);
+  BOOST_REQUIRE(journal.empty());
+}
+
+BOOST_AUTO_TEST_CASE(RejectsOtherFiles)
+{
+  BOOST_REQUIRE_THROW(SpillJournal{ path }, SpillJournalIssue);
+  BOOST_REQUIRE_THROW(SpillJournal(path, sizeof(Record), 0), SpillJournalIssue);
+
+  {
+    std::ofstream file(path, std::ios::binary);
+    file << "not a journal, although long enough to hold a journal header";
+  }
+  BOOST_REQUIRE_THROW(SpillJournal{ path }, SpillJournalIssue);
+
+  // a journal cut short
+  {
+    SpillJournal journal(path, sizeof(Record), 8);
+  }
+  BOOST_REQUIRE_EQUAL(::truncate(path.c_str(), 100), 0);
+  BOOST_REQUIRE_THROW(SpillJournal{ path }, SpillJournalIssue);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,184 @@
+/**
+ * @file TimeBucketLatencyBufferModel_test.cxx TimeBucketLatencyBufferModel class unit tests
+ *
+ * This is part of the DUNE DAQ Software Suite, copyright 2020.
+ * Licensing/copyright details are in the COPYING file that you should have
+ * received with this code.
+ */
+
+#include "../src/TimeBucketLatencyBufferModel.hpp"
+
+#define BOOST_TEST_MODULE TimeBucketLatencyBufferModel_test // NOLINT
+
+#include "boost/test/unit_test.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace dunedaq::hsilibs;
+
+namespace {
+
+struct TestElement
+{
+  uint64_t timestamp; // NOLINT(build/unsigned)
+  size_t id;
+
+  uint64_t get_first_timestamp() const { return timestamp; } // NOLINT(build/unsigned)
+  uint64_t get_last_timestamp() const { return timestamp; }  // NOLINT(build/unsigned)
+  void set_first_timestamp(uint64_t ts) { timestamp = ts; } // NOLINT(build/unsigned)
+  size_t get_num_frames() const { return 1; }
+};
+
+using buffer_t = TimeBucketLatencyBufferModel<TestElement>;
+
+// the buffer content in timestamp order; elements with equal timestamps stay in write order
+void
+reference_insert(std::deque<TestElement>& reference, const TestElement& element)
+{
+  auto position = std::upper_bound(
+    reference.begin(), reference.end(), element, [](const TestElement& a, const TestElement& b) {
+      return a.timestamp < b.timestamp;
+    });
+  reference.insert(position, element);
+}
+
+// the buffer gives the same first element not before ts as the reference, or end() if there is none
+void
+check_lower_bound(buffer_t& buffer, const std::deque<TestElement>& reference, uint64_t ts) // NOLINT
+{
+  TestElement probe{ ts, 0 };
+  auto it = buffer.lower_bound(probe);
+  auto expected = std::lower_bound(
+    reference.begin(), reference.end(), ts, [](const TestElement& a, uint64_t value) { // NOLINT(build/unsigned)
+      return a.timestamp < value;
+    });
+
+  BOOST_TEST_CONTEXT("timestamp " << ts)
+  {
+    if (expected == reference.end()) {
+      BOOST_REQUIRE(!it.good());
+      BOOST_REQUIRE(it == buffer.end());
+    } else {
+      BOOST_REQUIRE(it.good());
+      BOOST_REQUIRE_EQUAL(it->id, expected->id);
+    }
+  }
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(TimeBucketLatencyBufferModel_test)
+
+BOOST_AUTO_TEST_CASE(SearchMatchesStdLowerBound)
+{
+  std::mt19937_64 rng(1);
+  for (size_t n : { 0, 1, 2, 15, 16, 17, 31, 32, 33, 100, 1000, 4097 }) {
+    // few distinct values, so most of them are repeated
+    std::vector<uint64_t> timestamps(n); // NOLINT(build/unsigned)
+    uint64_t ts = 1000;                  // NOLINT(build/unsigned)
+    for (auto& element : timestamps) {
+      ts += rng() % 3 == 0;
+      element = ts;
+    }
+
+    const uint64_t* first = timestamps.data();     // NOLINT(build/unsigned)
+    const uint64_t* last = first + timestamps.size(); // NOLINT(build/unsigned)
+    for (uint64_t value = 0; value <= ts + 2; value = (value < 990 ? 990 : value + 1)) { // NOLINT(build/unsigned)
+      BOOST_TEST_CONTEXT("size " << n << ", value " << value)
+      {
+        BOOST_REQUIRE(timestamp_lower_bound(first, last, value) == std::lower_bound(first, last, value));
+      }
+    }
+    BOOST_REQUIRE(timestamp_lower_bound(first, last, std::numeric_limits<uint64_t>::max()) == last); // NOLINT
+  }
+}
+
+// the search within a bucket runs on its index, which pop_front compacts from time to time
+BOOST_AUTO_TEST_CASE(SearchAfterPopCompaction)
+{
+  // all elements in one bucket
+  buffer_t buffer(32);
+  buffer.allocate_memory(100000);
+  std::deque<TestElement> reference;
+
+  std::mt19937_64 rng(2);
+  size_t id = 0;
+  for (; id < 1000; ++id) {
+    TestElement element{ 100 + id / 3, id };
+    reference_insert(reference, element);
+    BOOST_REQUIRE(buffer.write(std::move(element)));
+  }
+
+  while (!reference.empty()) {
+    size_t n_pop = std::min<size_t>(7, reference.size());
+    buffer.pop(n_pop);
+    reference.erase(reference.begin(), reference.begin() + n_pop);
+
+    // keep writing, in order and late
+    if (id % 2 == 0 && !reference.empty()) {
+      TestElement element{ reference.back().timestamp + rng() % 2, id++ };
+      reference_insert(reference, element);
+      buffer.write(std::move(element));
+    } else if (reference.size() > 10) {
+      uint64_t span = reference.back().timestamp - reference.front().timestamp; // NOLINT(build/unsigned)
+      TestElement element{ reference.front().timestamp + rng() % (span + 1), id++ };
+      reference_insert(reference, element);
+      buffer.write(std::move(element));
+    } else {
+      ++id;
+    }
+
+    BOOST_REQUIRE_EQUAL(buffer.occupancy(), reference.size());
+    if (reference.empty())
+      break;
+    for (uint64_t ts = reference.front().timestamp - 1; ts <= reference.back().timestamp + 1; ++ts) // NOLINT
+      check_lower_bound(buffer, reference, ts);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(WindowsOutsideBufferedRange)
+{
+  // buckets of 16 ticks, with a long gap of empty ones in between
+  buffer_t buffer(4);
+  buffer.allocate_memory(1000);
+  std::deque<TestElement> reference;
+
+  TestElement probe{ 1000, 0 };
+  BOOST_REQUIRE(buffer.lower_bound(probe) == buffer.end());
+
+  size_t id = 0;
+  for (uint64_t ts : { 1000, 1010, 1010, 1020, 1100, 5000, 5000, 5007, 5100 }) { // NOLINT(build/unsigned)
+    TestElement element{ ts, id++ };
+    reference_insert(reference, element);
+    buffer.write(std::move(element));
+  }
+
+  for (uint64_t ts : { 0, 1, 999, 1000, 1001, 1010, 1011, 1099, 1100, 1101, 3000, 4999, 5000, 5001, 5099, 5100 }) // NOLINT
+    check_lower_bound(buffer, reference, ts);
+
+  // before the buffered range: the oldest element
+  probe.timestamp = 0;
+  BOOST_REQUIRE(buffer.lower_bound(probe) == buffer.begin());
+  // after the buffered range: end()
+  for (uint64_t ts : { uint64_t(5101), uint64_t(1) << 40, std::numeric_limits<uint64_t>::max() }) { // NOLINT
+    probe.timestamp = ts;
+    BOOST_REQUIRE(buffer.lower_bound(probe) == buffer.end());
+  }
+
+  // a window in the gap left by evicted buckets starts at the oldest remaining element
+  buffer.evict_before(5000);
+  reference.erase(reference.begin(), reference.begin() + 5);
+  probe.timestamp = 1050;
+  auto it = buffer.lower_bound(probe);
+  BOOST_REQUIRE(it == buffer.begin());
+  BOOST_REQUIRE_EQUAL(it->id, 5);
+  for (uint64_t ts = 4990; ts <= 5110; ++ts) // NOLINT(build/unsigned)
+    check_lower_bound(buffer, reference, ts);
+}
+
+BOOST_AUTO_TEST_SUITE_END()